@@ -0,0 +1,381 @@
+
+
+#include "decisionTrees.h"
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <sys/resource.h>
+#include <malloc.h>
+
+
+
+// Benchmark of tree construction, prediction and memory use on the bundled datasets and on synthetic
+// datasets of increasing size. Results are written as CSV rows (benchmark, metric, value), and can be
+// compared against the results of an earlier run.
+//
+// Usage: benchmark [--quick] [--threads 1,2,4] [--out results.csv] [--baseline old.csv] [--tolerance 0.1]
+//                  [--data path/to/examples]
+
+
+// Results as (benchmark, metric, value)
+typedef std::vector< std::tuple<std::string, std::string, double> > Results;
+
+
+
+// Reset the peak resident set size of the process to its current size, where the system allows it
+static void resetPeakMemory()
+{
+	std::ofstream file("/proc/self/clear_refs");
+	if (file.is_open())
+		file << "5";
+}
+
+
+
+// Heap memory in use by the process in kilobytes, or zero if it is not available
+static double heapMemory()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	return mallinfo2().uordblks / 1024.0;
+#else
+	return 0;
+#endif
+}
+
+
+
+// Peak resident set size of the process in kilobytes since the last reset
+static double peakMemory()
+{
+	std::ifstream file("/proc/self/status");
+	std::string str;
+	while (std::getline(file, str))
+		if (str.compare(0, 6, "VmHWM:") == 0)
+			return std::stod(str.substr(6));
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024.0;
+#else
+	return usage.ru_maxrss;
+#endif
+}
+
+
+
+// Wall-clock time in seconds taken by a function
+static double timeIt(const std::function<void()>& f)
+{
+	auto start = std::chrono::steady_clock::now();
+	f();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+
+
+// Read the dry beans dataset
+static void readBeans(const std::string& file, std::vector< std::vector<double> >& inputs, std::vector<std::string>& outputs)
+{
+	std::size_t D = 16;
+	std::ifstream inFile(file);
+	if (!inFile.is_open())
+	{
+		std::cerr << "Could not open " << file << '\n';
+		exit(1);
+	}
+	std::string str;
+	std::size_t pos;
+	std::getline(inFile, str);
+	while (std::getline(inFile, str))
+	{
+		std::vector<double> in(D);
+		for (std::size_t d = 0; d < D; ++d)
+		{
+			pos = str.find(',');
+			in[d] = std::stod(str.substr(0, pos));
+			str.erase(0, pos+1);
+		}
+		if (!str.empty() && str.back() == '\r')
+			str.pop_back();
+		inputs.push_back(in);
+		outputs.push_back(str);
+	}
+}
+
+
+
+// Read the real estate prices dataset, skipping its first column
+static void readEstate(const std::string& file, std::vector< std::vector<double> >& inputs, std::vector<double>& outputs)
+{
+	std::size_t D = 6;
+	std::ifstream inFile(file);
+	if (!inFile.is_open())
+	{
+		std::cerr << "Could not open " << file << '\n';
+		exit(1);
+	}
+	std::string str;
+	std::size_t pos;
+	std::getline(inFile, str);
+	while (std::getline(inFile, str))
+	{
+		pos = str.find(',');
+		str.erase(0, pos+1);
+		std::vector<double> in(D);
+		for (std::size_t d = 0; d < D; ++d)
+		{
+			pos = str.find(',');
+			in[d] = std::stod(str.substr(0, pos));
+			str.erase(0, pos+1);
+		}
+		inputs.push_back(in);
+		outputs.push_back(std::stod(str));
+	}
+}
+
+
+
+// Predict a batch of inputs, shared between a number of threads, and return the time taken
+template<typename Model, typename T>
+static double batchPredict(const Model& model, const std::vector< std::vector<T> >& in, const std::size_t& nrThreads)
+{
+	return timeIt([&]()
+	{
+		std::vector<std::thread> threads;
+		std::size_t chunk = (in.size() + nrThreads - 1) / nrThreads;
+		for (std::size_t t = 0; t < nrThreads; ++t)
+			threads.emplace_back([&model, &in, t, chunk]()
+			{
+				for (std::size_t i = t*chunk; i < std::min(in.size(), (t+1)*chunk); ++i)
+				{
+					volatile auto y = model.predict(in[i]);
+					(void) y;
+				}
+			});
+		for (auto& thread : threads)
+			thread.join();
+	});
+}
+
+
+
+// Benchmark one model: build time, latency of single predictions, batch throughput for each number of
+// threads, out-of-bag scoring time for bagged models, test error, the heap memory kept by the model after
+// building and the peak memory of the process
+template<typename Model, typename T, typename U>
+static void benchmark(Results& results, const std::string& name, Model& model, const std::function<void(Model&)>& build,
+		const std::vector< std::vector<T> >& testIn, const std::vector<U>& testOut, const std::vector<std::size_t>& threads)
+{
+	std::cout << "Benchmarking " << name << '\n';
+	resetPeakMemory();
+	double before = heapMemory();
+	results.push_back(std::make_tuple(name, "build_s", timeIt([&]() {build(model);})));
+	results.push_back(std::make_tuple(name, "model_heap_kb", heapMemory() - before));
+
+	std::size_t M = std::min<std::size_t>(testIn.size(), 2000);
+	std::vector<double> latency(M);
+	for (std::size_t i = 0; i < M; ++i)
+		latency[i] = 1e6 * timeIt([&]() {volatile auto y = model.predict(testIn[i]); (void) y;});
+	std::sort(latency.begin(), latency.end());
+	results.push_back(std::make_tuple(name, "predict_p50_us", latency[M/2]));
+	results.push_back(std::make_tuple(name, "predict_p99_us", latency[std::min(M-1, M*99/100)]));
+
+	std::vector< std::vector<T> > batch;
+	while (batch.size() < 20000)
+		batch.insert(batch.end(), testIn.begin(), testIn.end());
+	for (std::size_t nrThreads : threads)
+		results.push_back(std::make_tuple(name, "batch_rows_per_s_" + std::to_string(nrThreads) + "t",
+						  batch.size() / batchPredict(model, batch, nrThreads)));
+
+	if constexpr (std::is_same< Model, BaggedClassificationTrees<T, U> >::value || std::is_same< Model, BaggedRegressionTrees<T, U> >::value)
+		results.push_back(std::make_tuple(name, "oob_s", timeIt([&]() {model.outOfBagError();})));
+	if constexpr (std::is_floating_point<U>::value)
+		results.push_back(std::make_tuple(name, "test_mse", meanSquareError<Model, T, U>(model, testIn, testOut)));
+	else
+		results.push_back(std::make_tuple(name, "test_error", classificationError<Model, T, U>(model, testIn, testOut)));
+	results.push_back(std::make_tuple(name, "peak_rss_kb", peakMemory()));
+}
+
+
+
+// Benchmark a single tree and a set of bagged trees on a classification dataset
+template<typename U>
+static void classification(Results& results, const std::string& name, const std::vector< std::vector<double> >& in,
+		const std::vector<U>& out, const std::size_t& nrTrees, const std::vector<std::size_t>& threads)
+{
+	auto pr = splitDataset<double, U>(in, out, 20);
+	auto& trainIn = pr.first.first;
+	auto& trainOut = pr.first.second;
+	std::size_t subD = std::max<std::size_t>(1, std::lround(std::sqrt(in[0].size())));
+
+	ClassificationTree<double, U> tree(trainIn, trainOut);
+	tree.setGrowth('l');
+	benchmark< ClassificationTree<double, U>, double, U >(results, name + "/tree", tree,
+		[](ClassificationTree<double, U>& m) {m.buildTree();}, pr.second.first, pr.second.second, threads);
+
+	BaggedClassificationTrees<double, U> bagged(trainIn, trainOut, nrTrees);
+	bagged.setGrowth('l');
+	bagged.setNrSelectedFeatures(subD);
+	benchmark< BaggedClassificationTrees<double, U>, double, U >(results, name + "/bagged" + std::to_string(nrTrees), bagged,
+		[](BaggedClassificationTrees<double, U>& m) {m.buildTrees();}, pr.second.first, pr.second.second, threads);
+}
+
+
+
+// Benchmark a single tree and a set of bagged trees on a regression dataset
+static void regression(Results& results, const std::string& name, const std::vector< std::vector<double> >& in,
+		const std::vector<double>& out, const std::size_t& nrTrees, const std::vector<std::size_t>& threads)
+{
+	auto pr = splitDataset<double, double>(in, out, 20);
+	auto& trainIn = pr.first.first;
+	auto& trainOut = pr.first.second;
+
+	RegressionTree<double, double> tree(trainIn, trainOut);
+	tree.setGrowth('l');
+	benchmark< RegressionTree<double, double>, double, double >(results, name + "/tree", tree,
+		[](RegressionTree<double, double>& m) {m.buildTree();}, pr.second.first, pr.second.second, threads);
+
+	BaggedRegressionTrees<double, double> bagged(trainIn, trainOut, nrTrees);
+	bagged.setGrowth('l');
+	benchmark< BaggedRegressionTrees<double, double>, double, double >(results, name + "/bagged" + std::to_string(nrTrees), bagged,
+		[](BaggedRegressionTrees<double, double>& m) {m.buildTrees();}, pr.second.first, pr.second.second, threads);
+}
+
+
+
+// Read results written by an earlier run
+static Results readResults(const std::string& file)
+{
+	Results results;
+	std::ifstream inFile(file);
+	if (!inFile.is_open())
+	{
+		std::cerr << "Could not open " << file << '\n';
+		exit(1);
+	}
+	std::string str, name, metric, value;
+	std::getline(inFile, str);
+	while (std::getline(inFile, str))
+	{
+		std::stringstream ss(str);
+		std::getline(ss, name, ','); std::getline(ss, metric, ','); std::getline(ss, value);
+		results.push_back(std::make_tuple(name, metric, std::stod(value)));
+	}
+	return results;
+}
+
+
+
+// Compare results against a baseline, and return the number of metrics which got worse by more than the
+// tolerance. Throughput is better when higher, all other metrics when lower. Test errors depend on the random
+// split of the data, so they are shown but not counted.
+static std::size_t compare(const Results& results, const Results& baseline, const double& tol)
+{
+	std::map< std::pair<std::string, std::string>, double > base;
+	for (const auto& r : baseline)
+		base[std::make_pair(std::get<0>(r), std::get<1>(r))] = std::get<2>(r);
+
+	std::size_t worse = 0;
+	std::cout << "\nComparison with baseline (ratio = new / baseline):\n";
+	std::cout << std::setw(36) << "Benchmark" << std::setw(26) << "Metric" << std::setw(14) << "Baseline"
+	          << std::setw(14) << "New" << std::setw(10) << "Ratio" << '\n';
+	for (const auto& r : results)
+	{
+		auto search = base.find(std::make_pair(std::get<0>(r), std::get<1>(r)));
+		if (search == base.end() || search->second == 0)
+			continue;
+		double ratio = std::get<2>(r) / search->second;
+		bool higherBetter = std::get<1>(r).find("rows_per_s") != std::string::npos;
+		bool regressed = std::get<1>(r).compare(0, 5, "test_") != 0 && (higherBetter ? ratio < 1 / (1 + tol) : ratio > 1 + tol);
+		worse += regressed;
+		std::cout << std::setw(36) << std::get<0>(r) << std::setw(26) << std::get<1>(r) << std::setw(14) << search->second
+		          << std::setw(14) << std::get<2>(r) << std::setw(10) << ratio << (regressed ? "  WORSE" : "") << '\n';
+	}
+	std::cout << worse << " metrics worse than the baseline by more than " << 100*tol << "%\n";
+	return worse;
+}
+
+
+
+int main(int argc, char* argv[])
+{
+	// Read options
+	bool quick = false;
+	std::vector<std::size_t> threads{1, 2, 4};
+	std::string out = "benchmark results.csv", baseline, data = "..";
+	double tol = 0.1;
+	for (int a = 1; a < argc; ++a)
+	{
+		std::string arg = argv[a];
+		if (arg == "--quick")
+			quick = true;
+		else if (arg == "--threads" && a+1 < argc)
+		{
+			threads.clear();
+			std::stringstream ss(argv[++a]);
+			std::string t;
+			while (std::getline(ss, t, ','))
+				threads.push_back(std::stoul(t));
+		}
+		else if (arg == "--out" && a+1 < argc)
+			out = argv[++a];
+		else if (arg == "--baseline" && a+1 < argc)
+			baseline = argv[++a];
+		else if (arg == "--tolerance" && a+1 < argc)
+			tol = std::stod(argv[++a]);
+		else if (arg == "--data" && a+1 < argc)
+			data = argv[++a];
+		else
+		{
+			std::cerr << "Usage: benchmark [--quick] [--threads 1,2,4] [--out results.csv] [--baseline old.csv] "
+			          << "[--tolerance 0.1] [--data path/to/examples]\n";
+			return 1;
+		}
+	}
+	std::size_t nrTrees = quick ? 5 : 20;
+	Results results;
+
+	// Bundled datasets
+	std::vector< std::vector<double> > beanIn, estateIn;
+	std::vector<std::string> beanOut;
+	std::vector<double> estateOut;
+	readBeans(data + "/classification/dry beans.csv", beanIn, beanOut);
+	readEstate(data + "/regression/real estate prices.csv", estateIn, estateOut);
+	classification(results, "beans", beanIn, beanOut, nrTrees, threads);
+	regression(results, "estate", estateIn, estateOut, nrTrees, threads);
+
+	// Synthetic datasets, scaling the number of examples, features and classes
+	std::vector< std::tuple<std::size_t, std::size_t, std::size_t> > sizes{{5000, 10, 2}, {5000, 10, 10}, {5000, 50, 2}};
+	if (!quick)
+	{
+		sizes.push_back(std::make_tuple(50000, 10, 2));
+		sizes.push_back(std::make_tuple(50000, 50, 10));
+	}
+	for (const auto& sz : sizes)
+	{
+		std::size_t N = std::get<0>(sz), D = std::get<1>(sz), C = std::get<2>(sz);
+		auto cls = syntheticClassification(N, D, C, 1);
+		classification(results, "synthetic_N" + std::to_string(N) + "_D" + std::to_string(D) + "_C" + std::to_string(C),
+					   cls.first, cls.second, nrTrees, threads);
+	}
+	auto reg = syntheticRegression(quick ? 5000 : 50000, 10, 1);
+	regression(results, "synthetic_regression_N" + std::to_string(reg.first.size()) + "_D10", reg.first, reg.second, nrTrees, threads);
+
+	// Write and display results
+	std::ofstream outFile(out);
+	outFile << "benchmark,metric,value\n";
+	outFile << std::setprecision(10);
+	for (const auto& r : results)
+		outFile << std::get<0>(r) << ',' << std::get<1>(r) << ',' << std::get<2>(r) << '\n';
+	std::cout << "\n\nResults written to " << out << ":\n";
+	for (const auto& r : results)
+		std::cout << std::setw(36) << std::get<0>(r) << std::setw(26) << std::get<1>(r) << std::setw(14) << std::get<2>(r) << '\n';
+
+	if (!baseline.empty())
+		return compare(results, readResults(baseline), tol) > 0 ? 2 : 0;
+	return 0;
+}
@@ -0,0 +1,544 @@
+
+
+#include "decisionTrees.h"
+#include <cstdio>
+#include <cstring>
+#include <charconv>
+#include <string>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <atomic>
+#include <exception>
+
+
+
+// Command-line tool to train and save a model, and to score large files of inputs with a saved model.
+//
+// Usage: score train --data train.csv --model model.dtm [--task c|r] [--trees 50] [--max-depth d]
+//                    [--compact t|b] [--header] [--skip 0]
+//        score predict --model model.dtm --input inputs.csv [--output predictions.txt] [--header] [--skip 0]
+//                      [--binary --features D] [--threads N] [--chunk-mb 4] [--batch 1024]
+//
+// Training reads a CSV file into memory, taking the last column as the output: labels for classification
+// (--task c, default) and numbers for regression (--task r). It builds bagged trees, or a single tree if
+// --trees is 1, and saves them as a prediction-only model.
+//
+// Scoring streams the input through a bounded pipeline, so that its memory does not depend on the size of
+// the file. A reader thread reads the file in chunks ending at a line (or record) boundary, a pool of
+// workers parses each chunk and predicts its rows in batches, and a writer thread writes the predictions
+// of the chunks in their original order, one per line. Only a fixed number of chunks is in flight at once,
+// and each chunk buffer is reused. Inputs are CSV text, or with --binary, records of D doubles in the byte
+// order of the machine. The first --skip columns of each CSV row (for example an identifier) are ignored,
+// and so are any columns after the features read by the model.
+
+
+// Options of the command line
+class Options
+{
+public:
+	std::string command, data, model, input, output;
+	char task{'c'}, compact{'f'};
+	bool header{false}, binary{false};
+	std::size_t trees{50}, maxDepth{0}, skip{0}, features{0}, batch{1024}, chunkBytes{4 << 20};
+	std::size_t threads{std::max(1u, std::thread::hardware_concurrency())};
+};
+
+
+
+// Queue between two stages of the pipeline, which can be closed to end the stage reading from it
+template<typename X>
+class Queue
+{
+	std::mutex lock;
+	std::condition_variable ready;
+	std::deque<X> items;
+	bool closed{false};
+
+public:
+
+	// Add an item
+	void push(X x)
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			items.push_back(std::move(x));
+		}
+		ready.notify_one();
+	}
+
+	// Take the next item, waiting for one, or return false once the queue is closed and empty
+	bool pop(X& x)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		ready.wait(guard, [this]() {return closed || !items.empty();});
+		if (items.empty())
+			return false;
+		x = std::move(items.front());
+		items.pop_front();
+		return true;
+	}
+
+	// Close the queue
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			closed = true;
+		}
+		ready.notify_all();
+	}
+};
+
+
+
+// Chunk of the input in flight: its position in the file, its bytes and the predictions of its rows
+class Chunk
+{
+public:
+	std::size_t seq{0}, rows{0};
+	std::vector<char> bytes;
+	std::string output;
+};
+
+
+
+// Split a CSV line into its fields, skipping the first 'skip' fields
+static void splitFields(const char* begin, const char* end, const std::size_t& skip, std::vector< std::pair<const char*, const char*> >& fields)
+{
+	fields.clear();
+	std::size_t f = 0;
+	while (true)
+	{
+		const char* comma = std::find(begin, end, ',');
+		if (f++ >= skip)
+			fields.push_back(std::make_pair(begin, comma));
+		if (comma == end)
+			break;
+		begin = comma + 1;
+	}
+}
+
+
+
+// Parse a number from a field, ignoring surrounding spaces
+static double parseNumber(const char* begin, const char* end)
+{
+	while (begin < end && (*begin == ' ' || *begin == '"'))
+		++begin;
+	while (end > begin && (end[-1] == ' ' || end[-1] == '"'))
+		--end;
+	double v;
+	auto result = std::from_chars(begin, end, v);
+	if (result.ec != std::errc() || result.ptr != end)
+		throw std::invalid_argument("Value '" + std::string(begin, end) + "' could not be parsed as a number\n");
+	return v;
+}
+
+
+
+// Append a prediction to the output of a chunk, as one line
+template<typename U>
+static void appendValue(std::string& out, const U& v)
+{
+	if constexpr (std::is_same<U, std::string>::value)
+		out += v;
+	else
+	{
+		char buffer[64];
+		auto result = std::to_chars(buffer, buffer + sizeof(buffer), v);
+		out.append(buffer, result.ptr);
+	}
+	out += '\n';
+}
+
+
+
+// Peak resident set size of the process in megabytes, or zero if it is not available
+static double peakMemory()
+{
+	std::ifstream file("/proc/self/status");
+	std::string str;
+	while (std::getline(file, str))
+		if (str.compare(0, 6, "VmHWM:") == 0)
+			return std::stod(str.substr(6)) / 1024;
+	return 0;
+}
+
+
+
+// Parse the rows of a chunk and predict them in batches, appending the predictions to the output of the chunk
+template<typename U, typename Model>
+static void scoreChunk(const Model& model, const Options& opt, const std::size_t& D, Chunk& chunk,
+		std::vector< std::vector<double> >& rows, std::vector< std::pair<const char*, const char*> >& fields)
+{
+	chunk.output.clear();
+	chunk.rows = 0;
+	std::size_t k = 0;
+	auto flush = [&]()
+	{
+		rows.resize(k);
+		for (const U& y : predictRows<U>(model, rows))
+			appendValue(chunk.output, y);
+		chunk.rows += k;
+		k = 0;
+	};
+	auto nextRow = [&]() -> std::vector<double>&
+	{
+		if (rows.size() <= k)
+			rows.resize(k + 1);
+		rows[k].clear();
+		return rows[k++];
+	};
+
+	const char* p = chunk.bytes.data();
+	const char* end = p + chunk.bytes.size();
+	if (opt.binary)
+	{
+		for (; p + D * sizeof(double) <= end; p += D * sizeof(double))
+		{
+			auto& row = nextRow();
+			row.resize(D);
+			std::memcpy(row.data(), p, D * sizeof(double));
+			if (k == opt.batch)
+				flush();
+		}
+	}
+	else
+	{
+		if (chunk.seq == 0 && opt.header)
+		{
+			const char* eol = std::find(p, end, '\n');
+			p = eol == end ? end : eol + 1;
+		}
+		while (p < end)
+		{
+			const char* eol = std::find(p, end, '\n');
+			const char* last = eol;
+			if (last > p && last[-1] == '\r')
+				--last;
+			if (last > p)
+			{
+				splitFields(p, last, opt.skip, fields);
+				if (fields.size() < D)
+					throw std::invalid_argument("Row has " + std::to_string(fields.size()) + " values, but the model reads "
+							+ std::to_string(D) + " features\n");
+				auto& row = nextRow();
+				for (std::size_t d = 0; d < D; ++d)
+					row.push_back(parseNumber(fields[d].first, fields[d].second));
+				if (k == opt.batch)
+					flush();
+			}
+			p = eol + (eol != end);
+		}
+	}
+	if (k > 0)
+		flush();
+}
+
+
+
+// Score the input file with a model through the pipeline read -> parse and predict -> ordered write
+template<typename U, typename Model>
+static void score(const Model& model, const Options& opt)
+{
+	std::size_t D = opt.binary ? opt.features : model.featureCount();
+	if (opt.binary && D < model.featureCount())
+		throw std::invalid_argument("Binary records have " + std::to_string(D) + " features, but the model reads "
+				+ std::to_string(model.featureCount()) + "\n");
+	std::FILE* in = std::fopen(opt.input.c_str(), "rb");
+	if (!in)
+		throw std::invalid_argument("Input file " + opt.input + " could not be opened\n");
+	std::FILE* out = opt.output.empty() ? stdout : std::fopen(opt.output.c_str(), "wb");
+	if (!out)
+		throw std::invalid_argument("Output file " + opt.output + " could not be opened\n");
+
+	// First failure of any stage, after which the remaining chunks pass through without work
+	std::mutex failureLock;
+	std::exception_ptr failure;
+	std::atomic<bool> failed{false};
+	auto fail = [&](std::exception_ptr e)
+	{
+		std::lock_guard<std::mutex> guard(failureLock);
+		if (!failure)
+			failure = e;
+		failed = true;
+	};
+
+	std::vector<Chunk> chunks(2 * opt.threads + 2);
+	Queue<Chunk*> freeChunks, parseQueue, writeQueue;
+	for (auto& chunk : chunks)
+		freeChunks.push(&chunk);
+
+	// Workers parse and predict chunks in any order
+	std::vector<std::thread> workers;
+	for (std::size_t w = 0; w < opt.threads; ++w)
+		workers.emplace_back([&]()
+		{
+			std::vector< std::vector<double> > rows;
+			std::vector< std::pair<const char*, const char*> > fields;
+			Chunk* chunk;
+			while (parseQueue.pop(chunk))
+			{
+				if (!failed)
+				{
+					try {scoreChunk<U>(model, opt, D, *chunk, rows, fields);}
+					catch (...) {fail(std::current_exception());}
+				}
+				writeQueue.push(chunk);
+			}
+		});
+
+	// The writer holds back chunks that finish early, and writes each chunk once all earlier ones are written
+	std::size_t nrRows = 0;
+	std::thread writer([&]()
+	{
+		std::map<std::size_t, Chunk*> waiting;
+		std::size_t next = 0;
+		Chunk* chunk;
+		while (writeQueue.pop(chunk))
+		{
+			waiting[chunk->seq] = chunk;
+			for (auto it = waiting.find(next); it != waiting.end(); it = waiting.find(++next))
+			{
+				chunk = it->second;
+				waiting.erase(it);
+				if (!failed && std::fwrite(chunk->output.data(), 1, chunk->output.size(), out) != chunk->output.size())
+					fail(std::make_exception_ptr(std::invalid_argument("Predictions could not be written\n")));
+				nrRows += chunk->rows;
+				freeChunks.push(chunk);
+			}
+		}
+	});
+
+	// Read chunks ending at a line or record boundary, carrying the rest over to the next chunk
+	std::size_t record = opt.binary ? D * sizeof(double) : 1;
+	std::vector<char> carry;
+	std::size_t seq = 0;
+	bool end = false;
+	Chunk* chunk;
+	while (!end && !failed && freeChunks.pop(chunk))
+	{
+		chunk->bytes.assign(carry.begin(), carry.end());
+		std::size_t size = carry.size();
+		chunk->bytes.resize(size + opt.chunkBytes);
+		std::size_t got = std::fread(chunk->bytes.data() + size, 1, opt.chunkBytes, in);
+		size += got;
+		chunk->bytes.resize(size);
+		end = got < opt.chunkBytes;
+		if (std::ferror(in))
+			fail(std::make_exception_ptr(std::invalid_argument("Input file could not be read\n")));
+
+		std::size_t cut = size;
+		if (opt.binary)
+			cut = size / record * record;
+		else if (!end)
+		{
+			auto eol = std::find(chunk->bytes.rbegin(), chunk->bytes.rend(), '\n');
+			if (eol == chunk->bytes.rend())
+				fail(std::make_exception_ptr(std::invalid_argument("A line of the input is longer than the chunk size\n")));
+			cut = chunk->bytes.rend() - eol;
+		}
+		carry.assign(chunk->bytes.begin() + cut, chunk->bytes.end());
+		chunk->bytes.resize(cut);
+		chunk->seq = seq++;
+		parseQueue.push(chunk);
+	}
+	if (end && !carry.empty())
+		fail(std::make_exception_ptr(std::invalid_argument("Binary input ends with an incomplete record\n")));
+
+	parseQueue.close();
+	for (auto& worker : workers)
+		worker.join();
+	writeQueue.close();
+	writer.join();
+	std::fclose(in);
+	if (out != stdout)
+		std::fclose(out);
+	else
+		std::fflush(stdout);
+	if (failure)
+		std::rethrow_exception(failure);
+	std::cerr << "Scored " << nrRows << " rows\n";
+}
+
+
+
+// Read a CSV file of training data into memory, with the last column as the output
+template<typename U>
+static void readTrainingData(const Options& opt, std::vector< std::vector<double> >& in, std::vector<U>& out)
+{
+	std::ifstream file(opt.data);
+	if (!file)
+		throw std::invalid_argument("Training data " + opt.data + " could not be opened\n");
+	std::string line;
+	std::vector< std::pair<const char*, const char*> > fields;
+	if (opt.header)
+		std::getline(file, line);
+	while (std::getline(file, line))
+	{
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (line.empty())
+			continue;
+		splitFields(line.data(), line.data() + line.size(), opt.skip, fields);
+		if (fields.size() < 2)
+			throw std::invalid_argument("Each row of the training data needs at least one input and an output\n");
+		std::vector<double> x;
+		for (std::size_t f = 0; f + 1 < fields.size(); ++f)
+			x.push_back(parseNumber(fields[f].first, fields[f].second));
+		if constexpr (std::is_same<U, std::string>::value)
+			out.push_back(std::string(fields.back().first, fields.back().second));
+		else
+			out.push_back(parseNumber(fields.back().first, fields.back().second));
+		in.push_back(x);
+	}
+	if (in.empty())
+		throw std::invalid_argument("Training data is empty\n");
+}
+
+
+
+// Train a single tree or bagged trees, and save them as a prediction-only model
+template<typename Tree, typename Bagged, typename U>
+static void train(const Options& opt)
+{
+	std::vector< std::vector<double> > in;
+	std::vector<U> out;
+	readTrainingData(opt, in, out);
+	std::cerr << "Training on " << in.size() << " rows with " << in[0].size() << " features\n";
+	if (opt.trees == 1)
+	{
+		Tree tree(in, out);
+		if (opt.maxDepth)
+			tree.setMaxDepth(opt.maxDepth);
+		tree.buildTree();
+		auto predictor = tree.freeze();
+		if (opt.compact != 'f')
+			predictor.compact(opt.compact, in);
+		predictor.save(opt.model);
+	}
+	else
+	{
+		Bagged bagged(in, out, opt.trees);
+		if (opt.maxDepth)
+			bagged.setMaxDepth(opt.maxDepth);
+		bagged.buildTrees();
+		auto predictor = bagged.toPredictor();
+		if (opt.compact != 'f')
+			predictor.compact(opt.compact, in);
+		predictor.save(opt.model);
+	}
+	std::cerr << "Saved the model to " << opt.model << '\n';
+}
+
+
+
+// Load a saved model with outputs of type U and score the input with it
+template<typename U>
+static void loadAndScore(const ModelHeader& header, const Options& opt)
+{
+	if (header.model == 't')
+		score<U>(TreePredictor<double, U>::load(opt.model), opt);
+	else
+		score<U>(ForestPredictor<double, U>::load(opt.model), opt);
+}
+
+
+
+int main(int argc, char* argv[])
+{
+	Options opt;
+	if (argc < 2)
+	{
+		std::cerr << "Usage: score train --data train.csv --model model.dtm [options]\n"
+			  << "       score predict --model model.dtm --input inputs.csv [options]\n";
+		return 1;
+	}
+	opt.command = argv[1];
+	for (int a = 2; a < argc; ++a)
+	{
+		std::string arg = argv[a];
+		if (arg == "--header")
+			opt.header = true;
+		else if (arg == "--binary")
+			opt.binary = true;
+		else if (a + 1 < argc)
+		{
+			std::string value = argv[++a];
+			if (arg == "--data") opt.data = value;
+			else if (arg == "--model") opt.model = value;
+			else if (arg == "--input") opt.input = value;
+			else if (arg == "--output") opt.output = value;
+			else if (arg == "--task") opt.task = value[0];
+			else if (arg == "--compact") opt.compact = value[0];
+			else if (arg == "--trees") opt.trees = std::stoul(value);
+			else if (arg == "--max-depth") opt.maxDepth = std::stoul(value);
+			else if (arg == "--skip") opt.skip = std::stoul(value);
+			else if (arg == "--features") opt.features = std::stoul(value);
+			else if (arg == "--threads") opt.threads = std::max<std::size_t>(1, std::stoul(value));
+			else if (arg == "--batch") opt.batch = std::max<std::size_t>(1, std::stoul(value));
+			else if (arg == "--chunk-mb") opt.chunkBytes = std::max<std::size_t>(1, std::stod(value) * 1048576);
+			else
+			{
+				std::cerr << "Unknown option " << arg << '\n';
+				return 1;
+			}
+		}
+		else
+		{
+			std::cerr << "Option " << arg << " needs a value\n";
+			return 1;
+		}
+	}
+
+	try
+	{
+		if (opt.command == "train")
+		{
+			if (opt.data.empty() || opt.model.empty())
+				throw std::invalid_argument("Training needs --data and --model\n");
+			if (opt.task == 'r')
+				train< RegressionTree<double, double>, BaggedRegressionTrees<double, double>, double >(opt);
+			else
+				train< ClassificationTree<double, std::string>, BaggedClassificationTrees<double, std::string>, std::string >(opt);
+		}
+		else if (opt.command == "predict")
+		{
+			if (opt.model.empty() || opt.input.empty())
+				throw std::invalid_argument("Scoring needs --model and --input\n");
+			if (opt.binary && opt.features == 0)
+				throw std::invalid_argument("Binary input needs --features\n");
+			auto start = std::chrono::steady_clock::now();
+			ModelHeader header = readModelHeader(opt.model);
+			if (header.input != 'f' || header.inputSize != sizeof(double))
+				throw std::invalid_argument("Only models with double inputs can be used for scoring\n");
+			if (header.output == 's')
+				loadAndScore<std::string>(header, opt);
+			else if (header.output == 'f' && header.outputSize == sizeof(double))
+				loadAndScore<double>(header, opt);
+			else if (header.output == 'f' && header.outputSize == sizeof(float))
+				loadAndScore<float>(header, opt);
+			else if (header.output == 'i' && header.outputSize == sizeof(int))
+				loadAndScore<int>(header, opt);
+			else if (header.output == 'i' && header.outputSize == sizeof(long long))
+				loadAndScore<long long>(header, opt);
+			else
+				throw std::invalid_argument("Model outputs have a type which cannot be used for scoring\n");
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			std::cerr << "Time: " << elapsed.count() << " s, peak memory: " << peakMemory() << " MB\n";
+		}
+		else
+			throw std::invalid_argument("Unknown command " + opt.command + ", which must be 'train' or 'predict'\n");
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Error: " << e.what();
+		return 1;
+	}
+	return 0;
+}
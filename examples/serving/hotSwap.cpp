@@ -0,0 +1,233 @@
+
+
+#include "decisionTrees.h"
+#include <string>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <functional>
+
+
+
+// Stress test of replacing the model of a live server. Prediction threads predict in a loop while a writer
+// thread keeps installing new models, and the latency of each prediction is recorded. The test runs three
+// phases of equal length:
+//  - steady: the writer prepares new models but never installs them
+//  - rcu:    the writer installs each new model through a ModelHandle
+//  - mutex:  the writer installs each new model into a std::shared_ptr guarded by a mutex, for comparison
+// The models of the pool have different numbers of trees, so every prediction can be checked against the
+// model it was made by. The program exits with code 1 if any prediction is wrong, and with code 2 if the
+// 99th-percentile latency while swapping through the handle exceeds that of the steady phase by more than
+// the given factor.
+//
+// Usage: hotSwap [--readers 2] [--seconds 2] [--swap-us 1000] [--tolerance 2]
+
+
+typedef ForestPredictor<double, int> Model;
+
+// Check of the prediction of a model for the input with the given position
+typedef std::function<bool(const Model&, const std::size_t&)> Check;
+
+
+
+// Latencies in microseconds of the predictions of one phase, and the number of models installed
+struct Phase
+{
+	std::string name;
+	std::vector<double> latency;
+	std::size_t swaps{0}, wrong{0};
+};
+
+
+
+// Reader taking a snapshot of the model of a handle for each prediction
+struct HandleRead
+{
+	ModelHandle<Model>& handle;
+	const Check& check;
+	ModelHandle<Model>::Reader begin() {return handle.reader();}
+	bool operator()(ModelHandle<Model>::Reader& reader, const std::size_t& i) {auto model = reader.read(); return check(*model, i);}
+};
+
+
+
+// Reader copying the shared pointer to the model under a mutex for each prediction
+struct MutexRead
+{
+	std::mutex& lock;
+	std::shared_ptr<const Model>& shared;
+	const Check& check;
+	int begin() {return 0;}
+	bool operator()(int&, const std::size_t& i)
+	{
+		std::shared_ptr<const Model> model;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			model = shared;
+		}
+		return check(*model, i);
+	}
+};
+
+
+
+// Run one phase. The reader function predicts one input with the current model, returning whether the
+// prediction is correct, and the writer function installs (or only prepares) the model of the pool with the
+// given position.
+template<typename Read, typename Write>
+static void runPhase(Phase& phase, const std::size_t& nrReaders, const double& seconds, const std::size_t& swapMicros,
+		const std::size_t& nrModels, Read read, Write write)
+{
+	std::atomic<bool> stop{false};
+	std::vector< std::vector<double> > latency(nrReaders);
+	std::vector<std::size_t> wrong(nrReaders, 0);
+	std::vector<std::thread> readers;
+	for (std::size_t r = 0; r < nrReaders; ++r)
+		readers.emplace_back([&, r]()
+		{
+			auto state = read.begin();
+			latency[r].reserve(1 << 20);
+			for (std::size_t i = r; !stop.load(std::memory_order_relaxed); ++i)
+			{
+				auto start = std::chrono::steady_clock::now();
+				bool correct = read(state, i);
+				std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+				latency[r].push_back(elapsed.count());
+				wrong[r] += !correct;
+			}
+		});
+
+	auto end = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+	while (std::chrono::steady_clock::now() < end)
+	{
+		write(phase.swaps % nrModels);
+		++phase.swaps;
+		std::this_thread::sleep_for(std::chrono::microseconds(swapMicros));
+	}
+	stop = true;
+	for (auto& thread : readers)
+		thread.join();
+
+	for (std::size_t r = 0; r < nrReaders; ++r)
+	{
+		phase.latency.insert(phase.latency.end(), latency[r].begin(), latency[r].end());
+		phase.wrong += wrong[r];
+	}
+	std::sort(phase.latency.begin(), phase.latency.end());
+}
+
+
+
+// Latency at the given quantile
+static double quantile(const std::vector<double>& sorted, const double& q)
+{
+	return sorted.empty() ? 0 : sorted[std::min(sorted.size() - 1, (std::size_t)(q * sorted.size()))];
+}
+
+
+
+int main(int argc, char* argv[])
+{
+	std::size_t nrReaders = 2, swapMicros = 1000;
+	double seconds = 2, tolerance = 2;
+	for (int a = 1; a + 1 < argc; a += 2)
+	{
+		std::string arg = argv[a];
+		if (arg == "--readers")
+			nrReaders = std::stoul(argv[a+1]);
+		else if (arg == "--seconds")
+			seconds = std::stod(argv[a+1]);
+		else if (arg == "--swap-us")
+			swapMicros = std::stoul(argv[a+1]);
+		else if (arg == "--tolerance")
+			tolerance = std::stod(argv[a+1]);
+		else
+		{
+			std::cerr << "Unknown option " << arg << '\n';
+			return 1;
+		}
+	}
+
+
+	// Build a pool of models with 10, 11, 12 and 13 trees, and the prediction of each model for each input
+	std::size_t nrModels = 4, firstSize = 10;
+	auto data = syntheticClassification(5000, 12, 4, 1);
+	std::vector<Model> pool;
+	for (std::size_t m = 0; m < nrModels; ++m)
+	{
+		BaggedClassificationTrees<double, int> bagged(data.first, data.second, firstSize + m);
+		bagged.setMaxDepth(12);
+		bagged.buildTrees();
+		pool.push_back(bagged.toPredictor());
+	}
+	const auto& inputs = data.first;
+	std::vector< std::vector<int> > expected(nrModels, std::vector<int>(inputs.size()));
+	for (std::size_t m = 0; m < nrModels; ++m)
+		for (std::size_t i = 0; i < inputs.size(); ++i)
+			expected[m][i] = pool[m].predict(inputs[i]);
+
+	// Check a prediction of the model, which is identified by its number of trees
+	Check check = [&](const Model& model, const std::size_t& i)
+	{
+		std::size_t n = i % inputs.size();
+		return model.predict(inputs[n]) == expected[model.size() - firstSize][n];
+	};
+
+
+	// Phase without swaps, in which the writer still copies a model of the pool for each swap
+	ModelHandle<Model> handle(pool[0], nrReaders);
+	std::vector<Phase> phases(3);
+	phases[0].name = "steady";
+	runPhase(phases[0], nrReaders, seconds, swapMicros, nrModels, HandleRead{handle, check},
+		 [&](const std::size_t& m) {Model copy(pool[m]); (void) copy;});
+
+	// Phase with swaps through the handle
+	phases[1].name = "rcu";
+	runPhase(phases[1], nrReaders, seconds, swapMicros, nrModels, HandleRead{handle, check},
+		 [&](const std::size_t& m) {handle.publish(pool[m]);});
+
+	// Phase with swaps of a shared pointer guarded by a mutex, where the last holder of a model deletes it
+	phases[2].name = "mutex";
+	std::mutex lock;
+	std::shared_ptr<const Model> shared = std::make_shared<const Model>(pool[0]);
+	runPhase(phases[2], nrReaders, seconds, swapMicros, nrModels, MutexRead{lock, shared, check},
+		 [&](const std::size_t& m)
+		 {
+			 std::shared_ptr<const Model> model = std::make_shared<const Model>(pool[m]);
+			 std::lock_guard<std::mutex> guard(lock);
+			 shared.swap(model);
+		 });
+
+
+	// Display the results
+	handle.synchronize();
+	std::cout << std::setw(8) << "Phase" << std::setw(14) << "Predictions" << std::setw(8) << "Swaps" << std::setw(8) << "Wrong"
+		  << std::setw(12) << "p50 (us)" << std::setw(12) << "p99 (us)" << std::setw(12) << "p99.9 (us)" << std::setw(12) << "max (us)" << '\n';
+	std::size_t wrong = 0;
+	for (const auto& phase : phases)
+	{
+		std::cout << std::setw(8) << phase.name << std::setw(14) << phase.latency.size() << std::setw(8) << phase.swaps
+			  << std::setw(8) << phase.wrong << std::setw(12) << quantile(phase.latency, 0.5) << std::setw(12)
+			  << quantile(phase.latency, 0.99) << std::setw(12) << quantile(phase.latency, 0.999) << std::setw(12)
+			  << phase.latency.back() << '\n';
+		wrong += phase.wrong;
+	}
+	std::cout << "Models published through the handle: " << handle.version() << ", retired and not yet deleted: "
+		  << handle.retiredCount() << '\n';
+
+	if (wrong)
+	{
+		std::cout << "FAILED: " << wrong << " wrong predictions\n";
+		return 1;
+	}
+	double ratio = quantile(phases[1].latency, 0.99) / quantile(phases[0].latency, 0.99);
+	std::cout << "p99 while swapping / steady p99: " << ratio << '\n';
+	if (ratio > tolerance)
+	{
+		std::cout << "FAILED: p99 latency rose by more than a factor " << tolerance << " while swapping\n";
+		return 2;
+	}
+	return 0;
+}
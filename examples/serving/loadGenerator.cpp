@@ -0,0 +1,227 @@
+
+
+#include "decisionTrees.h"
+#include <string>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+
+
+// Load generator for the in-process prediction service. Client threads submit single inputs and wait for
+// their predictions, so that each client has one request in flight (closed loop), or one thread submits
+// inputs at a fixed rate without waiting (open loop, with --rate). The test is repeated for each maximum
+// batch size, and for each it reports the throughput, the mean batch size and latency percentiles, together
+// with the latency of predicting directly from the client threads for comparison.
+//
+// Usage: loadGenerator [--clients 32] [--rate 0] [--seconds 2] [--batch 1,16,64,256] [--wait-us 200]
+//                      [--workers 1] [--trees 40] [--examples 10000]
+
+
+typedef ForestPredictor<double, double> Model;
+
+
+
+// Latency at the given quantile
+static double quantile(const std::vector<double>& sorted, const double& q)
+{
+	return sorted.empty() ? 0 : sorted[std::min(sorted.size() - 1, (std::size_t)(q * sorted.size()))];
+}
+
+
+
+// Display one row of results, given the latencies in microseconds
+static void display(const std::string& name, const double& seconds, const double& meanBatch, std::vector<double>& latency)
+{
+	std::sort(latency.begin(), latency.end());
+	std::cout << std::setw(10) << name << std::setw(14) << latency.size() / seconds << std::setw(12) << meanBatch
+		  << std::setw(12) << quantile(latency, 0.5) << std::setw(12) << quantile(latency, 0.99) << std::setw(12)
+		  << quantile(latency, 0.999) << '\n';
+}
+
+
+
+// Closed loop: each client submits an input, waits for its prediction and submits the next one
+template<typename Submit>
+static std::vector<double> closedLoop(const std::vector< std::vector<double> >& inputs, const std::size_t& nrClients,
+		const double& seconds, Submit submit)
+{
+	std::atomic<bool> stop{false};
+	std::vector< std::vector<double> > latency(nrClients);
+	std::vector<std::thread> clients;
+	for (std::size_t c = 0; c < nrClients; ++c)
+		clients.emplace_back([&, c]()
+		{
+			for (std::size_t i = c; !stop.load(std::memory_order_relaxed); i += nrClients)
+			{
+				auto start = std::chrono::steady_clock::now();
+				submit(c, inputs[i % inputs.size()]);
+				std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+				latency[c].push_back(elapsed.count());
+			}
+		});
+	std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+	stop = true;
+	for (auto& client : clients)
+		client.join();
+	std::vector<double> all;
+	for (const auto& l : latency)
+		all.insert(all.end(), l.begin(), l.end());
+	return all;
+}
+
+
+
+// Open loop: one thread submits inputs at a fixed rate, and another collects the predictions in order of
+// submission. An input whose prediction is ready before that of an earlier input is counted as completing
+// with the earlier one, so the latencies are slightly pessimistic.
+static std::vector<double> openLoop(PredictionService<Model, double, double>& service, const std::vector< std::vector<double> >& inputs,
+		const double& rate, const double& seconds)
+{
+	typedef std::pair< std::future<double>, std::chrono::steady_clock::time_point > Pending;
+	std::mutex lock;
+	std::condition_variable ready;
+	std::deque<Pending> pending;
+	bool done = false;
+	std::vector<double> latency;
+	std::thread collector([&]()
+	{
+		while (true)
+		{
+			Pending p;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				ready.wait(guard, [&]() {return done || !pending.empty();});
+				if (pending.empty())
+					return;
+				p = std::move(pending.front());
+				pending.pop_front();
+			}
+			p.first.get();
+			std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - p.second;
+			latency.push_back(elapsed.count());
+		}
+	});
+
+	auto start = std::chrono::steady_clock::now();
+	std::size_t total = (std::size_t)(rate * seconds);
+	for (std::size_t i = 0; i < total; ++i)
+	{
+		auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(i / rate));
+		std::this_thread::sleep_until(due);
+		auto now = std::chrono::steady_clock::now();
+		std::future<double> result = service.submit(inputs[i % inputs.size()]);
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			pending.push_back(std::make_pair(std::move(result), now));
+		}
+		ready.notify_one();
+	}
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		done = true;
+	}
+	ready.notify_one();
+	collector.join();
+	return latency;
+}
+
+
+
+int main(int argc, char* argv[])
+{
+	std::size_t nrClients = 32, waitMicros = 200, nrWorkers = 1, nrTrees = 40, N = 10000;
+	double rate = 0, seconds = 2;
+	std::vector<std::size_t> batchSizes = {1, 16, 64, 256};
+	for (int a = 1; a + 1 < argc; a += 2)
+	{
+		std::string arg = argv[a], value = argv[a+1];
+		if (arg == "--clients")
+			nrClients = std::stoul(value);
+		else if (arg == "--rate")
+			rate = std::stod(value);
+		else if (arg == "--seconds")
+			seconds = std::stod(value);
+		else if (arg == "--wait-us")
+			waitMicros = std::stoul(value);
+		else if (arg == "--workers")
+			nrWorkers = std::stoul(value);
+		else if (arg == "--trees")
+			nrTrees = std::stoul(value);
+		else if (arg == "--examples")
+			N = std::stoul(value);
+		else if (arg == "--batch")
+		{
+			batchSizes.clear();
+			std::stringstream ss(value);
+			std::string item;
+			while (std::getline(ss, item, ','))
+				batchSizes.push_back(std::stoul(item));
+		}
+		else
+		{
+			std::cerr << "Unknown option " << arg << '\n';
+			return 1;
+		}
+	}
+
+
+	// Build the model served, and inputs drawn from the same distribution as its training data
+	auto data = syntheticRegression(N, 12, 1);
+	BaggedRegressionTrees<double, double> bagged(data.first, data.second, nrTrees);
+	bagged.setGrowth('l');
+	bagged.buildTrees();
+	Model model = bagged.toPredictor();
+	std::size_t kilobytes = model.memoryUsage().total() / 1024;
+	ModelHandle<Model> handle(std::move(model), std::max<std::size_t>(64, nrWorkers + nrClients));
+	std::vector< std::vector<double> > inputs = syntheticRegression(10000, 12, 2).first;
+	std::cout << "Serving " << nrTrees << " trees (" << kilobytes << " KB) with "
+		  << nrWorkers << " workers, " << (rate > 0 ? "open loop at " + std::to_string((std::size_t)rate) + " inputs/s"
+							 : "closed loop with " + std::to_string(nrClients) + " clients") << "\n\n";
+
+
+	std::cout << std::setw(10) << "Batch" << std::setw(14) << "Inputs/s" << std::setw(12) << "Mean batch" << std::setw(12)
+		  << "p50 (us)" << std::setw(12) << "p99 (us)" << std::setw(12) << "p99.9 (us)" << '\n';
+
+	// Direct prediction from the client threads, without batching
+	if (rate == 0)
+	{
+		std::vector<ModelHandle<Model>::Reader> readers;
+		for (std::size_t c = 0; c < nrClients; ++c)
+			readers.push_back(handle.reader());
+		auto latency = closedLoop(inputs, nrClients, seconds, [&](const std::size_t& c, const std::vector<double>& in)
+		{
+			auto model = readers[c].read();
+			volatile double y = model->predict(in);
+			(void) y;
+		});
+		display("direct", seconds, 1, latency);
+	}
+
+	// Prediction through the service, for each maximum batch size
+	for (std::size_t batch : batchSizes)
+	{
+		std::vector<double> latency;
+		double meanBatch;
+		{
+			PredictionService<Model, double, double> service(handle, nrWorkers, batch, waitMicros);
+			if (rate > 0)
+				latency = openLoop(service, inputs, rate, seconds);
+			else
+				latency = closedLoop(inputs, nrClients, seconds, [&](const std::size_t&, const std::vector<double>& in)
+				{
+					volatile double y = service.submit(in).get();
+					(void) y;
+				});
+			service.stop();
+			meanBatch = service.batchCount() ? (double)service.rowCount() / service.batchCount() : 0;
+		}
+		display(std::to_string(batch), seconds, meanBatch, latency);
+	}
+	return 0;
+}
@@ -2,19 +2,77 @@
 #ifndef _BAGGING_
 #define _BAGGING_
 
+#include <chrono>
 #include "trees.h"
 
 
-// Implement bootstrap sampling to determine training data to be used for each tree
+// Group the examples which are sampled together: all of them, or the examples of each output value
+// separately if samples preserve class proportions
+template<typename U>
+static inline std::vector< std::vector<std::size_t> > bootstrapGroups(const std::vector<U>& out, bool stratify)
+{
+	std::size_t N = out.size();
+	std::vector< std::vector<std::size_t> > groups;
+	if (stratify)
+	{
+		std::map<U, std::size_t> group;
+		for (std::size_t n = 0; n < N; ++n)
+		{
+			auto search = group.find(out[n]);
+			if (search == group.end())
+			{
+				search = group.insert(std::make_pair(out[n], groups.size())).first;
+				groups.resize(groups.size()+1);
+			}
+			groups[search->second].push_back(n);
+		}
+	}
+	else
+	{
+		groups.resize(1);
+		groups[0].resize(N);
+		std::iota(groups[0].begin(), groups[0].end(), 0);
+	}
+	return groups;
+}
+
+
+
+// Draw the examples of one bootstrap sample, taking a fraction 'frac' of each group with or without replacement
+static inline std::vector<std::size_t> bootstrapSample(const std::vector< std::vector<std::size_t> >& groups,
+            const double& frac, bool replace, std::mt19937& gen)
+{
+	std::vector<std::size_t> pnts;
+	for (const auto& group : groups)
+	{
+		std::size_t M = std::max<std::size_t>(1, std::lround(frac * group.size()));
+		if (replace)
+		{
+			std::uniform_int_distribution<std::size_t> distrib(0, group.size()-1);
+			for (std::size_t m = 0; m < M; ++m)
+				pnts.push_back(group[distrib(gen)]);
+		}
+		else
+			std::sample(group.begin(), group.end(), std::back_inserter(pnts), M, gen);
+	}
+	return pnts;
+}
+
+
+
+// Implement bootstrap sampling to determine training data to be used for each tree. Each sample holds a
+// fraction 'frac' of the examples, drawn with or without replacement, and optionally drawn separately
+// from the examples of each output value so that class proportions are preserved.
 template<typename T, typename U>
 static inline std::tuple< std::vector< std::vector< std::vector<T> > >, 
     std::vector< std::vector<U> >, std::vector< std::set<std::size_t> > >
-    bootstrap(const std::vector< std::vector<T> >& in, const std::vector<U>& out, const std::size_t& nr)
+    bootstrap(const std::vector< std::vector<T> >& in, const std::vector<U>& out, const std::size_t& nr,
+            const double& frac = 1, bool replace = true, bool stratify = false)
 {
 	std::size_t N = in.size();
 	std::random_device rd;
 	std::mt19937 gen(rd());
-	std::uniform_int_distribution<> distrib(0, N-1);
+	auto groups = bootstrapGroups(out, stratify);
 	
 	std::vector< std::vector< std::vector<T> > > bagInputs(nr);
 	std::vector< std::vector<U> > bagOutputs(nr);
@@ -26,14 +84,14 @@ static inline std::tuple< std::vector< std::vector< std::vector<T> > >,
 			
 	for (std::size_t i = 0; i < nr; ++i)
 	{
-		bagInputs[i].resize(N);
-		bagOutputs[i].resize(N);
-		for (std::size_t n = 0; n < N; ++n)
+		std::vector<std::size_t> pnts = bootstrapSample(groups, frac, replace, gen);
+		bagInputs[i].resize(pnts.size());
+		bagOutputs[i].resize(pnts.size());
+		for (std::size_t n = 0; n < pnts.size(); ++n)
 		{
-			int pnt = distrib(gen);
-			bagInputs[i][n] = in[pnt];
-			bagOutputs[i][n] = out[pnt];
-			unusedSamples[pnt].erase(i);
+			bagInputs[i][n] = in[pnts[n]];
+			bagOutputs[i][n] = out[pnts[n]];
+			unusedSamples[pnts[n]].erase(i);
 		}
 	}
 	
@@ -42,36 +100,202 @@ static inline std::tuple< std::vector< std::vector< std::vector<T> > >,
 
 
 
-// Construct all trees for bagging procedure, according to user-defined parameters
+
+// Construct one tree for bagging procedure from the examples 'pnts', according to user-defined parameters.
+// The tree is built within a memory budget, if one is given, and can release its training data once built.
+template<typename T, typename U, typename Tr>
+static inline Tr baggedTree(const std::vector< std::vector<T> >& in, const std::vector<U>& out, const std::vector<std::size_t>& pnts,
+            const std::tuple<std::size_t, std::size_t, std::size_t, char, char, std::size_t, bool, std::size_t>& props,
+            bool trace = false, const std::size_t& budget = 0, bool release = false)
+{
+	std::vector< std::vector<T> > bagInputs(pnts.size());
+	std::vector<U> bagOutputs(pnts.size());
+	for (std::size_t n = 0; n < pnts.size(); ++n)
+	{
+		bagInputs[n] = in[pnts[n]];
+		bagOutputs[n] = out[pnts[n]];
+	}
+	
+	Tr tree(bagInputs, bagOutputs);
+	tree.setMinLeafSize(std::get<0>(props));
+	tree.setMaxDepth(std::get<1>(props));
+	tree.setNrSelectedFeatures(std::get<2>(props));
+	tree.setGrowth(std::get<4>(props));
+	tree.setMaxLeafNodes(std::get<5>(props));
+	tree.setExtraTrees(std::get<6>(props));
+	tree.setMaxSplitSamples(std::get<7>(props));
+	if constexpr (std::is_same< Tr, ClassificationTree<T,U> >::value)
+		tree.setImpurity(std::get<3>(props));
+#ifdef DTREES_PROFILE
+	tree.setTrace(trace);
+#else
+	(void) trace;
+#endif
+	tree.setMemoryBudget(budget);
+	tree.buildTree();
+	if (release)
+		tree.releaseTrainingData();
+	return tree;
+}	
+	
+	
+
+// Construct all trees for bagging procedure, according to user-defined parameters, each from its own
+// bootstrap sample drawn with the settings 'sampling' (fraction, replacement, stratification). Returns the
+// trees and, for each example, the trees whose sample left it out.
 template<typename T, typename U, typename Tr>
 static inline std::pair< std::vector<Tr>, std::vector< std::set<std::size_t> > > 
     baggingTrees(const std::vector< std::vector<T> >& in, const std::vector<U>& out, 
-            std::vector<Tr>& trees, const std::tuple<std::size_t, std::size_t, std::size_t, char>& props)
+            std::vector<Tr>& trees, const std::tuple<std::size_t, std::size_t, std::size_t, char, char, std::size_t, bool, std::size_t>& props,
+            const std::tuple<double, bool, bool>& sampling)
 {
 	std::size_t nr = trees.size();
-	auto tp = bootstrap(in, out, nr);
-	std::vector< std::vector< std::vector<T> > > inputs = std::get<0>(tp);
-	std::vector< std::vector<U> > outputs = std::get<1>(tp);
-	std::vector< std::set<std::size_t> > unusedSamples = std::get<2>(tp);
+	std::random_device rd;
+	std::mt19937 gen(rd());
+	auto groups = bootstrapGroups(out, std::get<2>(sampling));
 	
-	std::size_t lf = std::get<0>(props), dp = std::get<1>(props), nrFtrs = std::get<2>(props);
+	std::vector< std::set<std::size_t> > unusedSamples(in.size());
+	for (std::size_t i = 0; i < in.size(); ++i)
+		for (std::size_t j = 0; j < nr; ++j)
+			unusedSamples[i].insert(unusedSamples[i].end(), j);
 	
-	for (std::size_t n = 0; n < nr; ++n)
+	for (std::size_t j = 0; j < nr; ++j)
 	{
-		trees[n] = Tr(inputs[n], outputs[n]);
-		trees[n].setMinLeafSize(lf);
-		trees[n].setMaxDepth(dp);
-		trees[n].setNrSelectedFeatures(nrFtrs);
-		if constexpr (std::is_same< Tr, ClassificationTree<T,U> >::value)
-			trees[n].setImpurity(std::get<3>(props));
-		trees[n].buildTree();
-		std::cout << "Constructed tree " << n+1 << '/' << nr << '\n';
+		std::vector<std::size_t> pnts = bootstrapSample(groups, std::get<0>(sampling), std::get<1>(sampling), gen);
+		for (const std::size_t& n : pnts)
+			unusedSamples[n].erase(j);
+		trees[j] = baggedTree<T, U, Tr>(in, out, pnts, props);
+		std::cout << "Constructed tree " << j+1 << '/' << nr << '\n';
 	}
 	return std::make_pair(trees, unusedSamples);
+}
 	
-}	
 	
+
+
+// Prune each tree with cost-complexity pruning, choosing its complexity parameter by the error on the
+// training examples left out of that tree's bootstrap sample, and return the chosen parameters
+template<typename T, typename U, typename Tr>
+static inline std::vector<double> pruneOutOfBag(const std::vector< std::vector<T> >& in, const std::vector<U>& out,
+            std::vector<Tr>& trees, const std::vector< std::set<std::size_t> >& unusedSamples)
+{
+	std::size_t nr = trees.size();
+	std::vector< std::vector< std::vector<T> > > oobInputs(nr);
+	std::vector< std::vector<U> > oobOutputs(nr);
+	for (std::size_t n = 0; n < unusedSamples.size(); ++n)
+		for (std::size_t sample : unusedSamples[n])
+		{
+			oobInputs[sample].push_back(in[n]);
+			oobOutputs[sample].push_back(out[n]);
+		}
+		
+	std::vector<double> alphas(nr, 0);
+	for (std::size_t n = 0; n < nr; ++n)
+		if (!oobInputs[n].empty())
+			alphas[n] = trees[n].pruneByValidation(oobInputs[n], oobOutputs[n]);
+	return alphas;
+}
+
+
+
+// Keep only the trees with the given increasing indices, renumbering the trees left out of each sample
+template<typename Tr>
+static inline void keepTrees(std::vector<Tr>& trees, std::vector< std::set<std::size_t> >& unusedSamples,
+            const std::vector<std::size_t>& keep)
+{
+	std::vector<std::size_t> index(trees.size(), trees.size());
+	std::vector<Tr> kept(keep.size());
+	for (std::size_t k = 0; k < keep.size(); ++k)
+	{
+		index[keep[k]] = k;
+		kept[k] = trees[keep[k]];
+	}
+	trees = kept;
 	
+	for (auto& unused : unusedSamples)
+	{
+		std::set<std::size_t> renumbered;
+		for (std::size_t sample : unused)
+			if (index[sample] < keep.size())
+				renumbered.insert(renumbered.end(), index[sample]);
+		unused = renumbered;
+	}
+}
+
+
+
+// Hash-cons identical subtrees across all trees into one shared structure, and return the number of
+// distinct nodes before and after
+template<typename Tr>
+static inline std::pair<std::size_t, std::size_t> mergeSubtrees(std::vector<Tr>& trees)
+{
+	typename Tr::SubtreeTable table;
+	std::size_t removed = 0;
+	for (auto& tree : trees)
+		removed += tree.shareSubtrees(table);
+	return std::make_pair(table.second.size(), table.second.size() - removed);
+}
+
+
+
+// Memory held by a set of trees, counting shared subtrees once, together with its training data and the
+// out-of-bag bookkeeping, which takes 'extra' bytes besides the samples left out of each tree
+template<typename T, typename U, typename Tr>
+static inline MemoryUsage baggedMemory(const std::vector<Tr>& trees, const std::vector< std::vector<T> >& in,
+            const std::vector<U>& out, const std::vector< std::set<std::size_t> >& unusedSamples, const std::size_t& extra)
+{
+	MemoryUsage usage;
+	std::unordered_set<const void*> seen;
+	for (const auto& tree : trees)
+		usage.add(tree.memoryUsage(seen));
+	usage.trainingData += in.capacity() * sizeof(std::vector<T>) + out.capacity() * sizeof(U);
+	for (const auto& x : in)
+		usage.trainingData += x.capacity() * sizeof(T);
+	for (const auto& unused : unusedSamples)
+		usage.indexStructures += sizeof(std::set<std::size_t>) + unused.size() * containerNodeBytes<std::size_t>();
+	usage.indexStructures += extra;
+	return usage;
+}
+
+
+
+// Check that 'nr' more trees, each grown on a sample of 'sampleSize' examples taking 'sampleBytes', fit in
+// a memory budget given the memory already held. The nodes of each tree are estimated from the trees so
+// far, or as those of the largest possible tree if there are none. Trees keep their sample unless that
+// would exceed the budget, in which case they release their training data once built, and growing the
+// trees fails with the estimate if even that is not enough. Returns whether trees release their data.
+template<typename Tr>
+static inline bool planMemory(const MemoryUsage& usage, const std::size_t& nrTrees, const std::size_t& nr,
+            const std::size_t& sampleSize, const std::size_t& sampleBytes, const std::size_t& budget)
+{
+	std::size_t nodes = nrTrees > 0 ? (usage.nodes + usage.leaves) / nrTrees : (2 * sampleSize - 1) * Tr::nodeBytes();
+	if (usage.total() + nr * (sampleBytes + nodes) <= budget)
+		return false;
+	std::size_t bytes = usage.total() + nr * nodes;
+	if (bytes > budget)
+		throw std::invalid_argument("Growing " + std::to_string(nr) + " more trees needs an estimated " + std::to_string(bytes)
+				+ " bytes, which exceeds the memory budget of " + std::to_string(budget) + " bytes\n");
+	return true;
+}
+
+
+
+// Mean time in microseconds taken by a model to predict the output of each of a set of inputs
+template<typename Tr, typename T>
+static inline double meanPredictionTime(const Tr& model, const std::vector< std::vector<T> >& in)
+{
+	if (in.empty())
+		return 0;
+	auto start = std::chrono::steady_clock::now();
+	for (const auto& x : in)
+	{
+		volatile auto y = model.predict(x);
+		(void) y;
+	}
+	std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / in.size();
+}
+
 
 
 // Class defining a set of bagged classification trees
@@ -90,7 +314,7 @@ class BaggedClassificationTrees
 	std::size_t N;
 	
 	// nrOfSamples = # bootstrap samples taken, subD = # features checked at each node
-	std::size_t nrOfSamples, minLeafSize{0}, maxDepth, subD;
+	std::size_t nrOfSamples, minLeafSize{0}, maxDepth, maxLeafNodes, maxSplitSamples, subD;
 	
 	// Vector of sampled trees
 	std::vector< ClassificationTree<T, U> > trees;
@@ -101,13 +325,59 @@ class BaggedClassificationTrees
 	// Indicate impurity measure, with entropy as default
 	char impurity{'e'};
 	
+	// Indicate whether bootstrap samples preserve the proportion of each class
+	bool stratify{false};
+	
+	// Indicate order of tree growth, with depth-first as default
+	char growth{'d'};
+	
+	// Indicate whether trees are extremely randomised
+	bool extraTrees{false};
+	
+	// Fraction of examples drawn for each bootstrap sample, and whether they are drawn with replacement
+	double maxSamples{1};
+	bool replace{true};
+	
+	// Indicate whether identical subtrees of different trees have been merged
+	bool shared{false};
+	
+	// Timers and counters of all tree builds, which only exist if compiled with DTREES_PROFILE defined
+#ifdef DTREES_PROFILE
+	BuildStats buildStats;
+#endif
+	
+	// Indicate whether voting stops once the leading class cannot be overtaken
+	bool earlyExit{false};
+	
+	// Share of the votes cast for the leading class after which voting stops, once at least minVotes trees
+	// have been evaluated (not used if 0)
+	double confidence{0};
+	std::size_t minVotes{1};
+	
+	// Order in which trees are evaluated, if not their natural order
+	std::vector<std::size_t> order;
+	
+	// Running out-of-bag votes of each example, the number of examples with any such votes and of those
+	// misclassified by them, and the out-of-bag error after each tree was added
+	std::vector< std::map<U, std::size_t> > oobVotes;
+	std::size_t oobCovered, oobWrong;
+	std::vector<double> oobHistory;
+	
+	// Indicate whether the running out-of-bag votes match the trees
+	bool oobValid;
+	
+	// Memory budget in bytes (not used if 0), the memory held so far while growing trees within it, and
+	// whether new trees release their training data once built to stay within it
+	std::size_t memoryBudget{0}, memoryHeld{0};
+	bool releaseData{false};
+	
 public:
 
 	// METHODS 
 	
 	// Constructor
 	BaggedClassificationTrees(const std::vector< std::vector<T> >& in, const std::vector<U>& out, const std::size_t& nr)
-	: inputs(in), outputs(out), N(in.size()), nrOfSamples(nr), maxDepth(N) {trees.resize(nr); subD = inputs[0].size();}
+	: inputs(in), outputs(out), N(in.size()), nrOfSamples(nr), maxDepth(N), maxLeafNodes(N), maxSplitSamples(N) {unusedSamples.resize(N); subD = inputs[0].size(); resetOutOfBag();}
 	
 	
 	// Pruning properties of trees
@@ -124,33 +394,345 @@ public:
 	char getImpurity() {return impurity;}
 	
 	
+	// Order in which each tree is grown
+	void setGrowth(char c)
+	{
+		if (c != 'd' && c != 'l' && c != 'b')
+			throw std::invalid_argument("Growth must be 'd' (depth-first), 'l' (level-wise) or 'b' (best-first)\n");
+		growth = c;
+	}
+	char getGrowth() const {return growth;}
+	void setMaxLeafNodes(const std::size_t& l) {maxLeafNodes = l;}
+	std::size_t getMaxLeafNodes() const {return maxLeafNodes;}
+	
+	
+	// Extremely randomised trees
+	void setExtraTrees(bool b) {extraTrees = b;}
+	bool getExtraTrees() const {return extraTrees;}
+	
+	
+	// Row subsampling, both for bootstrap samples and for the split search at large nodes
+	void setMaxSamples(const double& f)
+	{
+		if (f <= 0 || f > 1)
+			throw std::invalid_argument("Fraction of examples in each sample must be in (0, 1]\n");
+		maxSamples = f;
+	}
+	void setReplacement(bool b) {replace = b;}
+	void setMaxSplitSamples(const std::size_t& s)
+	{
+		if (s == 0)
+			throw std::invalid_argument("Maximum number of split samples must be positive\n");
+		maxSplitSamples = s;
+	}
+	double getMaxSamples() const {return maxSamples;}
+	bool getReplacement() const {return replace;}
+	std::size_t getMaxSplitSamples() const {return maxSplitSamples;}
+	void setStratified(bool b) {stratify = b;}
+	bool getStratified() const {return stratify;}
+	
+	
 	// Random feature selection
 	void setNrSelectedFeatures(const std::size_t n) {subD = n;}
 	std::size_t getNrSelectedFeatures() {return subD;}
 	
+	
+	// Early exit from voting. In exact mode, voting stops as soon as the remaining trees cannot change the
+	// prediction. With a confidence c, voting also stops once the leading class holds a share c of the
+	// votes cast by at least m trees, which may change some predictions.
+	void setEarlyExit(bool b) {earlyExit = b;}
+	bool getEarlyExit() const {return earlyExit;}
+	void setConfidence(const double& c, const std::size_t& m = 1)
+	{
+		if (c < 0 || c > 1)
+			throw std::invalid_argument("Confidence must be in [0, 1]\n");
+		confidence = c; minVotes = m;
+	}
+	double getConfidence() const {return confidence;}
+	
+	
+	// Order in which trees vote, given as a permutation of the tree indices. Evaluating the most accurate
+	// trees first, as given by oobTreeOrder, makes an early exit more likely.
+	void setTreeOrder(const std::vector<std::size_t>& o)
+	{
+		std::vector<std::size_t> sorted(o);
+		std::sort(sorted.begin(), sorted.end());
+		for (std::size_t t = 0; t < sorted.size(); ++t)
+			if (sorted[t] != t || sorted.size() != trees.size())
+				throw std::invalid_argument("Tree order must be a permutation of the tree indices\n");
+		order = o;
+	}
+	std::vector<std::size_t> getTreeOrder() const {return order;}
+	
+	
+	// Indices of trees by increasing error on the training examples left out of their bootstrap samples
+	std::vector<std::size_t> oobTreeOrder() const
+	{
+		std::vector<double> error(trees.size(), 0);
+		std::vector<std::size_t> size(trees.size(), 0), o(trees.size());
+		for (std::size_t n = 0; n < N; ++n)
+			for (std::size_t sample : unusedSamples[n])
+			{
+				++size[sample];
+				if (trees[sample].predict(inputs[n]) != outputs[n])
+					++error[sample];
+			}
+		for (std::size_t t = 0; t < trees.size(); ++t)
+			error[t] = size[t] > 0 ? error[t] / size[t] : 1;
+		std::iota(o.begin(), o.end(), 0);
+		std::stable_sort(o.begin(), o.end(), [&error](std::size_t t1, std::size_t t2) {return error[t1] < error[t2];});
+		return o;
+	}
+	
 
 	// Construct all trees
 	void buildTrees()
 	{
-		std::tuple<std::size_t, std::size_t, std::size_t, char> properties = std::make_tuple(minLeafSize, maxDepth, subD, impurity);
-		auto bagData = baggingTrees< T, U, ClassificationTree<T, U> >(inputs, outputs, trees, properties);
-		trees = bagData.first; unusedSamples = bagData.second;
+		std::size_t nr = nrOfSamples;
+		trees.clear();
+		unusedSamples.assign(N, std::set<std::size_t>());
+		resetOutOfBag();
+		shared = false;
+		PROFILE_CLEAR();
+		addTrees(nr);
 	}
 	
 	
-	// Predict new output value for a given input point, based on aggregate of trees
+	// Add nr trees grown on new bootstrap samples to the trees already built, which are kept unchanged
+	void addTrees(const std::size_t& nr)
+	{
+		std::random_device rd;
+		std::mt19937 gen(rd());
+		auto groups = bootstrapGroups(outputs, stratify);
+		std::size_t total = trees.size() + nr;
+		planTrees(nr);
+		while (trees.size() < total)
+		{
+			growTree(groups, gen);
+			std::cout << "Constructed tree " << trees.size() << '/' << total << '\n';
+		}
+	}
+	
+	
+	// Add trees one at a time until the out-of-bag error of the set has improved by less than 'tol' over
+	// the last 'window' trees, or until there are maxTrees trees, and return the number of trees
+	std::size_t addTreesUntilConverged(const std::size_t& maxTrees, const std::size_t& window = 10, const double& tol = 1e-3)
+	{
+		std::random_device rd;
+		std::mt19937 gen(rd());
+		auto groups = bootstrapGroups(outputs, stratify);
+		planTrees(maxTrees > trees.size() ? maxTrees - trees.size() : 0);
+		while (trees.size() < maxTrees)
+		{
+			growTree(groups, gen);
+			std::cout << "Constructed tree " << trees.size() << '/' << maxTrees << '\n';
+			std::size_t k = oobHistory.size();
+			if (k > window && oobHistory[k-1-window] - oobHistory[k-1] < tol)
+				break;
+		}
+		return trees.size();
+	}
+	
+	
+	// Out-of-bag error of the set after each tree was added, for examples left out of any sample so far
+	const std::vector<double>& getOutOfBagHistory() const {return oobHistory;}
+	
+	
+	// Timers and counters of all tree builds, which are only available if the library is compiled with
+	// DTREES_PROFILE defined. With tracing on, every timed phase is recorded with the tree it belongs to.
+#ifdef DTREES_PROFILE
+	const BuildStats& getBuildStats() const {return buildStats;}
+	void setTrace(bool b) {buildStats.trace = b;}
+#endif
+	
+	
+	// Memory held by the set, broken down by kind, with subtrees shared between trees counted once
+	MemoryUsage memoryUsage() const {return baggedMemory(trees, inputs, outputs, unusedSamples, outOfBagBytes());}
+	
+	
+	// Compile the trees into an immutable predictor holding only their nodes and leaf values, voting with the same
+	// early exit settings and tree order
+	ForestPredictor<T, U> toPredictor() const
+	{
+		std::vector<U> values;
+		std::map<U, std::size_t> position;
+		std::vector< TreePredictor<T, U> > compiled;
+		for (const auto& tree : trees)
+			compiled.push_back(tree.toPredictor(values, position));
+		return ForestPredictor<T, U>(compiled, values, true, earlyExit, confidence, minVotes, order);
+	}
+	
+	
+	// Compile the trees into a predictor, then free the training data and all trees, including their nodes.
+	// The set is left empty, and copies of it, which share its nodes, cannot be used afterwards.
+	ForestPredictor<T, U> freeze()
+	{
+		ForestPredictor<T, U> predictor = toPredictor();
+		std::unordered_set<const void*> seen;
+		for (auto& tree : trees)
+			tree.release(seen);
+		std::vector< ClassificationTree<T, U> >().swap(trees);
+		std::vector<std::size_t>().swap(order);
+		std::vector< std::vector<T> >().swap(inputs);
+		std::vector<U>().swap(outputs);
+		std::vector< std::set<std::size_t> >().swap(unusedSamples);
+		std::vector< std::map<U, std::size_t> >().swap(oobVotes);
+		std::vector<double>().swap(oobHistory);
+		N = 0;
+		resetOutOfBag();
+		return predictor;
+	}
+	
+	
+	// Memory budget in bytes for growing trees (0 for none). Each tree is built within what is left of the
+	// budget, as for a single tree. If keeping the bootstrap sample of every tree would exceed the budget,
+	// trees release their training data once built, after which they cannot be pruned. If the estimated
+	// memory still exceeds the budget, growing trees fails with the estimate before any tree is built.
+	void setMemoryBudget(const std::size_t& b) {memoryBudget = b;}
+	std::size_t getMemoryBudget() const {return memoryBudget;}
+	
+	
+	// Predict new output value for a given input point, based on aggregate of trees. The second form also
+	// gives the number of trees evaluated, which is smaller than the number of trees if voting exits early.
 	U predict(const std::vector<T>& in) const
 	{
-		std::map<U, std::size_t> count;
+		std::size_t evaluated;
+		return vote(in, evaluated);
+	}
+	U predict(const std::vector<T>& in, std::size_t& evaluated) const {return vote(in, evaluated);}
+	
+	
+	// Predict output value for a sparse input, given as (feature, value) pairs sorted by feature
+	U predict(const std::vector< std::pair<std::size_t, T> >& in) const
+	{
+		std::size_t evaluated;
+		return vote(in, evaluated);
+	}
+	U predict(const std::vector< std::pair<std::size_t, T> >& in, std::size_t& evaluated) const {return vote(in, evaluated);}
+	
+	
+	// Prediction of each tree of the set for a dense input
+	std::vector<U> treePredictions(const std::vector<T>& in) const
+	{
+		std::vector<U> out;
+		out.reserve(trees.size());
 		for (const auto& tree : trees)
-			++count[tree.predict(in)];
-			
-		std::pair<U, std::size_t> max = std::make_pair(U(), 0);
-		for (const auto& el : count)
-			if (el.second > max.second)
-				max = el;
-				
-		return max.first;
+			out.push_back(tree.predict(in));
+		return out;
+	}
+	
+	
+	// Prune every tree in place, either with a common complexity parameter alpha or with the parameter
+	// giving the least out-of-bag error for each tree
+	void prune(const double& alpha)
+	{
+		checkUnshared();
+		oobValid = false;
+		for (auto& tree : trees)
+			tree.prune(alpha);
+	}
+	std::vector<double> pruneTrees()
+	{
+		checkUnshared();
+		oobValid = false;
+		return pruneOutOfBag(inputs, outputs, trees, unusedSamples);
+	}
+	
+	
+	// Calibrate every tree on a representative sample of inputs, compiling each into a node array laid out
+	// for the paths taken most often, and return the number of tree evaluations by path length
+	std::vector<std::size_t> calibrate(const std::vector< std::vector<T> >& in)
+	{
+		std::vector<std::size_t> pathLengths;
+		for (auto& tree : trees)
+		{
+			tree.calibrate(in);
+			const auto& lengths = tree.getPathLengths();
+			if (pathLengths.size() < lengths.size())
+				pathLengths.resize(lengths.size(), 0);
+			for (std::size_t l = 0; l < lengths.size(); ++l)
+				pathLengths[l] += lengths[l];
+		}
+		return pathLengths;
+	}
+	
+	
+	// Merge identical subtrees of all trees (same leaf value, or same split and branches) into one shared
+	// structure, which cuts memory and improves cache use during prediction. Returns the number of distinct
+	// nodes before and after. The trees can no longer be pruned afterwards.
+	std::pair<std::size_t, std::size_t> shareSubtrees()
+	{
+		shared = true;
+		return mergeSubtrees(trees);
+	}
+	
+	
+	// Keep only a subset of the trees, chosen greedily by adding at each step the tree which most reduces
+	// the majority vote error on the examples 'in', until that error is within 'tol' of the error of all
+	// trees. Returns the number of trees kept, the error of all trees and of those kept, and the mean
+	// prediction time per example in microseconds before and after
+	std::tuple<std::size_t, double, double, double, double> compress(const std::vector< std::vector<T> >& in,
+			const std::vector<U>& out, const double& tol)
+	{
+		auto classes = classIndex(out);
+		std::vector<std::size_t> label(in.size());
+		std::vector< std::vector<std::size_t> > pred(trees.size(), std::vector<std::size_t>(in.size()));
+		for (std::size_t m = 0; m < in.size(); ++m)
+		{
+			label[m] = classes[out[m]];
+			for (std::size_t t = 0; t < trees.size(); ++t)
+				pred[t][m] = classes[trees[t].predict(in[m])];
+		}
+		return compressTrees(in, label, pred, classes.size(), tol);
+	}
+	
+	
+	// Compress the set of trees in the same way, judging each tree only on the training examples left out
+	// of its bootstrap sample
+	std::tuple<std::size_t, double, double, double, double> compress(const double& tol)
+	{
+		const std::size_t none = std::numeric_limits<std::size_t>::max();
+		auto classes = classIndex(outputs);
+		std::vector<std::size_t> label(N);
+		std::vector< std::vector<std::size_t> > pred(trees.size(), std::vector<std::size_t>(N, none));
+		for (std::size_t n = 0; n < N; ++n)
+		{
+			label[n] = classes[outputs[n]];
+			for (std::size_t sample : unusedSamples[n])
+				pred[sample][n] = classes[trees[sample].predict(inputs[n])];
+		}
+		return compressTrees(inputs, label, pred, classes.size(), tol);
+	}
+	
+	
+	// Train a new set of 'nr' bagged trees with the same settings on the predictions of this set, made for
+	// its training inputs together with any further inputs 'extra', so that fewer trees mimic this set
+	BaggedClassificationTrees distil(const std::size_t& nr, const std::vector< std::vector<T> >& extra = {}) const
+	{
+		BaggedClassificationTrees student(*this);
+		std::tie(student.inputs, student.outputs) = teacherData(extra);
+		student.N = student.inputs.size();
+		if (maxDepth == N)
+			student.maxDepth = student.N;
+		if (maxLeafNodes == N)
+			student.maxLeafNodes = student.N;
+		if (maxSplitSamples == N)
+			student.maxSplitSamples = student.N;
+		student.nrOfSamples = nr;
+		student.buildTrees();
+		return student;
+	}
+	
+	
+	// Train a single unlimited tree on the predictions of this set, made as for distil
+	ClassificationTree<T, U> distilTree(const std::vector< std::vector<T> >& extra = {}) const
+	{
+		auto data = teacherData(extra);
+		ClassificationTree<T, U> tree(data.first, data.second);
+		tree.setImpurity(impurity);
+		tree.setGrowth(growth);
+		tree.buildTree();
+		return tree;
 	}
 	
 	
@@ -173,6 +755,270 @@ public:
 		}
 		return error / size;
 	}
+	
+	
+private:
+
+	// Check that trees can be changed in place
+	void checkUnshared() const
+	{
+		if (shared)
+			throw std::invalid_argument("Trees cannot be pruned once their subtrees are shared\n");
+	}
+	
+	
+
+	// Majority vote of the trees for an input, counting the trees evaluated. Ties go to the smallest class.
+	template<typename X>
+	U vote(const X& in, std::size_t& evaluated) const
+	{
+		std::map<U, std::size_t> count;
+		std::size_t nr = trees.size();
+		for (evaluated = 0; evaluated < nr; )
+		{
+			++count[trees[order.empty() ? evaluated : order[evaluated]].predict(in)];
+			++evaluated;
+			if (!earlyExit && confidence == 0)
+				continue;
+			
+			std::size_t lead = 0, second = 0;
+			for (const auto& el : count)
+				if (el.second > lead)
+				{
+					second = lead;
+					lead = el.second;
+				}
+				else if (el.second > second)
+					second = el.second;
+			if (earlyExit && lead > second + (nr - evaluated))
+				break;
+			if (confidence > 0 && evaluated >= minVotes && lead >= confidence * evaluated)
+				break;
+		}
+			
+		return majority(count);
+	}
+	
+	
+	// Class with the most votes, with ties going to the smallest class
+	static U majority(const std::map<U, std::size_t>& count)
+	{
+		std::pair<U, std::size_t> max = std::make_pair(U(), 0);
+		for (const auto& el : count)
+			if (el.second > max.second)
+				max = el;
+				
+		return max.first;
+	}
+	
+	
+	// Clear the running out-of-bag votes
+	void resetOutOfBag()
+	{
+		oobVotes.assign(N, std::map<U, std::size_t>());
+		oobCovered = 0; oobWrong = 0;
+		oobHistory.clear();
+		oobValid = true;
+	}
+	
+	
+	// Memory in bytes of the running out-of-bag votes and the order of the trees
+	std::size_t outOfBagBytes() const
+	{
+		std::size_t bytes = oobVotes.capacity() * sizeof(std::map<U, std::size_t>) + oobHistory.capacity() * sizeof(double)
+				+ order.capacity() * sizeof(std::size_t);
+		for (const auto& votes : oobVotes)
+			bytes += votes.size() * containerNodeBytes< std::pair<const U, std::size_t> >();
+		return bytes;
+	}
+	
+	
+	// Add the vote of a tree for an example left out of its sample
+	void addOutOfBagVote(const std::size_t& n, const U& y)
+	{
+		if (oobVotes[n].empty())
+			++oobCovered;
+		else if (majority(oobVotes[n]) != outputs[n])
+			--oobWrong;
+		++oobVotes[n][y];
+		if (majority(oobVotes[n]) != outputs[n])
+			++oobWrong;
+	}
+	
+	
+	// Plan the memory of growing nr more trees within the budget, if there is one, deciding whether they
+	// keep their bootstrap sample
+	void planTrees(const std::size_t& nr)
+	{
+		if (memoryBudget == 0)
+			return;
+		MemoryUsage usage = memoryUsage();
+		std::size_t n = std::ceil(maxSamples * N);
+		std::size_t sampleBytes = n * (sizeof(std::vector<T>) + inputs[0].size() * sizeof(T) + sizeof(U) + sizeof(std::size_t));
+		releaseData = planMemory< ClassificationTree<T, U> >(usage, trees.size(), nr, n, sampleBytes, memoryBudget);
+		memoryHeld = usage.total();
+	}
+	
+	
+	// Grow one more tree on a new bootstrap sample and add its votes for the examples left out of it
+	void growTree(const std::vector< std::vector<std::size_t> >& groups, std::mt19937& gen)
+	{
+		if (!oobValid)
+		{
+			resetOutOfBag();
+			for (std::size_t n = 0; n < N; ++n)
+				for (std::size_t sample : unusedSamples[n])
+					addOutOfBagVote(n, trees[sample].predict(inputs[n]));
+		}
+		
+		PROFILE_PHASE(BOOTSTRAP);
+		std::vector<std::size_t> pnts = bootstrapSample(groups, maxSamples, replace, gen);
+		PROFILE_STOP();
+		std::size_t budget = 0;
+		if (memoryBudget > 0)
+		{
+			if (memoryHeld >= memoryBudget)
+				throw std::invalid_argument("Trees have used up the memory budget of " + std::to_string(memoryBudget) + " bytes\n");
+			budget = memoryBudget - memoryHeld;
+		}
+		trees.push_back(baggedTree< T, U, ClassificationTree<T, U> >(inputs, outputs, pnts,
+			std::make_tuple(minLeafSize, maxDepth, subD, impurity, growth, maxLeafNodes, extraTrees, maxSplitSamples), PROFILE_TRACING(),
+			budget, releaseData));
+		std::size_t j = trees.size() - 1;
+		if (memoryBudget > 0)
+			memoryHeld += trees[j].memoryUsage().total();
+		PROFILE_ADD(trees[j].getBuildStats(), j);
+		nrOfSamples = trees.size();
+		order.clear();
+		
+		std::vector<char> inBag(N, 0);
+		for (std::size_t p : pnts)
+			inBag[p] = 1;
+		for (std::size_t n = 0; n < N; ++n)
+			if (!inBag[n])
+			{
+				unusedSamples[n].insert(unusedSamples[n].end(), j);
+				addOutOfBagVote(n, trees[j].predict(inputs[n]));
+			}
+		oobHistory.push_back(oobCovered > 0 ? (double) oobWrong / oobCovered : 1);
+	}
+	
+	
+	// Index of each class among the training outputs and the outputs 'out', in increasing order so that
+	// ties between votes are broken as in predict
+	std::map<U, std::size_t> classIndex(const std::vector<U>& out) const
+	{
+		std::map<U, std::size_t> classes;
+		for (const U& y : outputs)
+			classes[y] = 0;
+		for (const U& y : out)
+			classes[y] = 0;
+		std::size_t c = 0;
+		for (auto& el : classes)
+			el.second = c++;
+		return classes;
+	}
+	
+	
+	// Select trees greedily for compress, given the class index 'pred[t][m]' predicted by tree t for
+	// example m, or the largest std::size_t where the tree does not vote on that example. Examples on which
+	// no chosen tree votes yet count as errors.
+	std::tuple<std::size_t, double, double, double, double> compressTrees(const std::vector< std::vector<T> >& in,
+			const std::vector<std::size_t>& label, const std::vector< std::vector<std::size_t> >& pred,
+			const std::size_t& C, const double& tol)
+	{
+		const std::size_t none = std::numeric_limits<std::size_t>::max();
+		std::size_t M = label.size(), nr = pred.size();
+		
+		// Majority vote error of all trees, over the examples on which any tree votes
+		std::vector<std::size_t> votes(M*C, 0), used;
+		for (std::size_t t = 0; t < nr; ++t)
+			for (std::size_t m = 0; m < M; ++m)
+				if (pred[t][m] != none)
+					++votes[m*C + pred[t][m]];
+		std::size_t wrong = 0;
+		for (std::size_t m = 0; m < M; ++m)
+		{
+			auto first = votes.begin() + m*C;
+			auto top = std::max_element(first, first + C);
+			if (*top == 0)
+				continue;
+			used.push_back(m);
+			if (std::size_t(top - first) != label[m])
+				++wrong;
+		}
+		std::size_t nrUsed = std::max<std::size_t>(used.size(), 1);
+		double fullError = (double) wrong / nrUsed, error = 1;
+		
+		// Add the tree which corrects the most examples until the error is small enough
+		std::fill(votes.begin(), votes.end(), 0);
+		std::vector<std::size_t> best(M, none), top(M, 0), keep;
+		std::vector<char> chosen(nr, 0);
+		std::size_t correct = 0;
+		while (keep.size() < nr && (keep.empty() || error > fullError + tol))
+		{
+			std::size_t pick = 0;
+			long bestGain = std::numeric_limits<long>::min();
+			for (std::size_t t = 0; t < nr; ++t)
+			{
+				if (chosen[t])
+					continue;
+				long gain = 0;
+				for (std::size_t m : used)
+				{
+					std::size_t p = pred[t][m];
+					if (p == none)
+						continue;
+					std::size_t c = votes[m*C + p] + 1;
+					std::size_t b = (c > top[m] || (c == top[m] && p < best[m])) ? p : best[m];
+					gain += long(b == label[m]) - long(best[m] == label[m]);
+				}
+				if (gain > bestGain)
+				{
+					bestGain = gain;
+					pick = t;
+				}
+			}
+			
+			chosen[pick] = 1;
+			keep.push_back(pick);
+			for (std::size_t m : used)
+			{
+				std::size_t p = pred[pick][m];
+				if (p == none)
+					continue;
+				std::size_t c = ++votes[m*C + p];
+				if (c > top[m] || (c == top[m] && p < best[m]))
+				{
+					top[m] = c;
+					best[m] = p;
+				}
+			}
+			correct += bestGain;
+			error = 1 - (double) correct / nrUsed;
+		}
+		
+		double before = meanPredictionTime(*this, in);
+		std::sort(keep.begin(), keep.end());
+		keepTrees(trees, unusedSamples, keep);
+		nrOfSamples = trees.size();
+		oobValid = false;
+		order.clear();
+		double after = meanPredictionTime(*this, in);
+		return std::make_tuple(keep.size(), fullError, error, before, after);
+	}
+	
+	
+	// Training inputs together with the inputs 'extra', labelled by the predictions of this set
+	std::pair< std::vector< std::vector<T> >, std::vector<U> > teacherData(const std::vector< std::vector<T> >& extra) const
+	{
+		std::vector< std::vector<T> > in(inputs);
+		in.insert(in.end(), extra.begin(), extra.end());
+		std::vector<U> out(in.size());
+		for (std::size_t n = 0; n < in.size(); ++n)
+			out[n] = predict(in[n]);
+		return std::make_pair(in, out);
+	}
 };
 
 
@@ -193,14 +1039,47 @@ class BaggedRegressionTrees
 	std::size_t N;
 	
 	// nrOfSamples = # bootstrap samples taken, subD = # features checked at each node
-	std::size_t nrOfSamples, minLeafSize{10}, maxDepth, subD;
+	std::size_t nrOfSamples, minLeafSize{10}, maxDepth, maxLeafNodes, maxSplitSamples, subD;
 	
 	// Vector of sampled trees
 	std::vector< RegressionTree<T, U> > trees;
 	
 	// Vector of unused samples, available for out of bag error calculation
 	std::vector< std::set<std::size_t> > unusedSamples;
-
+	
+	// Indicate order of tree growth, with depth-first as default
+	char growth{'d'};
+	
+	// Indicate whether trees are extremely randomised
+	bool extraTrees{false};
+	
+	// Fraction of examples drawn for each bootstrap sample, and whether they are drawn with replacement
+	double maxSamples{1};
+	bool replace{true};
+	
+	// Indicate whether identical subtrees of different trees have been merged
+	bool shared{false};
+	
+	// Timers and counters of all tree builds, which only exist if compiled with DTREES_PROFILE defined
+#ifdef DTREES_PROFILE
+	BuildStats buildStats;
+#endif
+	
+	// Running sum and number of out-of-bag predictions of each example, the number of examples with any
+	// such predictions and their total squared error, and the out-of-bag error after each tree was added
+	std::vector<double> oobSum;
+	std::vector<std::size_t> oobCount;
+	std::size_t oobCovered;
+	double oobSqError;
+	std::vector<double> oobHistory;
+	
+	// Indicate whether the running out-of-bag predictions match the trees
+	bool oobValid;
+	
+	// Memory budget in bytes (not used if 0), the memory held so far while growing trees within it, and
+	// whether new trees release their training data once built to stay within it
+	std::size_t memoryBudget{0}, memoryHeld{0};
+	bool releaseData{false};
 	
 public:
  
@@ -208,7 +1087,7 @@ public:
 	
 	// Constructor
 	BaggedRegressionTrees(const std::vector< std::vector<T> >& in, const std::vector<U>& out, const std::size_t& nr) 
-	: inputs(in), outputs(out), N(in.size()), nrOfSamples(nr), maxDepth(N) {trees.resize(nr); subD = inputs[0].size();}
+	: inputs(in), outputs(out), N(in.size()), nrOfSamples(nr), maxDepth(N), maxLeafNodes(N), maxSplitSamples(N) {unusedSamples.resize(N); subD = inputs[0].size(); resetOutOfBag();}
 
 
 	// Pruning properties of trees
@@ -218,6 +1097,42 @@ public:
 	std::size_t getMaxDepth() const {return maxDepth;}
 	
 	
+	// Order in which each tree is grown
+	void setGrowth(char c)
+	{
+		if (c != 'd' && c != 'l' && c != 'b')
+			throw std::invalid_argument("Growth must be 'd' (depth-first), 'l' (level-wise) or 'b' (best-first)\n");
+		growth = c;
+	}
+	char getGrowth() const {return growth;}
+	void setMaxLeafNodes(const std::size_t& l) {maxLeafNodes = l;}
+	std::size_t getMaxLeafNodes() const {return maxLeafNodes;}
+	
+	
+	// Extremely randomised trees
+	void setExtraTrees(bool b) {extraTrees = b;}
+	bool getExtraTrees() const {return extraTrees;}
+	
+	
+	// Row subsampling, both for bootstrap samples and for the split search at large nodes
+	void setMaxSamples(const double& f)
+	{
+		if (f <= 0 || f > 1)
+			throw std::invalid_argument("Fraction of examples in each sample must be in (0, 1]\n");
+		maxSamples = f;
+	}
+	void setReplacement(bool b) {replace = b;}
+	void setMaxSplitSamples(const std::size_t& s)
+	{
+		if (s == 0)
+			throw std::invalid_argument("Maximum number of split samples must be positive\n");
+		maxSplitSamples = s;
+	}
+	double getMaxSamples() const {return maxSamples;}
+	bool getReplacement() const {return replace;}
+	std::size_t getMaxSplitSamples() const {return maxSplitSamples;}
+	
+	
 	// Random feature selection
 	void setNrSelectedFeatures(const std::size_t n) {subD = n;}
 	std::size_t getNrSelectedFeatures() {return subD;}
@@ -226,10 +1141,108 @@ public:
 	// Construct all trees
 	void buildTrees()
 	{
-		std::tuple<std::size_t, std::size_t, std::size_t, char> properties = std::make_tuple(minLeafSize, maxDepth, subD, ' ');
-		auto bagData = baggingTrees< T, U, RegressionTree<T, U> >(inputs, outputs, trees, properties);
-		trees = bagData.first; unusedSamples = bagData.second;
-	}	
+		std::size_t nr = nrOfSamples;
+		trees.clear();
+		unusedSamples.assign(N, std::set<std::size_t>());
+		resetOutOfBag();
+		shared = false;
+		PROFILE_CLEAR();
+		addTrees(nr);
+	}
+	
+	
+	// Add nr trees grown on new bootstrap samples to the trees already built, which are kept unchanged
+	void addTrees(const std::size_t& nr)
+	{
+		std::random_device rd;
+		std::mt19937 gen(rd());
+		auto groups = bootstrapGroups(outputs, false);
+		std::size_t total = trees.size() + nr;
+		planTrees(nr);
+		while (trees.size() < total)
+		{
+			growTree(groups, gen);
+			std::cout << "Constructed tree " << trees.size() << '/' << total << '\n';
+		}
+	}
+	
+	
+	// Add trees one at a time until the out-of-bag error of the set has improved by less than 'tol' over
+	// the last 'window' trees, or until there are maxTrees trees, and return the number of trees
+	std::size_t addTreesUntilConverged(const std::size_t& maxTrees, const std::size_t& window = 10, const double& tol = 1e-3)
+	{
+		std::random_device rd;
+		std::mt19937 gen(rd());
+		auto groups = bootstrapGroups(outputs, false);
+		planTrees(maxTrees > trees.size() ? maxTrees - trees.size() : 0);
+		while (trees.size() < maxTrees)
+		{
+			growTree(groups, gen);
+			std::cout << "Constructed tree " << trees.size() << '/' << maxTrees << '\n';
+			std::size_t k = oobHistory.size();
+			if (k > window && oobHistory[k-1-window] - oobHistory[k-1] < tol)
+				break;
+		}
+		return trees.size();
+	}
+	
+	
+	// Out-of-bag error of the set after each tree was added, for examples left out of any sample so far
+	const std::vector<double>& getOutOfBagHistory() const {return oobHistory;}
+	
+	
+	// Timers and counters of all tree builds, which are only available if the library is compiled with
+	// DTREES_PROFILE defined. With tracing on, every timed phase is recorded with the tree it belongs to.
+#ifdef DTREES_PROFILE
+	const BuildStats& getBuildStats() const {return buildStats;}
+	void setTrace(bool b) {buildStats.trace = b;}
+#endif
+	
+	
+	// Memory held by the set, broken down by kind, with subtrees shared between trees counted once
+	MemoryUsage memoryUsage() const {return baggedMemory(trees, inputs, outputs, unusedSamples, outOfBagBytes());}
+	
+	
+	// Compile the trees into an immutable predictor holding only their nodes and leaf values, averaging their
+	// predictions
+	ForestPredictor<T, U> toPredictor() const
+	{
+		std::vector<U> values;
+		std::map<U, std::size_t> position;
+		std::vector< TreePredictor<T, U> > compiled;
+		for (const auto& tree : trees)
+			compiled.push_back(tree.toPredictor(values, position));
+		return ForestPredictor<T, U>(compiled, values, false);
+	}
+	
+	
+	// Compile the trees into a predictor, then free the training data and all trees, including their nodes.
+	// The set is left empty, and copies of it, which share its nodes, cannot be used afterwards.
+	ForestPredictor<T, U> freeze()
+	{
+		ForestPredictor<T, U> predictor = toPredictor();
+		std::unordered_set<const void*> seen;
+		for (auto& tree : trees)
+			tree.release(seen);
+		std::vector< RegressionTree<T, U> >().swap(trees);
+		std::vector< std::vector<T> >().swap(inputs);
+		std::vector<U>().swap(outputs);
+		std::vector< std::set<std::size_t> >().swap(unusedSamples);
+		std::vector<double>().swap(oobSum);
+		std::vector<std::size_t>().swap(oobCount);
+		std::vector<double>().swap(oobHistory);
+		N = 0;
+		resetOutOfBag();
+		return predictor;
+	}
+	
+	
+	// Memory budget in bytes for growing trees (0 for none). Each tree is built within what is left of the
+	// budget, as for a single tree. If keeping the bootstrap sample of every tree would exceed the budget,
+	// trees release their training data once built, after which they cannot be pruned. If the estimated
+	// memory still exceeds the budget, growing trees fails with the estimate before any tree is built.
+	void setMemoryBudget(const std::size_t& b) {memoryBudget = b;}
+	std::size_t getMemoryBudget() const {return memoryBudget;}
 	
 	
 	// Predict new output value for a given input point, based on aggregate of trees
@@ -240,10 +1253,135 @@ public:
 		for (const auto& tree : trees)
 			sum += tree.predict(in);
 		
-		return sum / nrOfSamples;
+		return sum / trees.size();
+	}
+	
+	
+	// Predict output value for a sparse input, given as (feature, value) pairs sorted by feature
+	U predict(const std::vector< std::pair<std::size_t, T> >& in) const
+	{
+		U sum = 0;
+		for (const auto& tree : trees)
+			sum += tree.predict(in);
+		
+		return sum / trees.size();
+	}
+	
+	
+	// Prediction of each tree of the set for a dense input
+	std::vector<U> treePredictions(const std::vector<T>& in) const
+	{
+		std::vector<U> out;
+		out.reserve(trees.size());
+		for (const auto& tree : trees)
+			out.push_back(tree.predict(in));
+		return out;
 	}
 	
 
+	// Prune every tree in place, either with a common complexity parameter alpha or with the parameter
+	// giving the least out-of-bag error for each tree
+	void prune(const double& alpha)
+	{
+		checkUnshared();
+		oobValid = false;
+		for (auto& tree : trees)
+			tree.prune(alpha);
+	}
+	std::vector<double> pruneTrees()
+	{
+		checkUnshared();
+		oobValid = false;
+		return pruneOutOfBag(inputs, outputs, trees, unusedSamples);
+	}
+	
+	
+	// Calibrate every tree on a representative sample of inputs, compiling each into a node array laid out
+	// for the paths taken most often, and return the number of tree evaluations by path length
+	std::vector<std::size_t> calibrate(const std::vector< std::vector<T> >& in)
+	{
+		std::vector<std::size_t> pathLengths;
+		for (auto& tree : trees)
+		{
+			tree.calibrate(in);
+			const auto& lengths = tree.getPathLengths();
+			if (pathLengths.size() < lengths.size())
+				pathLengths.resize(lengths.size(), 0);
+			for (std::size_t l = 0; l < lengths.size(); ++l)
+				pathLengths[l] += lengths[l];
+		}
+		return pathLengths;
+	}
+	
+	
+	// Merge identical subtrees of all trees (same leaf value, or same split and branches) into one shared
+	// structure, which cuts memory and improves cache use during prediction. Returns the number of distinct
+	// nodes before and after. The trees can no longer be pruned afterwards.
+	std::pair<std::size_t, std::size_t> shareSubtrees()
+	{
+		shared = true;
+		return mergeSubtrees(trees);
+	}
+	
+	
+	// Keep only a subset of the trees, chosen greedily by adding at each step the tree which most reduces
+	// the mean squared error of the average prediction on the examples 'in', until that error is within
+	// 'tol' of the error of all trees. Returns the number of trees kept, the error of all trees and of
+	// those kept, and the mean prediction time per example in microseconds before and after
+	std::tuple<std::size_t, double, double, double, double> compress(const std::vector< std::vector<T> >& in,
+			const std::vector<U>& out, const double& tol)
+	{
+		std::vector< std::vector<double> > pred(trees.size(), std::vector<double>(in.size()));
+		for (std::size_t t = 0; t < trees.size(); ++t)
+			for (std::size_t m = 0; m < in.size(); ++m)
+				pred[t][m] = trees[t].predict(in[m]);
+		return compressTrees(in, out, pred, tol);
+	}
+	
+	
+	// Compress the set of trees in the same way, judging each tree only on the training examples left out
+	// of its bootstrap sample
+	std::tuple<std::size_t, double, double, double, double> compress(const double& tol)
+	{
+		std::vector< std::vector<double> > pred(trees.size(), std::vector<double>(N, std::nan("")));
+		for (std::size_t n = 0; n < N; ++n)
+			for (std::size_t sample : unusedSamples[n])
+				pred[sample][n] = trees[sample].predict(inputs[n]);
+		return compressTrees(inputs, outputs, pred, tol);
+	}
+	
+	
+	// Train a new set of 'nr' bagged trees with the same settings on the predictions of this set, made for
+	// its training inputs together with any further inputs 'extra', so that fewer trees mimic this set
+	BaggedRegressionTrees distil(const std::size_t& nr, const std::vector< std::vector<T> >& extra = {}) const
+	{
+		BaggedRegressionTrees student(*this);
+		std::tie(student.inputs, student.outputs) = teacherData(extra);
+		student.N = student.inputs.size();
+		if (maxDepth == N)
+			student.maxDepth = student.N;
+		if (maxLeafNodes == N)
+			student.maxLeafNodes = student.N;
+		if (maxSplitSamples == N)
+			student.maxSplitSamples = student.N;
+		student.nrOfSamples = nr;
+		student.buildTrees();
+		return student;
+	}
+	
+	
+	// Train a single tree on the predictions of this set, made as for distil, with the same leaf size and depth
+	RegressionTree<T, U> distilTree(const std::vector< std::vector<T> >& extra = {}) const
+	{
+		auto data = teacherData(extra);
+		RegressionTree<T, U> tree(data.first, data.second);
+		tree.setMinLeafSize(minLeafSize);
+		tree.setGrowth(growth);
+		tree.buildTree();
+		return tree;
+	}
+	
+	
 	// Calculate out of bag error by testing each training point on the trees which did not sample that point
 	double outOfBagError()
 	{
@@ -260,6 +1398,200 @@ public:
 			}
 		return error / size;
 	}	
+	
+	
+private:
+
+	// Check that trees can be changed in place
+	void checkUnshared() const
+	{
+		if (shared)
+			throw std::invalid_argument("Trees cannot be pruned once their subtrees are shared\n");
+	}
+	
+	
+
+	// Select trees greedily for compress, given the prediction 'pred[t][m]' of tree t for example m, or
+	// NaN where the tree does not vote on that example. Examples on which no chosen tree votes yet are
+	// predicted by the mean training output.
+	std::tuple<std::size_t, double, double, double, double> compressTrees(const std::vector< std::vector<T> >& in,
+			const std::vector<U>& out, const std::vector< std::vector<double> >& pred, const double& tol)
+	{
+		std::size_t M = out.size(), nr = pred.size();
+		double mean = std::accumulate(outputs.begin(), outputs.end(), 0.0) / N;
+		
+		// Error of the average prediction of all trees, over the examples on which any tree votes
+		std::vector<double> sum(M, 0);
+		std::vector<std::size_t> count(M, 0), used;
+		for (std::size_t t = 0; t < nr; ++t)
+			for (std::size_t m = 0; m < M; ++m)
+				if (!std::isnan(pred[t][m]))
+				{
+					sum[m] += pred[t][m];
+					++count[m];
+				}
+		double fullError = 0;
+		for (std::size_t m = 0; m < M; ++m)
+			if (count[m] > 0)
+			{
+				used.push_back(m);
+				fullError += pow(sum[m]/count[m] - out[m], 2);
+			}
+		std::size_t nrUsed = std::max<std::size_t>(used.size(), 1);
+		fullError /= nrUsed;
+		
+		// Add the tree which reduces the squared error the most until the error is small enough
+		std::fill(sum.begin(), sum.end(), 0);
+		std::fill(count.begin(), count.end(), 0);
+		double total = 0;
+		for (std::size_t m : used)
+			total += pow(mean - out[m], 2);
+		double error = total / nrUsed;
+		std::vector<std::size_t> keep;
+		std::vector<char> chosen(nr, 0);
+		while (keep.size() < nr && (keep.empty() || error > fullError + tol))
+		{
+			std::size_t pick = 0;
+			double bestGain = -std::numeric_limits<double>::infinity();
+			for (std::size_t t = 0; t < nr; ++t)
+			{
+				if (chosen[t])
+					continue;
+				double gain = 0;
+				for (std::size_t m : used)
+				{
+					if (std::isnan(pred[t][m]))
+						continue;
+					double old = count[m] > 0 ? sum[m]/count[m] : mean;
+					gain += pow(old - out[m], 2) - pow((sum[m] + pred[t][m])/(count[m] + 1) - out[m], 2);
+				}
+				if (gain > bestGain)
+				{
+					bestGain = gain;
+					pick = t;
+				}
+			}
+			
+			chosen[pick] = 1;
+			keep.push_back(pick);
+			for (std::size_t m : used)
+				if (!std::isnan(pred[pick][m]))
+				{
+					sum[m] += pred[pick][m];
+					++count[m];
+				}
+			total -= bestGain;
+			error = std::max(total, 0.0) / nrUsed;
+		}
+		
+		double before = meanPredictionTime(*this, in);
+		std::sort(keep.begin(), keep.end());
+		keepTrees(trees, unusedSamples, keep);
+		nrOfSamples = trees.size();
+		oobValid = false;
+		double after = meanPredictionTime(*this, in);
+		return std::make_tuple(keep.size(), fullError, error, before, after);
+	}
+	
+	
+	// Clear the running out-of-bag predictions
+	void resetOutOfBag()
+	{
+		oobSum.assign(N, 0);
+		oobCount.assign(N, 0);
+		oobCovered = 0; oobSqError = 0;
+		oobHistory.clear();
+		oobValid = true;
+	}
+	
+	
+	// Memory in bytes of the running out-of-bag predictions
+	std::size_t outOfBagBytes() const
+	{
+		return oobSum.capacity() * sizeof(double) + oobCount.capacity() * sizeof(std::size_t) + oobHistory.capacity() * sizeof(double);
+	}
+	
+	
+	// Add the prediction of a tree for an example left out of its sample
+	void addOutOfBagPrediction(const std::size_t& n, const double& y)
+	{
+		if (oobCount[n] == 0)
+			++oobCovered;
+		else
+			oobSqError -= pow(oobSum[n]/oobCount[n] - outputs[n], 2);
+		oobSum[n] += y;
+		++oobCount[n];
+		oobSqError += pow(oobSum[n]/oobCount[n] - outputs[n], 2);
+	}
+	
+	
+	// Plan the memory of growing nr more trees within the budget, if there is one, deciding whether they
+	// keep their bootstrap sample
+	void planTrees(const std::size_t& nr)
+	{
+		if (memoryBudget == 0)
+			return;
+		MemoryUsage usage = memoryUsage();
+		std::size_t n = std::ceil(maxSamples * N);
+		std::size_t sampleBytes = n * (sizeof(std::vector<T>) + inputs[0].size() * sizeof(T) + sizeof(U) + sizeof(std::size_t));
+		releaseData = planMemory< RegressionTree<T, U> >(usage, trees.size(), nr, n, sampleBytes, memoryBudget);
+		memoryHeld = usage.total();
+	}
+	
+	
+	// Grow one more tree on a new bootstrap sample and add its predictions for the examples left out of it
+	void growTree(const std::vector< std::vector<std::size_t> >& groups, std::mt19937& gen)
+	{
+		if (!oobValid)
+		{
+			resetOutOfBag();
+			for (std::size_t n = 0; n < N; ++n)
+				for (std::size_t sample : unusedSamples[n])
+					addOutOfBagPrediction(n, trees[sample].predict(inputs[n]));
+		}
+		
+		PROFILE_PHASE(BOOTSTRAP);
+		std::vector<std::size_t> pnts = bootstrapSample(groups, maxSamples, replace, gen);
+		PROFILE_STOP();
+		std::size_t budget = 0;
+		if (memoryBudget > 0)
+		{
+			if (memoryHeld >= memoryBudget)
+				throw std::invalid_argument("Trees have used up the memory budget of " + std::to_string(memoryBudget) + " bytes\n");
+			budget = memoryBudget - memoryHeld;
+		}
+		trees.push_back(baggedTree< T, U, RegressionTree<T, U> >(inputs, outputs, pnts,
+			std::make_tuple(minLeafSize, maxDepth, subD, ' ', growth, maxLeafNodes, extraTrees, maxSplitSamples), PROFILE_TRACING(),
+			budget, releaseData));
+		std::size_t j = trees.size() - 1;
+		if (memoryBudget > 0)
+			memoryHeld += trees[j].memoryUsage().total();
+		PROFILE_ADD(trees[j].getBuildStats(), j);
+		nrOfSamples = trees.size();
+		
+		std::vector<char> inBag(N, 0);
+		for (std::size_t p : pnts)
+			inBag[p] = 1;
+		for (std::size_t n = 0; n < N; ++n)
+			if (!inBag[n])
+			{
+				unusedSamples[n].insert(unusedSamples[n].end(), j);
+				addOutOfBagPrediction(n, trees[j].predict(inputs[n]));
+			}
+		oobHistory.push_back(oobCovered > 0 ? std::max(oobSqError, 0.0) / oobCovered : 0);
+	}
+	
+	
+	// Training inputs together with the inputs 'extra', labelled by the predictions of this set
+	std::pair< std::vector< std::vector<T> >, std::vector<U> > teacherData(const std::vector< std::vector<T> >& extra) const
+	{
+		std::vector< std::vector<T> > in(inputs);
+		in.insert(in.end(), extra.begin(), extra.end());
+		std::vector<U> out(in.size());
+		for (std::size_t n = 0; n < in.size(); ++n)
+			out[n] = predict(in[n]);
+		return std::make_pair(in, out);
+	}
 };
 
 
@@ -0,0 +1,398 @@
+
+#ifndef _BOOSTING_
+#define _BOOSTING_
+
+#include <random>
+#include <limits>
+#include <type_traits>
+#include "trees.h"
+
+
+// Gradient-boosted trees: a sum of shallow regression trees, each fitted to the gradient of the loss of the
+// trees before it. The loss is the squared error ('s'), for regression, or the multinomial log-loss ('l'),
+// for classification, with one tree per class in each round when there are more than two classes and a
+// single tree per round otherwise. The training examples are sorted along each feature once, and every
+// tree of every round is built from the same sorted columns, only replacing the outputs it is fitted to.
+template<typename T, typename U>
+class GradientBoostedTrees
+{
+
+	// MEMBER OBJECTS
+
+	// Loss minimised, 's' (squared error) or 'l' (log-loss)
+	char loss;
+
+	// Number of scores summed over the trees: 1 for regression and two classes, or else one per class
+	std::size_t S{0};
+
+	// Classes in increasing order (log-loss only), and the initial value of each score
+	std::vector<U> classes;
+	std::vector<double> base;
+
+	// Trees of each round r and score s at position r*S + s, with leaf values including the learning rate,
+	// compactly encoded with thresholds in the input type when the inputs are numerical
+	std::vector< TreePredictor<T, double> > trees;
+
+	// Settings of the rounds and of the trees
+	std::size_t nrRounds{100}, maxDepth{3}, minLeafSize{10}, nrSelectedFeatures{0}, patience{10};
+	double learningRate{0.1}, subsample{1};
+	unsigned seed{0};
+
+	// Mean loss on the training examples and on the validation examples after each round
+	std::vector<double> trainingLoss, validationLoss;
+
+
+	// METHODS
+
+	// Position of each output in the classes, or the output itself for squared error
+	std::vector<double> targets(const std::vector<U>& out) const
+	{
+		std::vector<double> y(out.size());
+		for (std::size_t n = 0; n < out.size(); ++n)
+			if (loss == 'l')
+			{
+				auto search = std::lower_bound(classes.begin(), classes.end(), out[n]);
+				y[n] = search != classes.end() && *search == out[n] ? search - classes.begin() : -1;
+			}
+			else if constexpr (std::is_arithmetic<U>::value)
+				y[n] = out[n];
+		return y;
+	}
+
+
+	// Probabilities of the classes given the scores of one example
+	void probabilitiesOf(const double* score, double* prob) const
+	{
+		if (classes.size() == 2)
+		{
+			prob[1] = 1 / (1 + std::exp(-score[0]));
+			prob[0] = 1 - prob[1];
+			return;
+		}
+		double top = *std::max_element(score, score + S), sum = 0;
+		for (std::size_t k = 0; k < S; ++k)
+		{
+			prob[k] = std::exp(score[k] - top);
+			sum += prob[k];
+		}
+		for (std::size_t k = 0; k < S; ++k)
+			prob[k] /= sum;
+	}
+
+
+	// Mean loss of scores F (S per example) against targets y. An example of a class not seen in training
+	// has probability 0, so its log-loss is that of the smallest probability counted.
+	double meanLoss(const std::vector<double>& F, const std::vector<double>& y) const
+	{
+		double total = 0;
+		std::vector<double> prob(classes.size());
+		for (std::size_t n = 0; n < y.size(); ++n)
+			if (loss == 's')
+				total += (y[n] - F[n]) * (y[n] - F[n]);
+			else
+			{
+				probabilitiesOf(&F[n * S], prob.data());
+				total -= std::log(std::max(y[n] < 0 ? 0 : prob[(std::size_t)y[n]], 1e-15));
+			}
+		return y.empty() ? 0 : total / y.size();
+	}
+
+
+	// Add the predictions of a tree to score s of every example
+	static void addTree(const TreePredictor<T, double>& tree, const std::vector< std::vector<T> >& in, std::vector<double>& F,
+			const std::size_t& S, const std::size_t& s)
+	{
+		for (std::size_t n = 0; n < in.size(); ++n)
+			F[n * S + s] += tree.predict(in[n]);
+	}
+
+
+	// Scores of a batch of examples, S per example. The trees are added one at a time over blocks of
+	// examples small enough to stay in cache, so that neither the trees nor the inputs are read from
+	// memory once per tree. Only examples first to last are scored, and the scores are numbered from first.
+	std::vector<double> batchScores(const std::vector< std::vector<T> >& in, const std::size_t& first, const std::size_t& last) const
+	{
+		const std::size_t blockSize = 256;
+		std::vector<double> F((last - first) * S);
+		for (std::size_t n = 0; n < last - first; ++n)
+			std::copy(base.begin(), base.end(), F.begin() + n * S);
+		for (std::size_t start = first; start < last; start += blockSize)
+		{
+			std::size_t end = std::min(last, start + blockSize);
+			for (std::size_t t = 0; t < trees.size(); ++t)
+				for (std::size_t n = start; n < end; ++n)
+					F[(n - first) * S + t % S] += trees[t].predict(in[n]);
+		}
+		return F;
+	}
+
+
+	// Output for the scores of one example
+	U outputOf(const double* score) const
+	{
+		if (loss == 'l')
+		{
+			if (classes.size() == 2)
+				return classes[score[0] > 0];
+			return classes[std::max_element(score, score + S) - score];
+		}
+		if constexpr (std::is_arithmetic<U>::value)
+			return (U) score[0];
+		else
+			throw std::invalid_argument("Squared error requires numerical outputs\n");
+	}
+
+
+public:
+
+	// Constructor, with the loss: 's' (squared error) or 'l' (log-loss)
+	GradientBoostedTrees(char l = 's')
+	: loss(l)
+	{
+		if (loss != 's' && loss != 'l')
+			throw std::invalid_argument("Loss must be 's' (squared error) or 'l' (log-loss)\n");
+		if (loss == 's' && !std::is_arithmetic<U>::value)
+			throw std::invalid_argument("Squared error requires numerical outputs\n");
+	}
+
+
+	// Settings: maximum number of rounds, shrinkage of each tree, depth, minimum leaf size and number of
+	// features checked at each node of the trees (0 for all), fraction of the training examples each round
+	// is fitted to, and number of rounds without improvement on the validation set before training stops
+	void setNrRounds(const std::size_t& r) {nrRounds = r;}
+	void setLearningRate(const double& rate)
+	{
+		if (!(rate > 0))
+			throw std::invalid_argument("Learning rate must be positive\n");
+		learningRate = rate;
+	}
+	void setMaxDepth(const std::size_t& d) {maxDepth = d;}
+	void setMinLeafSize(const std::size_t& s) {minLeafSize = s;}
+	void setNrSelectedFeatures(const std::size_t& n) {nrSelectedFeatures = n;}
+	void setSubsample(const double& f)
+	{
+		if (!(f > 0 && f <= 1))
+			throw std::invalid_argument("Subsample fraction must be in (0, 1]\n");
+		subsample = f;
+	}
+	void setPatience(const std::size_t& p) {patience = p;}
+	void setSeed(const unsigned& s) {seed = s;}
+	char getLoss() const {return loss;}
+
+
+	// Train on the given examples, for the maximum number of rounds
+	void fit(const std::vector< std::vector<T> >& in, const std::vector<U>& out)
+	{
+		fit(in, out, std::vector< std::vector<T> >(), std::vector<U>());
+	}
+
+
+	// Train on the given examples, stopping once the loss on the validation examples has not improved for
+	// 'patience' rounds, and keeping the rounds up to its lowest value
+	void fit(const std::vector< std::vector<T> >& in, const std::vector<U>& out,
+			const std::vector< std::vector<T> >& validIn, const std::vector<U>& validOut)
+	{
+		if (in.size() != out.size() || in.empty())
+			throw std::invalid_argument("Number of training inputs (" + std::to_string(in.size())
+					+ ") and outputs (" + std::to_string(out.size()) + ") must match and be positive\n");
+		if (validIn.size() != validOut.size())
+			throw std::invalid_argument("Number of validation inputs (" + std::to_string(validIn.size())
+					+ ") and outputs (" + std::to_string(validOut.size()) + ") must match\n");
+		std::size_t N = in.size(), M = validIn.size();
+
+		// Classes and initial scores: the mean output, the log-odds of the second class, or the log-prior of each class
+		classes.clear();
+		base.clear();
+		trees.clear();
+		trainingLoss.clear();
+		validationLoss.clear();
+		if (loss == 'l')
+		{
+			classes = out;
+			std::sort(classes.begin(), classes.end());
+			classes.erase(std::unique(classes.begin(), classes.end()), classes.end());
+			if (classes.size() < 2)
+				throw std::invalid_argument("Log-loss requires at least two classes\n");
+		}
+		S = loss == 'l' && classes.size() > 2 ? classes.size() : 1;
+		std::vector<double> y = targets(out), validY = targets(validOut);
+		if (loss == 's')
+			base.push_back(std::accumulate(y.begin(), y.end(), 0.0) / N);
+		else
+		{
+			std::vector<double> prior(classes.size());
+			for (std::size_t n = 0; n < N; ++n)
+				prior[(std::size_t)y[n]] += 1.0 / N;
+			if (S == 1)
+				base.push_back(std::log(prior[1] / prior[0]));
+			else
+				for (std::size_t k = 0; k < S; ++k)
+					base.push_back(std::log(prior[k]));
+		}
+		std::vector<double> F(N * S), validF(M * S);
+		for (std::size_t n = 0; n < N; ++n)
+			std::copy(base.begin(), base.end(), F.begin() + n * S);
+		for (std::size_t m = 0; m < M; ++m)
+			std::copy(base.begin(), base.end(), validF.begin() + m * S);
+
+		// One tree over the training inputs, rebuilt on new gradients each round from columns sorted once
+		RegressionTree<T, double> tree(in, std::vector<double>(N));
+		tree.setGrowth('l');
+		tree.setMaxDepth(maxDepth);
+		tree.setMinLeafSize(minLeafSize);
+		if (nrSelectedFeatures > 0)
+			tree.setNrSelectedFeatures(nrSelectedFeatures);
+		tree.setSeed(seed);
+		SortedColumns<T> columns = tree.sortColumns();
+		tree.setPresorted(&columns);
+
+		std::mt19937 gen(seed);
+		std::vector<std::size_t> rows(N);
+		std::iota(rows.begin(), rows.end(), 0);
+		std::size_t sampled = std::max<std::size_t>(1, (std::size_t)(subsample * N));
+		std::vector<char> mask;
+		std::vector<double> gradient(N), prob(N * classes.size());
+		double factor = S > 1 ? (S - 1.0) / S : 1, best = std::numeric_limits<double>::infinity();
+		std::size_t bestRound = 0;
+		for (std::size_t r = 0; r < nrRounds; ++r)
+		{
+			if (sampled < N)
+			{
+				std::shuffle(rows.begin(), rows.end(), gen);
+				mask.assign(N, 0);
+				for (std::size_t i = 0; i < sampled; ++i)
+					mask[rows[i]] = 1;
+				tree.setRowMask(mask);
+			}
+			if (loss == 'l')
+				for (std::size_t n = 0; n < N; ++n)
+					probabilitiesOf(&F[n * S], &prob[n * classes.size()]);
+
+			// Fit a tree to the negative gradient of each score, then set each leaf to a Newton step
+			for (std::size_t s = 0; s < S; ++s)
+			{
+				std::size_t k = S == 1 ? 1 : s;
+				for (std::size_t n = 0; n < N; ++n)
+					gradient[n] = loss == 's' ? y[n] - F[n] : (y[n] == k) - prob[n * classes.size() + k];
+				tree.setOutputs(gradient);
+				tree.buildTree();
+				tree.refitLeaves([&](const std::vector<std::size_t>& leafRows)
+				{
+					double sum = 0, hessian = 0;
+					for (const auto& n : leafRows)
+					{
+						sum += gradient[n];
+						hessian += loss == 's' ? 1 : std::abs(gradient[n]) * (1 - std::abs(gradient[n]));
+					}
+					return hessian > 1e-12 ? learningRate * factor * sum / hessian : 0;
+				});
+				trees.push_back(tree.toPredictor());
+				tree.deleteNodes();
+				if constexpr (std::is_arithmetic<T>::value)
+					trees.back().compact('t');
+				addTree(trees.back(), in, F, S, s);
+				if (M > 0)
+					addTree(trees.back(), validIn, validF, S, s);
+			}
+
+			trainingLoss.push_back(meanLoss(F, y));
+			if (M == 0)
+				continue;
+			validationLoss.push_back(meanLoss(validF, validY));
+			if (validationLoss.back() < best)
+			{
+				best = validationLoss.back();
+				bestRound = r;
+			}
+			else if (r - bestRound >= patience)
+				break;
+		}
+		if (M > 0)
+			trees.resize((bestRound + 1) * S);
+	}
+
+
+	// Scores of an input: the output for squared error, the log-odds of the second class for two classes,
+	// or else the unnormalised log-probability of each class
+	std::vector<double> scores(const std::vector<T>& in) const
+	{
+		std::vector<double> score = base;
+		for (std::size_t t = 0; t < trees.size(); ++t)
+			score[t % S] += trees[t].predict(in);
+		return score;
+	}
+
+
+	// Probability of each class, in the order of getClasses(), for log-loss
+	std::vector<double> probabilities(const std::vector<T>& in) const
+	{
+		if (loss != 'l')
+			throw std::invalid_argument("Probabilities require log-loss\n");
+		std::vector<double> score = scores(in), prob(classes.size());
+		probabilitiesOf(score.data(), prob.data());
+		return prob;
+	}
+
+
+	// Predict the output of an input
+	U predict(const std::vector<T>& in) const
+	{
+		if (trees.empty() && base.empty())
+			throw std::invalid_argument("Model has not been trained\n");
+		std::vector<double> score = scores(in);
+		return outputOf(score.data());
+	}
+
+
+	// Predict the outputs of a batch of inputs, or of inputs first to last of a batch, which are read in place
+	std::vector<U> predictBatch(const std::vector< std::vector<T> >& in) const {return predictBatch(in, 0, in.size());}
+	std::vector<U> predictBatch(const std::vector< std::vector<T> >& in, const std::size_t& first, const std::size_t& last) const
+	{
+		if (trees.empty() && base.empty())
+			throw std::invalid_argument("Model has not been trained\n");
+		std::vector<double> F = batchScores(in, first, last);
+		std::vector<U> out(last - first);
+		for (std::size_t n = 0; n < last - first; ++n)
+			out[n] = outputOf(&F[n * S]);
+		return out;
+	}
+
+
+	// Number of rounds kept, trees and nodes
+	std::size_t size() const {return S ? trees.size() / S : 0;}
+	std::size_t treeCount() const {return trees.size();}
+	std::size_t nodeCount() const
+	{
+		std::size_t count = 0;
+		for (const auto& tree : trees)
+			count += tree.nodeCount();
+		return count;
+	}
+
+
+	// Memory held by the trees
+	MemoryUsage memoryUsage() const
+	{
+		MemoryUsage usage;
+		for (const auto& tree : trees)
+			usage.add(tree.memoryUsage());
+		return usage;
+	}
+
+
+	// Tree of round r for score s
+	const TreePredictor<T, double>& tree(const std::size_t& r, const std::size_t& s = 0) const {return trees.at(r * S + s);}
+
+
+	// Classes in increasing order, and the mean loss after each round of training
+	const std::vector<U>& getClasses() const {return classes;}
+	const std::vector<double>& getTrainingLoss() const {return trainingLoss;}
+	const std::vector<double>& getValidationLoss() const {return validationLoss;}
+
+
+};
+
+
+
+
+#endif     // _BOOSTING_
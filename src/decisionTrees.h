@@ -3,13 +3,40 @@
 #ifndef _DTREES_
 #define _DTREES_
 
+// Class for sparse matrices of inputs
+#include "sparse.h"
+
+// Counters and timers for profiling tree construction, and memory accounting
+#include "profiling.h"
+
+// Immutable trees and sets of trees used only for prediction
+#include "predictor.h"
+
 // Classes for classification and regression trees, defining
 // data structure and associated methods for both types of tree
 #include "trees.h"
 
+// Regression and classification trees predicting several targets with one traversal
+#include "multioutput.h"
+
 // Classes for bagged classification and regression trees
 #include "bagging.h"
 
+// Gradient-boosted trees for squared error and log-loss
+#include "boosting.h"
+
+// Incremental Hoeffding trees learnt from streams of examples
+#include "streaming.h"
+
+// Cross-validation and search over the hyperparameters of trees
+#include "tuning.h"
+
+// Handle for replacing the model of a live server without pausing prediction
+#include "serving.h"
+
+// Parallel evaluation of models: confusion matrices, error metrics and per-tree agreement
+#include "evaluation.h"
+
 // A set of functions for testing tree performance
 #include "testing.h"
 
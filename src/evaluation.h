@@ -0,0 +1,495 @@
+
+#ifndef _EVALUATION_
+#define _EVALUATION_
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <type_traits>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include "serving.h"
+
+
+
+// Confusion matrix of a classifier, from which the accuracy and the precision and recall of each class follow
+template<typename U>
+class ClassificationMetrics
+{
+public:
+
+	// MEMBER OBJECTS
+
+	// Classes seen among the actual and predicted outputs, in increasing order, and the number of examples
+	// of each actual class (row) predicted as each class (column)
+	std::vector<U> classes;
+	std::vector< std::vector<std::size_t> > counts;
+
+
+	// METHODS
+
+	// Position of a class, adding it if it has not been seen yet
+	std::size_t index(const U& c)
+	{
+		auto it = std::lower_bound(classes.begin(), classes.end(), c);
+		std::size_t k = it - classes.begin();
+		if (it == classes.end() || c < *it)
+		{
+			classes.insert(it, c);
+			for (auto& row : counts)
+				row.insert(row.begin() + k, 0);
+			counts.insert(counts.begin() + k, std::vector<std::size_t>(classes.size(), 0));
+		}
+		return k;
+	}
+
+
+	// Count nr examples of class 'actual' predicted as 'predicted'. Both classes are added before either
+	// position is taken, since adding a class shifts the positions after it.
+	void add(const U& actual, const U& predicted, const std::size_t& nr = 1)
+	{
+		index(actual);
+		std::size_t p = index(predicted), a = index(actual);
+		counts[a][p] += nr;
+	}
+
+
+	// Add the counts of another matrix
+	void merge(const ClassificationMetrics& other)
+	{
+		for (std::size_t a = 0; a < other.classes.size(); ++a)
+			for (std::size_t p = 0; p < other.classes.size(); ++p)
+				if (other.counts[a][p] > 0)
+					add(other.classes[a], other.classes[p], other.counts[a][p]);
+	}
+
+
+	// Number of examples, and fraction of them classified correctly or not
+	std::size_t total() const
+	{
+		std::size_t n = 0;
+		for (const auto& row : counts)
+			for (const std::size_t& c : row)
+				n += c;
+		return n;
+	}
+	double accuracy() const
+	{
+		std::size_t correct = 0;
+		for (std::size_t k = 0; k < classes.size(); ++k)
+			correct += counts[k][k];
+		return total() > 0 ? (double)correct / total() : 0;
+	}
+	double error() const {return total() > 0 ? 1 - accuracy() : 0;}
+
+
+	// Precision, recall and F1 score of the class with position k: the fraction of examples predicted as
+	// the class which belong to it, the fraction of examples of the class predicted as it, and their
+	// harmonic mean. Each is 0 if undefined.
+	double precision(const std::size_t& k) const
+	{
+		std::size_t predicted = 0;
+		for (std::size_t a = 0; a < classes.size(); ++a)
+			predicted += counts[a][k];
+		return predicted > 0 ? (double)counts[k][k] / predicted : 0;
+	}
+	double recall(const std::size_t& k) const
+	{
+		std::size_t actual = 0;
+		for (const std::size_t& c : counts[k])
+			actual += c;
+		return actual > 0 ? (double)counts[k][k] / actual : 0;
+	}
+	double f1(const std::size_t& k) const
+	{
+		double p = precision(k), r = recall(k);
+		return p + r > 0 ? 2 * p * r / (p + r) : 0;
+	}
+
+
+	// Unweighted mean of the F1 scores of all classes
+	double macroF1() const
+	{
+		double sum = 0;
+		for (std::size_t k = 0; k < classes.size(); ++k)
+			sum += f1(k);
+		return classes.empty() ? 0 : sum / classes.size();
+	}
+
+
+	// Display the confusion matrix, with actual classes as rows, followed by the metrics of each class
+	void display() const
+	{
+		std::cout << std::setw(18) << "Actual \\ Predicted";
+		for (const U& c : classes)
+			std::cout << std::setw(10) << c;
+		std::cout << '\n';
+		for (std::size_t a = 0; a < classes.size(); ++a)
+		{
+			std::cout << std::setw(18) << classes[a];
+			for (const std::size_t& c : counts[a])
+				std::cout << std::setw(10) << c;
+			std::cout << '\n';
+		}
+		std::cout << '\n' << std::setw(18) << "Class" << std::setw(12) << "Precision" << std::setw(12) << "Recall"
+			  << std::setw(12) << "F1" << '\n';
+		for (std::size_t k = 0; k < classes.size(); ++k)
+			std::cout << std::setw(18) << classes[k] << std::setw(12) << precision(k) << std::setw(12) << recall(k)
+				  << std::setw(12) << f1(k) << '\n';
+		std::cout << "Accuracy: " << accuracy() << ", macro F1: " << macroF1() << " (" << total() << " examples)\n";
+	}
+};
+
+
+
+// Error metrics of a regressor. The mean and spread of the actual outputs are accumulated with the
+// pairwise update of Chan et al. (1979), so that merging partial results stays accurate.
+class RegressionMetrics
+{
+public:
+
+	// MEMBER OBJECTS
+
+	// Number of examples, sums of absolute and squared errors, and mean of the actual outputs with the sum
+	// of their squared deviations from it
+	std::size_t count{0};
+	double absError{0}, sqError{0}, mean{0}, deviation{0};
+
+
+	// METHODS
+
+	// Add an example with output 'actual' predicted as 'predicted'
+	void add(const double& actual, const double& predicted)
+	{
+		double e = predicted - actual, delta = actual - mean;
+		absError += std::fabs(e);
+		sqError += e * e;
+		++count;
+		mean += delta / count;
+		deviation += delta * (actual - mean);
+	}
+
+
+	// Add the examples of other metrics
+	void merge(const RegressionMetrics& other)
+	{
+		if (other.count == 0)
+			return;
+		double n = count + other.count, delta = other.mean - mean;
+		absError += other.absError;
+		sqError += other.sqError;
+		deviation += other.deviation + delta * delta * count * other.count / n;
+		mean += delta * other.count / n;
+		count += other.count;
+	}
+
+
+	// Mean absolute error, mean squared error and its root, and coefficient of determination R²
+	double mae() const {return count > 0 ? absError / count : 0;}
+	double mse() const {return count > 0 ? sqError / count : 0;}
+	double rmse() const {return std::sqrt(mse());}
+	double r2() const {return deviation > 0 ? 1 - sqError / deviation : 0;}
+
+
+	// Display the metrics
+	void display() const
+	{
+		std::cout << std::setw(20) << "MAE: " << mae() << '\n';
+		std::cout << std::setw(20) << "MSE: " << mse() << '\n';
+		std::cout << std::setw(20) << "RMSE: " << rmse() << '\n';
+		std::cout << std::setw(20) << "R2: " << r2() << '\n';
+		std::cout << std::setw(20) << "Examples: " << count << '\n';
+	}
+};
+
+
+
+// Agreement of each tree of a set with the prediction of the whole set, and error of each tree on its own.
+// For classification, the sums count the examples on which a tree votes for the class predicted by the set
+// and those it misclassifies. For regression, they add up the squared differences from the prediction of
+// the set and the squared errors.
+class TreeAgreement
+{
+public:
+
+	// MEMBER OBJECTS
+
+	std::size_t count{0};
+	std::vector<double> agreed, errors;
+
+
+	// METHODS
+
+	// Add the predictions of each tree for one example, given the prediction of the set and the actual output
+	template<typename U>
+	void add(const std::vector<U>& trees, const U& set, const U& actual, bool classification)
+	{
+		agreed.resize(trees.size(), 0);
+		errors.resize(trees.size(), 0);
+		for (std::size_t t = 0; t < trees.size(); ++t)
+			if (classification)
+			{
+				agreed[t] += (trees[t] == set);
+				errors[t] += (trees[t] != actual);
+			}
+			else if constexpr (std::is_arithmetic<U>::value)
+			{
+				agreed[t] += ((double)trees[t] - (double)set) * ((double)trees[t] - (double)set);
+				errors[t] += ((double)trees[t] - (double)actual) * ((double)trees[t] - (double)actual);
+			}
+		++count;
+	}
+
+
+	// Add the sums of another set of examples
+	void merge(const TreeAgreement& other)
+	{
+		agreed.resize(std::max(agreed.size(), other.agreed.size()), 0);
+		errors.resize(agreed.size(), 0);
+		for (std::size_t t = 0; t < other.agreed.size(); ++t)
+		{
+			agreed[t] += other.agreed[t];
+			errors[t] += other.errors[t];
+		}
+		count += other.count;
+	}
+
+
+	// Agreement of tree t with the set, as the fraction of examples on which it votes for the prediction of
+	// the set or the mean squared difference from it, and its classification error or mean squared error.
+	// Tree t must be one of the trees seen, even before any example has been added.
+	double agreement(const std::size_t& t) const
+	{
+		if (t >= size())
+			throw std::invalid_argument("Tree " + std::to_string(t) + " is not one of the " + std::to_string(size()) + " trees\n");
+		return count > 0 ? agreed[t] / count : 0;
+	}
+	double error(const std::size_t& t) const
+	{
+		if (t >= size())
+			throw std::invalid_argument("Tree " + std::to_string(t) + " is not one of the " + std::to_string(size()) + " trees\n");
+		return count > 0 ? errors[t] / count : 0;
+	}
+
+
+	// Number of trees
+	std::size_t size() const {return agreed.size();}
+};
+
+
+
+
+// Detect whether a model can predict inputs first to last of a batch in place, through predictBatch(in, first, last)
+template<typename M, typename T, typename = void>
+struct HasPredictRange : std::false_type {};
+template<typename M, typename T>
+struct HasPredictRange<M, T, std::void_t<decltype(std::declval<const M&>().predictBatch(std::declval<const std::vector< std::vector<T> >&>(),
+		std::size_t(), std::size_t()))> >
+: std::true_type {};
+
+
+
+// Detect whether a model is a set of trees which can give the prediction of each of its trees
+template<typename M, typename T, typename = void>
+struct HasTreePredictions : std::false_type {};
+template<typename M, typename T>
+struct HasTreePredictions<M, T, std::void_t<decltype(std::declval<const M&>().treePredictions(std::declval<const std::vector<T>&>()))> >
+: std::true_type {};
+
+
+
+
+// Evaluation of a model on examples given in one or more chunks, so that a dataset too large to hold at once
+// can be streamed through it. The examples of each chunk are split into blocks of a fixed size, which are
+// scored in parallel through the batch path of the model if it has one. Each block accumulates its own
+// metrics, and these are merged in the order of the blocks, so the results do not depend on the number of
+// threads. Classification ('c') fills a confusion matrix and regression ('r') error metrics. Per-tree
+// agreement can be added for sets of trees.
+template<typename T, typename U>
+class Evaluation
+{
+
+	// MEMBER OBJECTS
+
+	// Kind of task, number of threads, number of examples per block, and whether per-tree agreement is kept
+	char task;
+	std::size_t nrThreads, blockSize{1024};
+	bool perTree{false};
+
+	// Metrics accumulated over all chunks so far
+	ClassificationMetrics<U> classification;
+	RegressionMetrics regression;
+	TreeAgreement trees;
+
+
+	// METHODS
+
+	// Metrics of one block of examples
+	class Partial
+	{
+	public:
+		ClassificationMetrics<U> classification;
+		RegressionMetrics regression;
+		TreeAgreement trees;
+	};
+
+
+	// Score the examples of one block
+	template<typename M>
+	void scoreBlock(const M& model, const std::vector< std::vector<T> >& in, const std::vector<U>& out,
+			const std::size_t& first, const std::size_t& last, Partial& part) const
+	{
+		std::vector<U> pred;
+		if constexpr (HasPredictRange<M, T>::value)
+			pred = model.predictBatch(in, first, last);
+		else
+			for (std::size_t n = first; n < last; ++n)
+				pred.push_back(model.predict(in[n]));
+
+		for (std::size_t n = first; n < last; ++n)
+		{
+			const U& p = pred[n - first];
+			if (task == 'c')
+				part.classification.add(out[n], p);
+			else if constexpr (std::is_arithmetic<U>::value)
+				part.regression.add((double)out[n], (double)p);
+			if constexpr (HasTreePredictions<M, T>::value)
+				if (perTree)
+					part.trees.add(model.treePredictions(in[n]), p, out[n], task == 'c');
+		}
+	}
+
+
+public:
+
+	// Constructor, for classification ('c') or regression ('r'), scoring on the given number of threads
+	// (one per core by default)
+	Evaluation(char c = 'c', const std::size_t& threads = 0)
+	: task(c), nrThreads(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency()))
+	{
+		if (c != 'c' && c != 'r')
+			throw std::invalid_argument("Evaluation is for classification ('c') or regression ('r')\n");
+		if (c == 'r' && !std::is_arithmetic<U>::value)
+			throw std::invalid_argument("Regression needs arithmetic outputs\n");
+	}
+
+
+	// Number of threads, number of examples scored together by a thread, and whether the agreement of each
+	// tree with its set is measured, which evaluates every tree separately
+	void setThreads(const std::size_t& n) {nrThreads = std::max<std::size_t>(1, n);}
+	void setBlockSize(const std::size_t& b) {blockSize = std::max<std::size_t>(1, b);}
+	void setTreeAgreement(bool b) {perTree = b;}
+
+
+	// Score one chunk of examples with the model, adding to the metrics of the chunks scored before
+	template<typename M>
+	void add(const M& model, const std::vector< std::vector<T> >& in, const std::vector<U>& out)
+	{
+		if (in.size() != out.size())
+			throw std::invalid_argument("Number of outputs (" + std::to_string(out.size())
+					+ ") does not match the number of inputs (" + std::to_string(in.size()) + ")\n");
+		if constexpr (!HasTreePredictions<M, T>::value)
+			if (perTree)
+				throw std::invalid_argument("Per-tree agreement needs a set of trees\n");
+
+		const std::size_t B = (in.size() + blockSize - 1) / blockSize;
+		std::vector<Partial> parts(B);
+		std::atomic<std::size_t> next{0};
+		std::exception_ptr failure;
+		std::mutex failureLock;
+		auto work = [&]()
+		{
+			try
+			{
+				for (std::size_t b = next++; b < B; b = next++)
+					scoreBlock(model, in, out, b * blockSize, std::min(in.size(), (b+1) * blockSize), parts[b]);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> guard(failureLock);
+				failure = std::current_exception();
+				next = B;
+			}
+		};
+		std::vector<std::thread> threads;
+		for (std::size_t t = 1; t < std::min(nrThreads, B); ++t)
+			threads.emplace_back(work);
+		work();
+		for (auto& thread : threads)
+			thread.join();
+		if (failure)
+			std::rethrow_exception(failure);
+
+		for (const auto& part : parts)
+		{
+			classification.merge(part.classification);
+			regression.merge(part.regression);
+			trees.merge(part.trees);
+		}
+	}
+
+
+	// Metrics over all examples scored so far
+	const ClassificationMetrics<U>& getClassification() const {return classification;}
+	const RegressionMetrics& getRegression() const {return regression;}
+	const TreeAgreement& getTreeAgreement() const {return trees;}
+
+
+	// Forget all examples scored so far
+	void clear()
+	{
+		classification = ClassificationMetrics<U>();
+		regression = RegressionMetrics();
+		trees = TreeAgreement();
+	}
+
+
+	// Display the metrics of the task, followed by the agreement of each tree if it was measured
+	void display() const
+	{
+		if (task == 'c')
+			classification.display();
+		else
+			regression.display();
+		if (trees.size() > 0)
+		{
+			std::cout << '\n' << std::setw(8) << "Tree" << std::setw(12) << "Agreement" << std::setw(12) << "Error" << '\n';
+			for (std::size_t t = 0; t < trees.size(); ++t)
+				std::cout << std::setw(8) << t << std::setw(12) << trees.agreement(t) << std::setw(12) << trees.error(t) << '\n';
+		}
+	}
+};
+
+
+
+
+// Confusion matrix and metrics of a classifier on a dataset, scored in parallel (one thread per core by default)
+template<typename M, typename T, typename U>
+static inline ClassificationMetrics<U> evaluateClassifier(const M& model, const std::vector< std::vector<T> >& in,
+		const std::vector<U>& out, const std::size_t& threads = 0)
+{
+	Evaluation<T, U> evaluation('c', threads);
+	evaluation.add(model, in, out);
+	return evaluation.getClassification();
+}
+
+
+
+// Error metrics of a regressor on a dataset, scored in parallel (one thread per core by default)
+template<typename M, typename T, typename U>
+static inline RegressionMetrics evaluateRegressor(const M& model, const std::vector< std::vector<T> >& in,
+		const std::vector<U>& out, const std::size_t& threads = 0)
+{
+	Evaluation<T, U> evaluation('r', threads);
+	evaluation.add(model, in, out);
+	return evaluation.getRegression();
+}
+
+
+
+
+#endif     // _EVALUATION_
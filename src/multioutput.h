@@ -0,0 +1,336 @@
+
+#ifndef _MULTIOUTPUT_
+#define _MULTIOUTPUT_
+
+#include "trees.h"
+
+
+// Check that every output of a multi-output tree has the same positive number of targets, and return it
+template<typename V>
+static inline std::size_t countTargets(const std::vector< std::vector<V> >& out)
+{
+	if (out.empty() || out[0].empty())
+		throw std::invalid_argument("Multi-output trees need at least one example and one target\n");
+	for (std::size_t n = 1; n < out.size(); ++n)
+		if (out[n].size() != out[0].size())
+			throw std::invalid_argument("Output " + std::to_string(n) + " has " + std::to_string(out[n].size())
+					+ " targets, but the first output has " + std::to_string(out[0].size()) + "\n");
+	return out[0].size();
+}
+
+
+
+
+// A class which constructs a single regression tree for M numerical targets at once. Each node chooses the
+// split which minimises the sum of squared deviations summed over the targets, and each leaf holds the mean
+// of every target, so that one traversal predicts them all. Inputs are sorted once for all targets. Trees
+// are grown level-wise, unless best-first growth is chosen.
+template<typename T, typename V>
+class MultiOutputRegressionTree : public TreeData<T, std::vector<V> >
+{
+	typedef std::vector<V> U;
+
+
+	// MEMBER OBJECTS
+
+	// Number of targets, and target m of example n at position n*M + m
+	std::size_t M{0};
+	std::vector<double> targets;
+
+
+	// METHODS
+
+	// Copy the targets of every example into one array
+	void findTargets()
+	{
+		M = countTargets(this->outputs);
+		targets.resize(this->N * M);
+		for (std::size_t n = 0; n < this->N; ++n)
+			for (std::size_t m = 0; m < M; ++m)
+				targets[n * M + m] = this->outputs[n][m];
+	}
+
+
+	// Node statistics are the (weighted) number of examples, sum of outputs and square sum of outputs of
+	// each target in turn
+	std::size_t statWidth() const {return 3 * M;}
+	void addStats(double* st, const std::size_t& n, const double& w) const
+	{
+		const double* out = &targets[n * M];
+		for (std::size_t m = 0; m < M; ++m, st += 3)
+		{
+			st[0] += w; st[1] += w * out[m]; st[2] += w * out[m] * out[m];
+		}
+	}
+	double statCount(const double* st) const {return st[0];}
+
+
+	// Sum of squared deviations from the mean output of a node, summed over the targets
+	double nodeImpurity(const double* st) const
+	{
+		double impurity = 0;
+		for (std::size_t m = 0; m < M; ++m)
+			impurity += varianceImpurity(st + 3 * m);
+		return impurity;
+	}
+
+
+	// Mean output of each target over the examples of a node
+	U leafValue(const double* st) const
+	{
+		U value(M);
+		for (std::size_t m = 0; m < M; ++m)
+			value[m] = st[3 * m + 1] / st[3 * m];
+		return value;
+	}
+
+
+	// Categories are ordered by the mean output of the first target
+	double categoryKey(const double* st, const double*) const {return st[1] / st[0];}
+
+
+	// Pruning measures the sum of squared errors over every target
+	double leafRisk(const double* st) const {return nodeImpurity(st);}
+	double loss(const U& pred, const U& actual) const
+	{
+		double error = 0;
+		for (std::size_t m = 0; m < M; ++m)
+			error += pow(pred[m] - actual[m], 2);
+		return error;
+	}
+
+
+	// Targets kept for each training example, besides the outputs themselves
+	std::size_t targetBytes() const
+	{
+		std::size_t bytes = targets.capacity() * sizeof(double);
+		for (const auto& out : this->outputs)
+			bytes += out.capacity() * sizeof(V);
+		return bytes;
+	}
+	void releaseTargets() {std::vector<double>().swap(targets);}
+
+
+public:
+
+	// Constructor, with the M targets of each example in one output vector
+	MultiOutputRegressionTree(std::vector< std::vector<T> > in, std::vector<U> out)
+	: TreeData<T, U>(std::move(in), std::move(out))
+	{
+		findTargets();
+		this->setMinLeafSize(10);
+		this->setGrowth('l');
+	}
+
+
+	// Constructor for sparse inputs
+	MultiOutputRegressionTree(const SparseMatrix<T>& in, std::vector<U> out)
+	: TreeData<T, U>(in, std::move(out))
+	{
+		findTargets();
+		this->setMinLeafSize(10);
+		this->setGrowth('l');
+	}
+
+
+	// Default constructor
+	MultiOutputRegressionTree() = default;
+
+
+	// Number of targets
+	std::size_t targetCount() const {return M;}
+
+
+	// Build the tree level by level, or best-first
+	void buildTree()
+	{
+		this->checkMemoryBudget();
+		this->layout.clear();
+		this->clearPruningPath();
+		PROFILE_CLEAR();
+		this->root = this->growthOrder() == 'b' ? this->bestFirst() : this->levelWise();
+	}
+
+};
+
+
+
+
+// A class which constructs a single classification tree for M categorical targets at once, e.g. one label
+// per target in multi-label classification. Each node chooses the split which minimises the entropy or Gini
+// impurity summed over the targets, and each leaf holds the most common class of every target, so that one
+// traversal predicts them all. Inputs are sorted once for all targets. Trees are grown level-wise, unless
+// best-first growth is chosen.
+template<typename T, typename V>
+class MultiOutputClassificationTree : public TreeData<T, std::vector<V> >
+{
+	typedef std::vector<V> U;
+
+
+	// MEMBER OBJECTS
+
+	// Number of targets, classes of each target in increasing order, and the position of the counts of
+	// each target in the node statistics
+	std::size_t M{0};
+	std::vector< std::vector<V> > classes;
+	std::vector<std::size_t> offsets;
+
+	// Position in the node statistics of the class of target m of example n, at position n*M + m
+	std::vector<std::size_t> labels;
+
+	// Indicates whether impurity should be measured with entropy ('e') or Gini ('g')
+	char impurity{'e'};
+
+
+	// METHODS
+
+	// Find the classes of each target, and the position of the class of every target of every example
+	void findClasses()
+	{
+		M = countTargets(this->outputs);
+		classes.assign(M, std::vector<V>());
+		offsets.assign(M + 1, 0);
+		for (std::size_t m = 0; m < M; ++m)
+		{
+			for (std::size_t n = 0; n < this->N; ++n)
+				classes[m].push_back(this->outputs[n][m]);
+			std::sort(classes[m].begin(), classes[m].end());
+			classes[m].erase(std::unique(classes[m].begin(), classes[m].end()), classes[m].end());
+			offsets[m + 1] = offsets[m] + classes[m].size();
+		}
+		labels.resize(this->N * M);
+		for (std::size_t n = 0; n < this->N; ++n)
+			for (std::size_t m = 0; m < M; ++m)
+				labels[n * M + m] = offsets[m] + (std::lower_bound(classes[m].begin(), classes[m].end(), this->outputs[n][m])
+								- classes[m].begin());
+	}
+
+
+	// Node statistics are the (weighted) number of examples of each class of each target in turn
+	std::size_t statWidth() const {return offsets[M];}
+	void addStats(double* st, const std::size_t& n, const double& w) const
+	{
+		const std::size_t* label = &labels[n * M];
+		for (std::size_t m = 0; m < M; ++m)
+			st[label[m]] += w;
+	}
+	double statCount(const double* st) const
+	{
+		double count = 0;
+		for (std::size_t k = 0; k < offsets[1]; ++k)
+			count += st[k];
+		return count;
+	}
+
+
+	// Entropy or Gini impurity of a node multiplied by its number of examples, summed over the targets
+	double nodeImpurity(const double* st) const
+	{
+		double H = 0;
+		for (std::size_t m = 0; m < M; ++m)
+			H += classImpurity(st + offsets[m], classes[m].size(), impurity);
+		return H;
+	}
+
+
+	// Position of the most common class of target m among the examples of a node
+	std::size_t majority(const double* st, const std::size_t& m) const
+	{
+		return std::max_element(st + offsets[m], st + offsets[m + 1]) - (st + offsets[m]);
+	}
+	U leafValue(const double* st) const
+	{
+		U value(M);
+		for (std::size_t m = 0; m < M; ++m)
+			value[m] = classes[m][majority(st, m)];
+		return value;
+	}
+
+
+	// Categories are ordered by the fraction of their examples in the most common class of the first target
+	double categoryKey(const double* st, const double* tot) const {return st[majority(tot, 0)] / statCount(st);}
+
+
+	// Pruning measures the number of misclassified targets
+	double leafRisk(const double* st) const
+	{
+		double risk = 0, count = statCount(st);
+		for (std::size_t m = 0; m < M; ++m)
+			risk += count - st[offsets[m] + majority(st, m)];
+		return risk;
+	}
+	double loss(const U& pred, const U& actual) const
+	{
+		double error = 0;
+		for (std::size_t m = 0; m < M; ++m)
+			error += pred[m] != actual[m];
+		return error;
+	}
+
+
+	// Class labels kept for each target of each training example, besides the outputs themselves
+	std::size_t targetBytes() const
+	{
+		std::size_t bytes = labels.capacity() * sizeof(std::size_t);
+		for (const auto& out : this->outputs)
+			bytes += out.capacity() * sizeof(V);
+		return bytes;
+	}
+	void releaseTargets() {std::vector<std::size_t>().swap(labels);}
+
+
+public:
+
+	// Constructor, with the M targets of each example in one output vector
+	MultiOutputClassificationTree(std::vector< std::vector<T> > in, std::vector<U> out)
+	: TreeData<T, U>(std::move(in), std::move(out))
+	{
+		findClasses();
+		this->setGrowth('l');
+	}
+
+
+	// Constructor for sparse inputs
+	MultiOutputClassificationTree(const SparseMatrix<T>& in, std::vector<U> out)
+	: TreeData<T, U>(in, std::move(out))
+	{
+		findClasses();
+		this->setGrowth('l');
+	}
+
+
+	// Default constructor
+	MultiOutputClassificationTree() = default;
+
+
+	// Access impurity measure
+	void setImpurity(char c)
+	{
+		if (c != 'e' && c != 'g')
+			throw std::invalid_argument("Impurity must be either 'e' (entropy) or 'g' (Gini)\n");
+		impurity = c;
+	}
+	char getImpurity() const {return impurity;}
+
+
+	// Number of targets, and the classes of target m in increasing order
+	std::size_t targetCount() const {return M;}
+	const std::vector<V>& getClasses(const std::size_t& m) const {return classes.at(m);}
+
+
+	// Build the tree level by level, or best-first
+	void buildTree()
+	{
+		this->checkMemoryBudget();
+		this->layout.clear();
+		this->clearPruningPath();
+		PROFILE_CLEAR();
+		this->root = this->growthOrder() == 'b' ? this->bestFirst() : this->levelWise();
+	}
+
+};
+
+
+
+
+#endif     // _MULTIOUTPUT_
@@ -0,0 +1,986 @@
+
+#ifndef _PREDICTOR_
+#define _PREDICTOR_
+
+#include <vector>
+#include <map>
+#include <limits>
+#include <algorithm>
+#include <numeric>
+#include <type_traits>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <stdexcept>
+#include <fstream>
+#include "sparse.h"
+#include "profiling.h"
+
+
+
+template<typename T, typename U>
+class ForestPredictor;
+
+
+
+// Smallest value of the input type T not below the split threshold s, so that any input x of type T has
+// x < s exactly when it is below that value. Compact encodings store thresholds this way.
+template<typename T>
+static inline T typedThreshold(const double& s)
+{
+	if constexpr (std::is_integral<T>::value)
+	{
+		double c = std::ceil(s);
+		if (c <= (double)std::numeric_limits<T>::lowest())
+			return std::numeric_limits<T>::lowest();
+		if (c >= (double)std::numeric_limits<T>::max())
+			return std::numeric_limits<T>::max();
+		return (T)c;
+	}
+	else
+	{
+		T f = (T)s;
+		if ((double)f < s)
+			f = std::nextafter(f, std::numeric_limits<T>::infinity());
+		return f;
+	}
+}
+
+
+
+// Header of a model file written by save(): the kind of model ('t' for a TreePredictor, 'f' for a
+// ForestPredictor), and the kind and size in bytes of the input and output types. Kinds of types are 'f'
+// for floating point, 'i' for signed and 'u' for unsigned integers, and 's' for strings.
+class ModelHeader
+{
+public:
+	char model, input, output;
+	std::uint8_t inputSize, outputSize;
+};
+
+static const char modelMagic[4] = {'D', 'T', 'P', 'M'};
+static const std::uint32_t modelVersion = 2;
+
+
+
+// Kind of a type stored in a model file, as in the model header
+template<typename V>
+static inline char typeKind()
+{
+	if constexpr (std::is_same<V, std::string>::value)
+		return 's';
+	else if constexpr (std::is_floating_point<V>::value)
+		return 'f';
+	else if constexpr (std::is_integral<V>::value)
+		return std::is_signed<V>::value ? 'i' : 'u';
+	else
+	{
+		static_assert(std::is_arithmetic<V>::value, "Models can only be saved with arithmetic or string inputs and outputs");
+		return 0;
+	}
+}
+
+
+
+// Write a value to a model file: strings and vectors as their length followed by their elements, and
+// anything else as its bytes. Files are written in the byte order of the machine.
+template<typename V>
+static inline void writeModelData(std::ostream& out, const V& v)
+{
+	if constexpr (std::is_same<V, std::string>::value)
+	{
+		writeModelData(out, (std::uint64_t) v.size());
+		out.write(v.data(), v.size());
+	}
+	else
+	{
+		static_assert(std::is_trivially_copyable<V>::value, "Model data must be trivially copyable");
+		out.write(reinterpret_cast<const char*>(&v), sizeof(V));
+	}
+}
+template<typename V>
+static inline void writeModelData(std::ostream& out, const std::vector<V>& v)
+{
+	writeModelData(out, (std::uint64_t) v.size());
+	if constexpr (std::is_arithmetic<V>::value || (std::is_class<V>::value && std::is_trivially_copyable<V>::value))
+		out.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(V));
+	else
+		for (const auto& x : v)
+			writeModelData(out, x);
+}
+
+
+
+// Number of bytes left to read in a model file, or the largest number if the stream cannot tell
+static inline std::uint64_t remainingBytes(std::istream& in)
+{
+	std::istream::pos_type position = in.tellg();
+	if (position == std::istream::pos_type(-1))
+		return std::numeric_limits<std::uint64_t>::max();
+	in.seekg(0, std::ios::end);
+	std::istream::pos_type end = in.tellg();
+	in.seekg(position);
+	return end < position ? 0 : (std::uint64_t) (end - position);
+}
+
+
+
+// Read a value written by writeModelData(), throwing if the file ends early. A length longer than the rest
+// of the file is rejected before anything is allocated.
+template<typename V>
+static inline void readModelData(std::istream& in, V& v)
+{
+	if constexpr (std::is_same<V, std::string>::value)
+	{
+		std::uint64_t size;
+		readModelData(in, size);
+		if (size > remainingBytes(in))
+			throw std::invalid_argument("Model file is truncated or corrupt\n");
+		v.resize(size);
+		in.read(&v[0], size);
+	}
+	else
+		in.read(reinterpret_cast<char*>(&v), sizeof(V));
+	if (!in)
+		throw std::invalid_argument("Model file is truncated or corrupt\n");
+}
+template<typename V>
+static inline void readModelData(std::istream& in, std::vector<V>& v)
+{
+	std::uint64_t size;
+	readModelData(in, size);
+	constexpr std::size_t minBytes = std::is_arithmetic<V>::value || (std::is_class<V>::value && std::is_trivially_copyable<V>::value)
+					? sizeof(V) : sizeof(std::uint64_t);
+	if (size > remainingBytes(in) / minBytes)
+		throw std::invalid_argument("Model file is truncated or corrupt\n");
+	v.resize(size);
+	if constexpr (std::is_arithmetic<V>::value || (std::is_class<V>::value && std::is_trivially_copyable<V>::value))
+	{
+		in.read(reinterpret_cast<char*>(v.data()), size * sizeof(V));
+		if (!in)
+			throw std::invalid_argument("Model file is truncated or corrupt\n");
+	}
+	else
+		for (auto& x : v)
+			readModelData(in, x);
+}
+
+
+
+// Write the header of a model file for a model of the given kind with inputs of type T and outputs of type U
+template<typename T, typename U>
+static inline void writeModelHeader(std::ostream& out, const char& model)
+{
+	out.write(modelMagic, 4);
+	writeModelData(out, modelVersion);
+	ModelHeader header{model, typeKind<T>(), typeKind<U>(), (std::uint8_t) sizeof(T), (std::uint8_t) sizeof(U)};
+	writeModelData(out, header);
+}
+
+
+
+// Read the header of a model file, checking that it is a model file of a version that can be read
+static inline ModelHeader readModelHeader(std::istream& in)
+{
+	char magic[4];
+	in.read(magic, 4);
+	if (!in || !std::equal(magic, magic + 4, modelMagic))
+		throw std::invalid_argument("File is not a model file\n");
+	std::uint32_t version;
+	readModelData(in, version);
+	if (version != modelVersion)
+		throw std::invalid_argument("Model file has version " + std::to_string(version) + ", but only version "
+				+ std::to_string(modelVersion) + " can be read\n");
+	ModelHeader header;
+	readModelData(in, header);
+	return header;
+}
+static inline ModelHeader readModelHeader(const std::string& filename)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+		throw std::invalid_argument("Model file could not be opened\n");
+	return readModelHeader(file);
+}
+
+
+
+// Read the header of a model file and check that it holds a model of the given kind with inputs of type T
+// and outputs of type U
+template<typename T, typename U>
+static inline void checkModelHeader(std::istream& in, const char& model)
+{
+	ModelHeader header = readModelHeader(in);
+	if (header.model != model)
+		throw std::invalid_argument(std::string("Model file holds a ") + (header.model == 't' ? "single tree" : "set of trees")
+				+ ", not a " + (model == 't' ? "single tree" : "set of trees") + "\n");
+	if (header.input != typeKind<T>() || header.inputSize != sizeof(T) || header.output != typeKind<U>()
+			|| (header.outputSize != sizeof(U) && header.output != 's'))
+		throw std::invalid_argument("Model file was saved with different input or output types\n");
+}
+
+
+
+// Immutable tree used only for prediction, compiled from a built tree by toPredictor() or freeze(). It holds
+// the nodes in one array, the category sets of categorical splits and a table of leaf values, but none of
+// the training data, so it can be copied and shared freely between threads.
+template<typename T, typename U>
+class TreePredictor
+{
+public:
+
+	// NESTED CLASS
+
+	// Node of the array, laid out in preorder so that the left child of an internal node directly follows
+	// it. For an internal node, 'next' is the position of the right child, and 'cats' the position of its
+	// category set if the split is on a categorical feature. For a leaf, 'd' is 'none' and 'next' is the
+	// position of its value in the value table.
+	class Node
+	{
+	public:
+		double split;
+		std::size_t d, next, cats;
+	};
+
+	static const std::size_t none = std::numeric_limits<std::size_t>::max();
+	
+	
+	// Nodes of the compact encodings, in the same order: the threshold is stored in the input type ('t'),
+	// or as the position of the threshold in the sorted thresholds of its feature ('b'). The feature id
+	// has 16 bits, and is 'leafId' for a leaf, and 'next' has 32 bits.
+	class TypedNode
+	{
+	public:
+		T split;
+		std::uint16_t d;
+		std::uint32_t next;
+	};
+	class BinNode
+	{
+	public:
+		std::uint16_t bin, d;
+		std::uint32_t next;
+	};
+	
+	static const std::uint16_t leafId = std::numeric_limits<std::uint16_t>::max();
+	
+	
+	// Input converted to the bin of each feature, for the binned encoding. The bin of a value is the number
+	// of thresholds of the feature not above it, so that the value is below the k-th threshold exactly when
+	// its bin is at most k.
+	class BinnedInput
+	{
+	public:
+		std::vector<std::uint16_t> bins;
+	};
+
+
+private:
+
+	// MEMBER OBJECTS
+
+	// Array of nodes, sorted categories sent to the left branch by each categorical split, and leaf values
+	// (empty for a tree belonging to a ForestPredictor, which holds the values of all its trees)
+	std::vector<Node> nodes;
+	std::vector< std::vector<T> > categories;
+	std::vector<U> values;
+	
+	// Encoding of the nodes: full ('f', default), thresholds in the input type ('t') or binned ('b'), the
+	// nodes in each compact encoding, and the sorted thresholds of each feature used for binning. The
+	// trees of a binned ForestPredictor, which bins inputs for all its trees, keep no thresholds and are
+	// marked as binned by the forest.
+	char encoding{'f'};
+	std::vector<TypedNode> typed;
+	std::vector<BinNode> binned;
+	std::vector< std::vector<T> > cuts;
+	bool forestBinned{false};
+
+
+	// METHODS
+
+	// Value of feature d of a dense or sparse input
+	static T featureValue(const std::vector<T>& in, const std::size_t& d) {return in[d];}
+	static T featureValue(const std::vector< std::pair<std::size_t, T> >& in, const std::size_t& d) {return sparseValue(in, d);}
+
+
+	// Renumber the leaf values after the value table has been reordered
+	void relabel(const std::vector<std::size_t>& position)
+	{
+		for (auto& node : nodes)
+			if (node.d == none)
+				node.next = position[node.next];
+	}
+
+
+	// Add the threshold of every split, as stored by the compact encodings, to the thresholds of its feature
+	void addThresholds(std::vector< std::vector<T> >& featureCuts) const
+	{
+		for (const auto& node : nodes)
+			if (node.d != none && node.cats == none)
+			{
+				if (featureCuts.size() <= node.d)
+					featureCuts.resize(node.d + 1);
+				featureCuts[node.d].push_back(typedThreshold<T>(node.split));
+			}
+	}
+
+
+	// Sort the thresholds of each feature, removing duplicates, and check that bins fit in 16 bits
+	static void sortThresholds(std::vector< std::vector<T> >& featureCuts)
+	{
+		for (auto& c : featureCuts)
+		{
+			std::sort(c.begin(), c.end());
+			c.erase(std::unique(c.begin(), c.end()), c.end());
+			if (c.size() >= leafId)
+				throw std::invalid_argument("Binned encoding supports at most 65534 thresholds per feature\n");
+		}
+	}
+
+
+	// Encode the nodes compactly in the given encoding, binning with the sorted thresholds 'featureCuts'
+	void encode(const char& e, const std::vector< std::vector<T> >& featureCuts)
+	{
+		if (!categories.empty())
+			throw std::invalid_argument("Compact encodings do not support categorical splits\n");
+		if (nodes.size() > std::numeric_limits<std::uint32_t>::max())
+			throw std::invalid_argument("Compact encodings support at most 2^32 nodes per tree\n");
+		typed.clear(); binned.clear();
+		if (e == 't')
+			typed.reserve(nodes.size());
+		else
+			binned.reserve(nodes.size());
+		for (const auto& node : nodes)
+		{
+			if (node.d != none && node.d >= leafId)
+				throw std::invalid_argument("Compact encodings support at most 65535 features\n");
+			std::uint16_t d = node.d == none ? leafId : node.d;
+			if (e == 't')
+				typed.push_back(TypedNode{node.d == none ? T() : typedThreshold<T>(node.split), d, (std::uint32_t) node.next});
+			else
+			{
+				std::uint16_t bin = 0;
+				if (node.d != none)
+				{
+					const auto& c = featureCuts[node.d];
+					bin = std::lower_bound(c.begin(), c.end(), typedThreshold<T>(node.split)) - c.begin();
+				}
+				binned.push_back(BinNode{bin, d, (std::uint32_t) node.next});
+			}
+		}
+		encoding = e;
+	}
+
+
+	// Drop the full nodes once the tree is encoded compactly
+	void dropFullNodes() {std::vector<Node>().swap(nodes);}
+
+
+	// Write and read the contents of the tree, without a header. The number of features read by the tree
+	// is written first, so that every split can be checked against it when the tree is read.
+	void writeContents(std::ostream& out) const
+	{
+		writeModelData(out, (std::uint64_t) featureCount());
+		writeModelData(out, encoding);
+		writeModelData(out, nodes);
+		writeModelData(out, typed);
+		writeModelData(out, binned);
+		writeModelData(out, categories);
+		writeModelData(out, values);
+		writeModelData(out, cuts);
+	}
+	void readContents(std::istream& in, std::uint64_t& D)
+	{
+		readModelData(in, D);
+		readModelData(in, encoding);
+		readModelData(in, nodes);
+		readModelData(in, typed);
+		readModelData(in, binned);
+		readModelData(in, categories);
+		readModelData(in, values);
+		readModelData(in, cuts);
+		if ((encoding != 'f' && encoding != 't' && encoding != 'b') || nodeCount() == 0)
+			throw std::invalid_argument("Model file is truncated or corrupt\n");
+	}
+
+
+	// Check that every node read from a model file stays within the arrays it refers to, given the number of
+	// features D, the number of leaf values and the thresholds used for binning: the right child of an
+	// internal node follows its left child and lies within the tree, a leaf indexes the value table, a
+	// categorical split indexes the category sets, and a binned split indexes the thresholds of its feature.
+	// Traversal then always moves forward and ends at a leaf.
+	void checkContents(const std::uint64_t& D, const std::size_t& nrValues, const std::vector< std::vector<T> >& featureCuts) const
+	{
+		const std::size_t M = nodeCount();
+		auto check = [&](const std::size_t& i, const bool& leaf, const std::size_t& d, const std::size_t& next)
+		{
+			bool valid = leaf ? next < nrValues : d < D && next > i + 1 && next < M;
+			if (!valid)
+				throw std::invalid_argument("Model file is truncated or corrupt\n");
+		};
+		for (std::size_t i = 0; i < nodes.size(); ++i)
+		{
+			check(i, nodes[i].d == none, nodes[i].d, nodes[i].next);
+			if (nodes[i].d != none && nodes[i].cats != none && nodes[i].cats >= categories.size())
+				throw std::invalid_argument("Model file is truncated or corrupt\n");
+		}
+		for (std::size_t i = 0; i < typed.size(); ++i)
+			check(i, typed[i].d == leafId, typed[i].d, typed[i].next);
+		for (std::size_t i = 0; i < binned.size(); ++i)
+		{
+			check(i, binned[i].d == leafId, binned[i].d, binned[i].next);
+			if (binned[i].d != leafId && (binned[i].d >= featureCuts.size() || binned[i].bin >= featureCuts[binned[i].d].size()))
+				throw std::invalid_argument("Model file is truncated or corrupt\n");
+		}
+	}
+
+
+	// Check that the encoding is known and that the input type allows compact encodings
+	static void checkEncoding(const char& e)
+	{
+		if (e != 't' && e != 'b')
+			throw std::invalid_argument("Compact encoding must be 't' (thresholds in the input type) or 'b' (binned)\n");
+		if constexpr (!std::is_arithmetic<T>::value)
+			throw std::invalid_argument("Compact encodings need arithmetic inputs\n");
+	}
+
+	friend class ForestPredictor<T, U>;
+
+
+public:
+
+	// Constructor from the node array, category sets and leaf values
+	TreePredictor(std::vector<Node> n, std::vector< std::vector<T> > c, std::vector<U> v)
+	: nodes(n), categories(c), values(v) {}
+
+
+	// Default constructor
+	TreePredictor() = default;
+
+
+	// Position in the value table of the leaf reached by a dense or sparse input
+	template<typename X>
+	std::size_t leaf(const X& in) const
+	{
+		if (encoding == 't')
+		{
+			std::uint32_t i = 0;
+			while (typed[i].d != leafId)
+				i = featureValue(in, typed[i].d) < typed[i].split ? i+1 : typed[i].next;
+			return typed[i].next;
+		}
+		if (encoding == 'b')
+		{
+			if (forestBinned)
+				throw std::invalid_argument("Trees of a binned forest predict through the forest\n");
+			return leaf(binInput(in, cuts));
+		}
+		std::size_t i = 0;
+		while (nodes[i].d != none)
+		{
+			const Node& node = nodes[i];
+			T x = featureValue(in, node.d);
+			bool left = node.cats == none ? x < node.split
+							: std::binary_search(categories[node.cats].begin(), categories[node.cats].end(), x);
+			i = left ? i+1 : node.next;
+		}
+		return nodes[i].next;
+	}
+
+
+	// Position in the value table of the leaf reached by an input converted to bins, in the binned encoding.
+	// Every comparison is between 16-bit integers.
+	std::size_t leaf(const BinnedInput& in) const
+	{
+		std::uint32_t i = 0;
+		while (binned[i].d != leafId)
+			i = in.bins[binned[i].d] <= binned[i].bin ? i+1 : binned[i].next;
+		return binned[i].next;
+	}
+
+
+	// Convert a dense or sparse input into bins, given the sorted thresholds of each feature
+	template<typename X>
+	static BinnedInput binInput(const X& in, const std::vector< std::vector<T> >& featureCuts)
+	{
+		BinnedInput b;
+		b.bins.resize(featureCuts.size(), 0);
+		for (std::size_t d = 0; d < featureCuts.size(); ++d)
+			if (!featureCuts[d].empty())
+				b.bins[d] = std::upper_bound(featureCuts[d].begin(), featureCuts[d].end(), featureValue(in, d)) - featureCuts[d].begin();
+		return b;
+	}
+
+
+	// Encode the tree compactly and drop its full nodes. With 't', each threshold is stored in the input
+	// type, rounded up to the next value of that type so that comparisons are unchanged. With 'b', each
+	// threshold is stored as a 16-bit position in the sorted thresholds of its feature, and inputs are
+	// converted to bins before traversal. Both use 16-bit feature ids and 32-bit node and leaf ids, and
+	// give the same predictions as the full encoding. If a sample of inputs is given, this is verified
+	// on the sample first, leaving the tree unchanged and throwing if any prediction differs.
+	void compact(const char& e, const std::vector< std::vector<T> >& sample = {})
+	{
+		checkEncoding(e);
+		if (encoding != 'f')
+			throw std::invalid_argument("Tree is already encoded compactly\n");
+		TreePredictor encoded(*this);
+		std::vector< std::vector<T> > featureCuts;
+		if (e == 'b')
+		{
+			addThresholds(featureCuts);
+			sortThresholds(featureCuts);
+			encoded.cuts = featureCuts;
+		}
+		encoded.encode(e, featureCuts);
+		std::size_t differ = 0;
+		for (const auto& x : sample)
+			differ += encoded.leaf(x) != leaf(x);
+		if (differ > 0)
+			throw std::invalid_argument("Compact encoding changes " + std::to_string(differ) + " of "
+					+ std::to_string(sample.size()) + " predictions\n");
+		encoded.dropFullNodes();
+		*this = std::move(encoded);
+	}
+	char getEncoding() const {return encoding;}
+
+
+	// Predict the output of a dense input, or of a sparse input given as (feature, value) pairs sorted by feature
+	U predict(const std::vector<T>& in) const {return values[leaf(in)];}
+	U predict(const std::vector< std::pair<std::size_t, T> >& in) const {return values[leaf(in)];}
+
+
+	// Predict the outputs of a batch of dense inputs, or of inputs first to last of a batch, which are
+	// read in place
+	std::vector<U> predictBatch(const std::vector< std::vector<T> >& in) const {return predictBatch(in, 0, in.size());}
+	std::vector<U> predictBatch(const std::vector< std::vector<T> >& in, const std::size_t& first, const std::size_t& last) const
+	{
+		std::vector<U> out(last - first);
+		for (std::size_t n = first; n < last; ++n)
+			out[n - first] = values[leaf(in[n])];
+		return out;
+	}
+
+
+	// Number of features read by the tree, which is one more than the largest feature id of any split
+	std::size_t featureCount() const
+	{
+		std::size_t D = 0;
+		for (const auto& node : nodes)
+			if (node.d != none)
+				D = std::max(D, node.d + 1);
+		for (const auto& node : typed)
+			if (node.d != leafId)
+				D = std::max<std::size_t>(D, node.d + 1);
+		for (const auto& node : binned)
+			if (node.d != leafId)
+				D = std::max<std::size_t>(D, node.d + 1);
+		return D;
+	}
+
+
+	// Save the tree to a binary file, and load a tree saved in this way. Input and output types must be
+	// arithmetic or strings, and the file can only be read with the same types on a machine with the same
+	// byte order.
+	void save(const std::string& filename) const
+	{
+		std::ofstream file(filename, std::ios::binary);
+		if (!file)
+			throw std::invalid_argument("Model file could not be opened\n");
+		writeModelHeader<T, U>(file, 't');
+		writeContents(file);
+		if (!file)
+			throw std::invalid_argument("Model file could not be written\n");
+	}
+	static TreePredictor load(const std::string& filename)
+	{
+		std::ifstream file(filename, std::ios::binary);
+		if (!file)
+			throw std::invalid_argument("Model file could not be opened\n");
+		checkModelHeader<T, U>(file, 't');
+		TreePredictor tree;
+		std::uint64_t D;
+		tree.readContents(file, D);
+		tree.checkContents(D, tree.values.size(), tree.cuts);
+		return tree;
+	}
+
+
+	// Number of nodes and of leaves
+	std::size_t nodeCount() const {return encoding == 't' ? typed.size() : (encoding == 'b' ? binned.size() : nodes.size());}
+	std::size_t leafCount() const {return (nodeCount() + 1) / 2;}
+
+
+	// Memory held by the predictor. Internal nodes, category sets and thresholds for binning count as
+	// nodes, and leaves and the value table as leaves.
+	MemoryUsage memoryUsage() const
+	{
+		MemoryUsage usage;
+		std::size_t nodeSize = encoding == 't' ? sizeof(TypedNode) : (encoding == 'b' ? sizeof(BinNode) : sizeof(Node));
+		std::size_t capacity = nodes.capacity() * sizeof(Node) + typed.capacity() * sizeof(TypedNode) + binned.capacity() * sizeof(BinNode);
+		usage.leaves = leafCount() * nodeSize + values.capacity() * sizeof(U);
+		usage.nodes = capacity - leafCount() * nodeSize + (categories.capacity() + cuts.capacity()) * sizeof(std::vector<T>);
+		for (const auto& c : categories)
+			usage.nodes += c.capacity() * sizeof(T);
+		for (const auto& c : cuts)
+			usage.nodes += c.capacity() * sizeof(T);
+		return usage;
+	}
+};
+
+
+
+// Immutable set of trees used only for prediction, compiled from bagged trees by toPredictor() or freeze().
+// Classification sets take a majority vote, with ties going to the smallest class and with the same early
+// exit settings and tree order as the set compiled, and regression sets take the mean. All trees share one
+// sorted table of leaf values, so votes are counted by position in that table.
+template<typename T, typename U>
+class ForestPredictor
+{
+	// MEMBER OBJECTS
+
+	// Trees, and the leaf values of all trees in increasing order
+	std::vector< TreePredictor<T, U> > trees;
+	std::vector<U> values;
+
+	// Indicate whether the trees vote (classification) or are averaged (regression)
+	bool vote{true};
+
+	// Early exit settings and order in which trees vote, as for bagged classification trees
+	bool earlyExit{false};
+	double confidence{0};
+	std::size_t minVotes{1};
+	std::vector<std::size_t> order;
+	
+	// Encoding of the trees, and the sorted thresholds of each feature over all trees if they are binned,
+	// so that each input is converted to bins once for all trees
+	char encoding{'f'};
+	std::vector< std::vector<T> > cuts;
+
+
+	// METHODS
+
+	// Majority vote of the trees, counting the trees evaluated
+	template<typename X>
+	U majority(const X& in, std::size_t& evaluated) const
+	{
+		std::vector<std::size_t> count(values.size(), 0);
+		std::size_t nr = trees.size();
+		for (evaluated = 0; evaluated < nr; )
+		{
+			++count[trees[order.empty() ? evaluated : order[evaluated]].leaf(in)];
+			++evaluated;
+			if (!earlyExit && confidence == 0)
+				continue;
+
+			std::size_t lead = 0, second = 0;
+			for (const std::size_t& c : count)
+				if (c > lead)
+				{
+					second = lead;
+					lead = c;
+				}
+				else if (c > second)
+					second = c;
+			if (earlyExit && lead > second + (nr - evaluated))
+				break;
+			if (confidence > 0 && evaluated >= minVotes && lead >= confidence * evaluated)
+				break;
+		}
+
+		std::size_t max = 0;
+		for (std::size_t k = 1; k < count.size(); ++k)
+			if (count[k] > count[max])
+				max = k;
+		return count.empty() || count[max] == 0 ? U() : values[max];
+	}
+
+
+	// Mean prediction of the trees
+	template<typename X>
+	U mean(const X& in) const
+	{
+		if constexpr (std::is_arithmetic<U>::value)
+		{
+			U sum = 0;
+			for (const auto& tree : trees)
+				sum += values[tree.leaf(in)];
+			return sum / trees.size();
+		}
+		else
+			return U();
+	}
+
+
+	// Predict by vote or by mean, converting the input to bins first if the trees are binned
+	template<typename X>
+	U aggregate(const X& in, std::size_t& evaluated) const
+	{
+		if (encoding == 'b')
+			return combine(TreePredictor<T, U>::binInput(in, cuts), evaluated);
+		return combine(in, evaluated);
+	}
+	template<typename X>
+	U combine(const X& in, std::size_t& evaluated) const
+	{
+		if (vote)
+			return majority(in, evaluated);
+		evaluated = trees.size();
+		return mean(in);
+	}
+
+
+	// Predict the N inputs starting at 'in' by vote or by mean, tree by tree
+	template<typename X>
+	std::vector<U> combineBatch(const X* in, const std::size_t& N) const
+	{
+		std::size_t K = values.size(), evaluated;
+		std::vector<U> out(N);
+		if (vote && (earlyExit || confidence > 0))
+		{
+			for (std::size_t n = 0; n < N; ++n)
+				out[n] = majority(in[n], evaluated);
+		}
+		else if (vote)
+		{
+			std::vector<std::size_t> count(N * K, 0);
+			for (const auto& tree : trees)
+				for (std::size_t n = 0; n < N; ++n)
+					++count[n * K + tree.leaf(in[n])];
+			for (std::size_t n = 0; n < N; ++n)
+			{
+				std::size_t max = 0;
+				for (std::size_t k = 1; k < K; ++k)
+					if (count[n * K + k] > count[n * K + max])
+						max = k;
+				out[n] = K == 0 || count[n * K + max] == 0 ? U() : values[max];
+			}
+		}
+		else if constexpr (std::is_arithmetic<U>::value)
+		{
+			std::vector<U> sum(N, 0);
+			for (const auto& tree : trees)
+				for (std::size_t n = 0; n < N; ++n)
+					sum[n] += values[tree.leaf(in[n])];
+			for (std::size_t n = 0; n < N; ++n)
+				out[n] = sum[n] / trees.size();
+		}
+		return out;
+	}
+
+
+public:
+
+	// Constructor from trees whose leaves index the value table 'v', which is sorted here
+	ForestPredictor(std::vector< TreePredictor<T, U> > t, std::vector<U> v, bool vt, bool exit = false,
+			const double& c = 0, const std::size_t& m = 1, std::vector<std::size_t> o = {})
+	: trees(t), values(v), vote(vt), earlyExit(exit), confidence(c), minVotes(m), order(o)
+	{
+		std::vector<std::size_t> idx(values.size()), position(values.size());
+		std::iota(idx.begin(), idx.end(), 0);
+		std::sort(idx.begin(), idx.end(), [this](std::size_t i1, std::size_t i2) {return values[i1] < values[i2];});
+		for (std::size_t k = 0; k < idx.size(); ++k)
+			position[idx[k]] = k;
+		std::sort(values.begin(), values.end());
+		for (auto& tree : trees)
+			tree.relabel(position);
+	}
+
+
+	// Default constructor
+	ForestPredictor() = default;
+
+
+	// Predict the output of a dense input, or of a sparse input given as (feature, value) pairs sorted by
+	// feature. The second form of each also gives the number of trees evaluated.
+	U predict(const std::vector<T>& in) const
+	{
+		std::size_t evaluated;
+		return aggregate(in, evaluated);
+	}
+	U predict(const std::vector<T>& in, std::size_t& evaluated) const {return aggregate(in, evaluated);}
+	U predict(const std::vector< std::pair<std::size_t, T> >& in) const
+	{
+		std::size_t evaluated;
+		return aggregate(in, evaluated);
+	}
+	U predict(const std::vector< std::pair<std::size_t, T> >& in, std::size_t& evaluated) const {return aggregate(in, evaluated);}
+
+
+	// Predict the outputs of a batch of dense inputs, with the same results as predicting each input. Each
+	// tree is evaluated for all inputs in turn, so that its nodes stay in cache, and binned trees convert
+	// each input once. Votes with early exit are taken one input at a time, as the trees evaluated differ.
+	// Inputs first to last of a batch can be predicted in place.
+	std::vector<U> predictBatch(const std::vector< std::vector<T> >& in) const {return predictBatch(in, 0, in.size());}
+	std::vector<U> predictBatch(const std::vector< std::vector<T> >& in, const std::size_t& first, const std::size_t& last) const
+	{
+		if (encoding != 'b')
+			return combineBatch(in.data() + first, last - first);
+		std::vector<typename TreePredictor<T, U>::BinnedInput> binnedIn;
+		binnedIn.reserve(last - first);
+		for (std::size_t n = first; n < last; ++n)
+			binnedIn.push_back(TreePredictor<T, U>::binInput(in[n], cuts));
+		return combineBatch(binnedIn.data(), binnedIn.size());
+	}
+
+
+	// Prediction of each tree of the set for a dense input, in the natural order of the trees
+	std::vector<U> treePredictions(const std::vector<T>& in) const
+	{
+		std::vector<U> out(trees.size());
+		if (encoding == 'b')
+		{
+			auto binned = TreePredictor<T, U>::binInput(in, cuts);
+			for (std::size_t t = 0; t < trees.size(); ++t)
+				out[t] = values[trees[t].leaf(binned)];
+		}
+		else
+			for (std::size_t t = 0; t < trees.size(); ++t)
+				out[t] = values[trees[t].leaf(in)];
+		return out;
+	}
+
+
+	// Encode all trees compactly, as for a single tree, dropping their full nodes. Binned trees share the
+	// sorted thresholds of each feature over all trees, so that each input is binned once. If a sample of
+	// inputs is given, every tree is first verified to reach the same leaf for each input, leaving the
+	// trees unchanged and throwing if any leaf differs.
+	void compact(const char& e, const std::vector< std::vector<T> >& sample = {})
+	{
+		TreePredictor<T, U>::checkEncoding(e);
+		if (encoding != 'f')
+			throw std::invalid_argument("Trees are already encoded compactly\n");
+		std::vector< std::vector<T> > featureCuts;
+		if (e == 'b')
+		{
+			for (const auto& tree : trees)
+				tree.addThresholds(featureCuts);
+			TreePredictor<T, U>::sortThresholds(featureCuts);
+		}
+		std::vector< TreePredictor<T, U> > encoded(trees);
+		for (auto& tree : encoded)
+		{
+			tree.encode(e, featureCuts);
+			tree.forestBinned = e == 'b';
+		}
+		
+		std::size_t differ = 0;
+		for (const auto& x : sample)
+		{
+			auto b = TreePredictor<T, U>::binInput(x, featureCuts);
+			for (std::size_t t = 0; t < trees.size(); ++t)
+				differ += (e == 'b' ? encoded[t].leaf(b) : encoded[t].leaf(x)) != trees[t].leaf(x);
+		}
+		if (differ > 0)
+			throw std::invalid_argument("Compact encoding changes " + std::to_string(differ) + " of "
+					+ std::to_string(sample.size() * trees.size()) + " tree predictions\n");
+		for (auto& tree : encoded)
+			tree.dropFullNodes();
+		trees = std::move(encoded);
+		cuts = featureCuts;
+		encoding = e;
+	}
+	char getEncoding() const {return encoding;}
+
+
+	// Number of features read by the trees
+	std::size_t featureCount() const
+	{
+		std::size_t D = 0;
+		for (const auto& tree : trees)
+			D = std::max(D, tree.featureCount());
+		return D;
+	}
+
+
+	// Save the set to a binary file, and load a set saved in this way, as for a single tree
+	void save(const std::string& filename) const
+	{
+		std::ofstream file(filename, std::ios::binary);
+		if (!file)
+			throw std::invalid_argument("Model file could not be opened\n");
+		writeModelHeader<T, U>(file, 'f');
+		writeModelData(file, (std::uint64_t) trees.size());
+		for (const auto& tree : trees)
+			tree.writeContents(file);
+		writeModelData(file, values);
+		writeModelData(file, vote);
+		writeModelData(file, earlyExit);
+		writeModelData(file, confidence);
+		writeModelData(file, (std::uint64_t) minVotes);
+		writeModelData(file, order);
+		writeModelData(file, encoding);
+		writeModelData(file, cuts);
+		if (!file)
+			throw std::invalid_argument("Model file could not be written\n");
+	}
+	static ForestPredictor load(const std::string& filename)
+	{
+		std::ifstream file(filename, std::ios::binary);
+		if (!file)
+			throw std::invalid_argument("Model file could not be opened\n");
+		checkModelHeader<T, U>(file, 'f');
+		ForestPredictor forest;
+		std::uint64_t nr, m;
+		readModelData(file, nr);
+		if (nr == 0 || nr > remainingBytes(file))
+			throw std::invalid_argument("Model file is truncated or corrupt\n");
+		forest.trees.resize(nr);
+		std::vector<std::uint64_t> D(nr);
+		for (std::size_t t = 0; t < nr; ++t)
+			forest.trees[t].readContents(file, D[t]);
+		readModelData(file, forest.values);
+		std::uint8_t vote, earlyExit;
+		readModelData(file, vote);
+		readModelData(file, earlyExit);
+		forest.vote = vote;
+		forest.earlyExit = earlyExit;
+		readModelData(file, forest.confidence);
+		readModelData(file, m);
+		forest.minVotes = m;
+		readModelData(file, forest.order);
+		readModelData(file, forest.encoding);
+		readModelData(file, forest.cuts);
+
+		// Trees index the value table of the set, and binned trees the thresholds of the set
+		bool valid = vote <= 1 && earlyExit <= 1 && (forest.encoding == 'f' || forest.encoding == 't' || forest.encoding == 'b');
+		for (const auto& i : forest.order)
+			valid = valid && i < nr;
+		valid = valid && (forest.order.empty() || forest.order.size() == nr);
+		for (std::size_t t = 0; t < nr && valid; ++t)
+		{
+			valid = forest.trees[t].encoding == forest.encoding && forest.trees[t].values.empty();
+			if (valid)
+				forest.trees[t].checkContents(D[t], forest.values.size(), forest.cuts);
+			forest.trees[t].forestBinned = forest.encoding == 'b';
+		}
+		if (!valid)
+			throw std::invalid_argument("Model file is truncated or corrupt\n");
+		return forest;
+	}
+
+
+	// Number of trees, and access to each of them. A tree of the set gives the position of its leaf in the
+	// value table of the set through leaf(), and value() gives the value at each position.
+	std::size_t size() const {return trees.size();}
+	const TreePredictor<T, U>& tree(const std::size_t& t) const {return trees[t];}
+	const U& value(const std::size_t& k) const {return values[k];}
+
+
+	// Memory held by the predictor, with the shared value table counted with the leaves
+	MemoryUsage memoryUsage() const
+	{
+		MemoryUsage usage;
+		for (const auto& tree : trees)
+			usage.add(tree.memoryUsage());
+		usage.nodes += trees.capacity() * sizeof(TreePredictor<T, U>) + order.capacity() * sizeof(std::size_t)
+				+ cuts.capacity() * sizeof(std::vector<T>);
+		for (const auto& c : cuts)
+			usage.nodes += c.capacity() * sizeof(T);
+		usage.leaves += values.capacity() * sizeof(U);
+		return usage;
+	}
+};
+
+
+
+#endif   // _PREDICTOR_
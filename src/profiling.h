@@ -0,0 +1,257 @@
+
+#ifndef _PROFILING_
+#define _PROFILING_
+
+#include <vector>
+#include <tuple>
+#include <string>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+
+
+
+// Phases of tree construction timed when profiling is enabled
+enum BuildPhase {PRESORT, CREATE_SPLITS, CHOOSE_SPLIT, SPLIT_INDICES, LEAVES, BOOTSTRAP, NR_PHASES};
+
+
+
+// Start of the timeline shared by all trace events
+inline std::chrono::steady_clock::time_point profileEpoch()
+{
+	static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+	return epoch;
+}
+
+
+
+// Statistics collected while building trees, if the library is compiled with DTREES_PROFILE defined.
+// These are the wall-clock and CPU time in seconds spent in each phase, and counts of the nodes and
+// leaves created, candidate thresholds evaluated, examples moved into child nodes and bytes allocated
+// for the main work buffers. If tracing is switched on, every timed phase is also kept as an event.
+class BuildStats
+{
+public:
+
+	// MEMBER OBJECTS
+
+	double wallTime[NR_PHASES] = {}, cpuTime[NR_PHASES] = {};
+	std::size_t nodes{0}, leaves{0}, thresholds{0}, rowsMoved{0}, bytes{0};
+
+	// Indicate whether events are recorded, and the events as (phase, start and duration in microseconds, tree)
+	bool trace{false};
+	std::vector< std::tuple<std::size_t, double, double, std::size_t> > events;
+
+
+	// METHODS
+
+	// Name of each phase
+	static const char* phaseName(const std::size_t& p)
+	{
+		static const char* names[NR_PHASES] = {"presort", "createSplits", "chooseSplit", "splitIndices", "leaves", "bootstrap"};
+		return names[p];
+	}
+
+
+	// Clear all statistics, keeping the tracing option
+	void clear()
+	{
+		bool tr = trace;
+		*this = BuildStats();
+		trace = tr;
+	}
+
+
+	// Add the statistics of another build, attributing its events to the given tree
+	void add(const BuildStats& other, const std::size_t& tree = 0)
+	{
+		for (std::size_t p = 0; p < NR_PHASES; ++p)
+		{
+			wallTime[p] += other.wallTime[p];
+			cpuTime[p] += other.cpuTime[p];
+		}
+		nodes += other.nodes; leaves += other.leaves; thresholds += other.thresholds;
+		rowsMoved += other.rowsMoved; bytes += other.bytes;
+		for (const auto& ev : other.events)
+			events.push_back(std::make_tuple(std::get<0>(ev), std::get<1>(ev), std::get<2>(ev), tree));
+	}
+
+
+	// Display the statistics
+	void display() const
+	{
+		std::cout << std::setw(16) << "Phase" << std::setw(14) << "Wall (s)" << std::setw(14) << "CPU (s)" << '\n';
+		for (std::size_t p = 0; p < NR_PHASES; ++p)
+			std::cout << std::setw(16) << phaseName(p) << std::setw(14) << wallTime[p] << std::setw(14) << cpuTime[p] << '\n';
+		std::cout << std::setw(16) << "Nodes: " << nodes << '\n';
+		std::cout << std::setw(16) << "Leaves: " << leaves << '\n';
+		std::cout << std::setw(16) << "Thresholds: " << thresholds << '\n';
+		std::cout << std::setw(16) << "Rows moved: " << rowsMoved << '\n';
+		std::cout << std::setw(16) << "Bytes: " << bytes << '\n';
+	}
+
+
+	// Write the recorded events as a Chrome trace-event JSON file, which can be opened in chrome://tracing
+	// or Perfetto. Each tree appears as a separate thread of the timeline.
+	void writeTrace(const std::string& filename) const
+	{
+		std::ofstream file(filename);
+		if (!file)
+			throw std::invalid_argument("Trace file could not be opened\n");
+		file << "{\"traceEvents\":[";
+		for (std::size_t e = 0; e < events.size(); ++e)
+			file << (e ? ",\n" : "\n") << "{\"name\":\"" << phaseName(std::get<0>(events[e])) << "\",\"ph\":\"X\",\"ts\":"
+			     << std::fixed << std::setprecision(3) << std::get<1>(events[e]) << ",\"dur\":" << std::get<2>(events[e])
+			     << ",\"pid\":0,\"tid\":" << std::get<3>(events[e]) << '}';
+		file << "\n]}\n";
+	}
+};
+
+
+
+// Approximate memory in bytes held by a tree or a set of trees, by kind of contents: the training data,
+// the index structures used for building, pruning and calibration, the internal nodes (including any
+// compiled node array) and the leaves. Container contents are counted, including an estimate for the
+// nodes of ordered containers, but not the overhead of the allocator.
+class MemoryUsage
+{
+public:
+
+	// MEMBER OBJECTS
+
+	std::size_t trainingData{0}, indexStructures{0}, nodes{0}, leaves{0};
+
+
+	// METHODS
+
+	// Total over all kinds of contents
+	std::size_t total() const {return trainingData + indexStructures + nodes + leaves;}
+
+
+	// Add the memory of another tree
+	void add(const MemoryUsage& other)
+	{
+		trainingData += other.trainingData; indexStructures += other.indexStructures;
+		nodes += other.nodes; leaves += other.leaves;
+	}
+
+
+	// Display the memory of each kind in megabytes
+	void display() const
+	{
+		std::cout << std::setw(20) << "Training data: " << trainingData / 1048576.0 << " MB\n";
+		std::cout << std::setw(20) << "Index structures: " << indexStructures / 1048576.0 << " MB\n";
+		std::cout << std::setw(20) << "Nodes: " << nodes / 1048576.0 << " MB\n";
+		std::cout << std::setw(20) << "Leaves: " << leaves / 1048576.0 << " MB\n";
+		std::cout << std::setw(20) << "Total: " << total() / 1048576.0 << " MB\n";
+	}
+};
+
+
+
+// Estimated size in bytes of one node of an ordered container (std::set or std::map) holding a value of
+// type V, which also stores its colour and pointers to its parent and children
+template<typename V>
+inline constexpr std::size_t containerNodeBytes() {return 4 * sizeof(void*) + sizeof(V);}
+
+
+
+// The timers below only exist if DTREES_PROFILE is defined
+#ifdef DTREES_PROFILE
+
+// CPU time in seconds used so far by the calling thread alone, so that trees built in parallel do not count
+// each other's work. Where the POSIX per-thread clock is missing, the CPU time of the whole process is used.
+inline double threadCpuTime()
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+	return (double) std::clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+
+
+// Object timing one phase of a build from its construction until it is stopped or destroyed
+class PhaseTimer
+{
+	// MEMBER OBJECTS
+	BuildStats& stats;
+	std::size_t phase;
+	std::chrono::steady_clock::time_point wallStart;
+	double cpuStart;
+	bool running{true};
+
+public:
+
+	// METHODS
+
+	// Constructor, which also fixes the start of the trace timeline before the first event begins
+	PhaseTimer(BuildStats& s, const std::size_t& p)
+	: stats(s), phase(p)
+	{
+		profileEpoch();
+		wallStart = std::chrono::steady_clock::now(); cpuStart = threadCpuTime();
+	}
+
+	// Stop timing, adding the time spent to the statistics
+	void stop()
+	{
+		if (!running)
+			return;
+		running = false;
+		auto wallEnd = std::chrono::steady_clock::now();
+		std::chrono::duration<double> wall = wallEnd - wallStart;
+		stats.wallTime[phase] += wall.count();
+		stats.cpuTime[phase] += threadCpuTime() - cpuStart;
+		if (stats.trace)
+		{
+			std::chrono::duration<double, std::micro> start = wallStart - profileEpoch();
+			stats.events.push_back(std::make_tuple(phase, start.count(), wall.count() * 1e6, 0));
+		}
+	}
+
+	// Stop timing the current phase and start timing another
+	void next(const std::size_t& p)
+	{
+		stop();
+		phase = p; running = true;
+		wallStart = std::chrono::steady_clock::now(); cpuStart = threadCpuTime();
+	}
+
+	// Destructor
+	~PhaseTimer() {stop();}
+};
+
+#endif
+
+
+
+// Instrumentation used inside the tree classes, which compiles to nothing unless DTREES_PROFILE is defined.
+// A scope holds at most one phase timer, which runs until PROFILE_STOP() or the end of the scope.
+#ifdef DTREES_PROFILE
+	#define PROFILE_PHASE(p) PhaseTimer phaseTimer(this->buildStats, p)
+	#define PROFILE_NEXT(p) phaseTimer.next(p)
+	#define PROFILE_STOP() phaseTimer.stop()
+	#define PROFILE_COUNT(counter, n) (this->buildStats.counter += (n))
+	#define PROFILE_ADD(stats, tree) this->buildStats.add(stats, tree)
+	#define PROFILE_CLEAR() this->buildStats.clear()
+	#define PROFILE_TRACING() this->buildStats.trace
+#else
+	#define PROFILE_PHASE(p)
+	#define PROFILE_NEXT(p)
+	#define PROFILE_STOP()
+	#define PROFILE_COUNT(counter, n)
+	#define PROFILE_ADD(stats, tree)
+	#define PROFILE_CLEAR()
+	#define PROFILE_TRACING() false
+#endif
+
+
+
+#endif   // _PROFILING_
@@ -0,0 +1,509 @@
+
+#ifndef _SERVING_
+#define _SERVING_
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <future>
+#include <deque>
+#include <chrono>
+#include <type_traits>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <stdexcept>
+
+
+
+// Handle to the model used by a live server, which can be replaced while other threads are predicting.
+// Publication follows read-copy-update (RCU): each prediction thread registers a Reader, and each read
+// takes a Snapshot of the current model without locks or reference counts. A writer installs a new model
+// with one atomic exchange, and the old model is retired. It is deleted once every reader that could
+// still see it has left, which is checked by the writer when publishing or calling reclaim().
+//
+// Models are never modified through the handle, so any type whose const methods may be called from
+// several threads at once can be served, such as TreePredictor, ForestPredictor or a set of bagged trees.
+template<typename M>
+class ModelHandle
+{
+	// NESTED CLASS
+
+	// Slot announcing the epoch in which a reader entered, or idle. Each slot fills a cache line, so
+	// that readers of different threads do not contend for the same line.
+	struct alignas(64) Slot
+	{
+		std::atomic<std::uint64_t> epoch{idle};
+		std::atomic<bool> claimed{false};
+	};
+
+
+	// MEMBER OBJECTS
+
+	static constexpr std::uint64_t idle = std::numeric_limits<std::uint64_t>::max();
+
+	std::atomic<const M*> current{nullptr};
+	std::atomic<std::uint64_t> epoch{0}, published{0};
+	std::size_t nrSlots;
+	std::unique_ptr<Slot[]> slots;
+
+	// Retired models as (model, first epoch in which it could no longer be read), guarded by the writer lock
+	std::mutex writerLock;
+	std::vector< std::pair<const M*, std::uint64_t> > retired;
+
+
+	// METHODS
+
+	// Delete the retired models which no reader can still see, assuming the writer lock is held
+	std::size_t reclaimRetired()
+	{
+		if (retired.empty())
+			return 0;
+		std::uint64_t oldest = idle;
+		for (std::size_t s = 0; s < nrSlots; ++s)
+			oldest = std::min(oldest, slots[s].epoch.load());
+		std::size_t kept = 0, freed = 0;
+		for (auto& r : retired)
+		{
+			if (r.second <= oldest)
+			{
+				delete r.first;
+				++freed;
+			}
+			else
+				retired[kept++] = r;
+		}
+		retired.resize(kept);
+		return freed;
+	}
+
+
+public:
+
+	class Reader;
+
+
+	// Read-only view of the model which was current when the snapshot was taken. The model stays valid
+	// until the snapshot is destroyed, even if a new one is published in the meantime. Snapshots are
+	// short-lived: a reader that holds one keeps every later retired model from being deleted.
+	class Snapshot
+	{
+		friend class Reader;
+
+		// MEMBER OBJECTS
+		Reader* reader;
+		const M* model;
+
+		// Constructor, used by Reader::read()
+		Snapshot(Reader* r, const M* m) : reader(r), model(m) {}
+
+	public:
+
+		// METHODS
+
+		// Move constructor
+		Snapshot(Snapshot&& other) : reader(other.reader), model(other.model) {other.reader = nullptr;}
+
+		Snapshot(const Snapshot&) = delete;
+		Snapshot& operator=(const Snapshot&) = delete;
+		Snapshot& operator=(Snapshot&&) = delete;
+
+		// Destructor, which lets the reader leave
+		~Snapshot()
+		{
+			if (reader)
+				reader->leave();
+		}
+
+		// Access the model, which is null if none has been published
+		const M* get() const {return model;}
+		const M& operator*() const {return *model;}
+		const M* operator->() const {return model;}
+		explicit operator bool() const {return model != nullptr;}
+	};
+
+
+	// Registration of one prediction thread with the handle, holding a slot until it is destroyed. A reader
+	// must only be used by one thread at a time, and must not outlive the handle.
+	class Reader
+	{
+		friend class ModelHandle;
+		friend class Snapshot;
+
+		// MEMBER OBJECTS
+		ModelHandle* handle;
+		Slot* slot;
+		std::size_t depth{0};
+
+		// Constructor, used by ModelHandle::reader()
+		Reader(ModelHandle* h, Slot* s) : handle(h), slot(s) {}
+
+		// Leave the outermost snapshot
+		void leave()
+		{
+			if (--depth == 0)
+				slot->epoch.store(idle, std::memory_order_release);
+		}
+
+	public:
+
+		// METHODS
+
+		// Move constructor
+		Reader(Reader&& other) : handle(other.handle), slot(other.slot), depth(other.depth) {other.slot = nullptr;}
+
+		Reader(const Reader&) = delete;
+		Reader& operator=(const Reader&) = delete;
+		Reader& operator=(Reader&&) = delete;
+
+		// Destructor, which frees the slot
+		~Reader()
+		{
+			if (slot)
+				slot->claimed.store(false, std::memory_order_release);
+		}
+
+
+		// Take a snapshot of the current model. The epoch is announced before the model is loaded, so that a
+		// writer which retires the model afterwards sees this reader as active. Snapshots may be nested.
+		Snapshot read()
+		{
+			if (depth++ == 0)
+				slot->epoch.store(handle->epoch.load());
+			return Snapshot(this, handle->current.load());
+		}
+	};
+
+
+	// Constructor, allowing up to the given number of readers at once
+	explicit ModelHandle(const std::size_t& maxReaders = 64)
+	: nrSlots(maxReaders), slots(new Slot[maxReaders]) {}
+
+
+	// Constructor with an initial model
+	explicit ModelHandle(M model, const std::size_t& maxReaders = 64)
+	: ModelHandle(maxReaders)
+	{
+		publish(std::move(model));
+	}
+
+
+	ModelHandle(const ModelHandle&) = delete;
+	ModelHandle& operator=(const ModelHandle&) = delete;
+
+
+	// Destructor, which deletes the current and all retired models. No reader may be active.
+	~ModelHandle()
+	{
+		delete current.load();
+		for (auto& r : retired)
+			delete r.first;
+	}
+
+
+	// Register a reader, which should be done once by each prediction thread
+	Reader reader()
+	{
+		for (std::size_t s = 0; s < nrSlots; ++s)
+		{
+			bool free = false;
+			if (!slots[s].claimed.load(std::memory_order_relaxed) && slots[s].claimed.compare_exchange_strong(free, true))
+				return Reader(this, &slots[s]);
+		}
+		throw std::invalid_argument("All " + std::to_string(nrSlots) + " reader slots of the model handle are in use\n");
+	}
+
+
+	// Install a new model, retiring the previous one, and delete any retired models that are no longer
+	// read. Readers are never blocked; concurrent writers are serialised.
+	void publish(std::unique_ptr<M> model)
+	{
+		std::lock_guard<std::mutex> lock(writerLock);
+		const M* old = current.exchange(model.release());
+		++published;
+		if (old)
+			retired.push_back(std::make_pair(old, epoch.fetch_add(1) + 1));
+		reclaimRetired();
+	}
+
+
+	// Install a new model, moving it into the handle
+	void publish(M model) {publish(std::unique_ptr<M>(new M(std::move(model))));}
+
+
+	// Delete the retired models that are no longer read, returning how many were deleted
+	std::size_t reclaim()
+	{
+		std::lock_guard<std::mutex> lock(writerLock);
+		return reclaimRetired();
+	}
+
+
+	// Wait until every retired model has been deleted, which needs all current snapshots to be destroyed
+	void synchronize()
+	{
+		while (true)
+		{
+			{
+				std::lock_guard<std::mutex> lock(writerLock);
+				reclaimRetired();
+				if (retired.empty())
+					return;
+			}
+			std::this_thread::yield();
+		}
+	}
+
+
+	// Number of retired models not yet deleted
+	std::size_t retiredCount()
+	{
+		std::lock_guard<std::mutex> lock(writerLock);
+		return retired.size();
+	}
+
+
+	// Number of models published so far
+	std::uint64_t version() const {return published.load();}
+
+
+	// Maximum number of readers at once
+	std::size_t maxReaders() const {return nrSlots;}
+};
+
+
+
+// Indicate whether a model has a batch prediction path predictBatch(in) for dense inputs of type T
+template<typename M, typename T, typename = void>
+struct HasPredictBatch : std::false_type {};
+template<typename M, typename T>
+struct HasPredictBatch<M, T, std::void_t<decltype(std::declval<const M&>().predictBatch(std::declval<const std::vector< std::vector<T> >&>()))> >
+: std::true_type {};
+
+
+
+// Predict a batch of dense inputs through the batch path of the model if it has one, or else one at a time
+template<typename U, typename M, typename T>
+static inline std::vector<U> predictRows(const M& model, const std::vector< std::vector<T> >& in)
+{
+	if constexpr (HasPredictBatch<M, T>::value)
+		return model.predictBatch(in);
+	else
+	{
+		std::vector<U> out(in.size());
+		for (std::size_t n = 0; n < in.size(); ++n)
+			out[n] = model.predict(in[n]);
+		return out;
+	}
+}
+
+
+
+// In-process prediction service which scores single inputs in batches. Callers submit one input at a time
+// and get a future for its prediction. A dispatcher thread coalesces waiting inputs into batches of at most
+// a given size, sending a smaller batch once its oldest input has waited for a given time, and a pool of
+// workers scores each batch with the current model of a ModelHandle, through predictBatch() where the model
+// has it. At most two batches per worker wait to be scored, so under load the inputs queue up and the
+// batches grow to the maximum size.
+template<typename M, typename T, typename U>
+class PredictionService
+{
+	// NESTED CLASSES
+
+	// Input waiting to be batched, with the promise of its prediction and its time of arrival
+	class Request
+	{
+	public:
+		std::vector<T> in;
+		std::promise<U> result;
+		std::chrono::steady_clock::time_point arrival;
+	};
+
+	// Batch of inputs waiting to be scored
+	class Batch
+	{
+	public:
+		std::vector< std::vector<T> > in;
+		std::vector< std::promise<U> > results;
+	};
+
+
+	// MEMBER OBJECTS
+
+	ModelHandle<M>& handle;
+	std::size_t maxBatch, maxQueued;
+	std::chrono::microseconds maxWait;
+
+	// Inputs waiting to be batched, guarded by requestLock, and whether the service is stopping
+	std::mutex requestLock;
+	std::condition_variable requested;
+	std::deque<Request> requests;
+	bool stopping{false};
+
+	// Batches waiting to be scored, guarded by batchLock, and whether all batches have been dispatched
+	std::mutex batchLock;
+	std::condition_variable batchReady, batchTaken;
+	std::deque<Batch> batches;
+	bool dispatched{false};
+
+	std::thread dispatcher;
+	std::vector<std::thread> workers;
+	std::atomic<std::size_t> nrBatches{0}, nrRows{0};
+
+
+	// METHODS
+
+	// Coalesce waiting inputs into batches until the service stops and every input has been dispatched
+	void dispatch()
+	{
+		std::unique_lock<std::mutex> lock(requestLock);
+		while (true)
+		{
+			requested.wait(lock, [this]() {return stopping || !requests.empty();});
+			if (requests.empty())
+				break;
+			requested.wait_until(lock, requests.front().arrival + maxWait,
+					     [this]() {return stopping || requests.size() >= maxBatch;});
+
+			Batch batch;
+			std::size_t nr = std::min(maxBatch, requests.size());
+			batch.in.reserve(nr);
+			batch.results.reserve(nr);
+			for (std::size_t n = 0; n < nr; ++n)
+			{
+				batch.in.push_back(std::move(requests.front().in));
+				batch.results.push_back(std::move(requests.front().result));
+				requests.pop_front();
+			}
+			lock.unlock();
+			{
+				std::unique_lock<std::mutex> queue(batchLock);
+				batchTaken.wait(queue, [this]() {return batches.size() < maxQueued;});
+				batches.push_back(std::move(batch));
+			}
+			batchReady.notify_one();
+			lock.lock();
+		}
+		lock.unlock();
+		{
+			std::lock_guard<std::mutex> queue(batchLock);
+			dispatched = true;
+		}
+		batchReady.notify_all();
+	}
+
+
+	// Score batches with the current model until all batches have been dispatched and scored
+	void work(typename ModelHandle<M>::Reader reader)
+	{
+		while (true)
+		{
+			Batch batch;
+			{
+				std::unique_lock<std::mutex> queue(batchLock);
+				batchReady.wait(queue, [this]() {return dispatched || !batches.empty();});
+				if (batches.empty())
+					return;
+				batch = std::move(batches.front());
+				batches.pop_front();
+			}
+			batchTaken.notify_one();
+
+			try
+			{
+				auto model = reader.read();
+				if (!model)
+					throw std::invalid_argument("No model has been published to the prediction service\n");
+				std::vector<U> out = predictRows<U>(*model, batch.in);
+				for (std::size_t n = 0; n < out.size(); ++n)
+					batch.results[n].set_value(out[n]);
+			}
+			catch (...)
+			{
+				for (auto& result : batch.results)
+					result.set_exception(std::current_exception());
+			}
+			++nrBatches;
+			nrRows += batch.in.size();
+		}
+	}
+
+
+public:
+
+	// Constructor, starting the dispatcher and the given number of workers, each registered as a reader of
+	// the handle. A batch holds at most 'batch' inputs, and is sent once its first input has waited for
+	// 'waitMicros' microseconds.
+	PredictionService(ModelHandle<M>& h, const std::size_t& nrWorkers = std::max(1u, std::thread::hardware_concurrency()),
+			  const std::size_t& batch = 64, const std::size_t& waitMicros = 200)
+	: handle(h), maxBatch(batch), maxQueued(2 * nrWorkers), maxWait(waitMicros)
+	{
+		if (nrWorkers == 0 || batch == 0)
+			throw std::invalid_argument("A prediction service needs at least one worker and a batch size of at least one\n");
+		std::vector<typename ModelHandle<M>::Reader> readers;
+		for (std::size_t w = 0; w < nrWorkers; ++w)
+			readers.push_back(handle.reader());
+		for (auto& reader : readers)
+			workers.emplace_back(&PredictionService::work, this, std::move(reader));
+		dispatcher = std::thread(&PredictionService::dispatch, this);
+	}
+
+
+	PredictionService(const PredictionService&) = delete;
+	PredictionService& operator=(const PredictionService&) = delete;
+
+
+	// Destructor, which scores every input already submitted before stopping
+	~PredictionService() {stop();}
+
+
+	// Submit one input, returning a future for its prediction. If scoring fails, the future holds the exception.
+	std::future<U> submit(std::vector<T> in)
+	{
+		Request request;
+		request.in = std::move(in);
+		request.arrival = std::chrono::steady_clock::now();
+		std::future<U> result = request.result.get_future();
+		bool wake;
+		{
+			std::lock_guard<std::mutex> lock(requestLock);
+			if (stopping)
+				throw std::invalid_argument("Prediction service has been stopped\n");
+			requests.push_back(std::move(request));
+			wake = requests.size() == 1 || requests.size() == maxBatch;
+		}
+		if (wake)
+			requested.notify_one();
+		return result;
+	}
+
+
+	// Score every input already submitted and stop the dispatcher and workers
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(requestLock);
+			if (stopping)
+				return;
+			stopping = true;
+		}
+		requested.notify_one();
+		dispatcher.join();
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+
+	// Number of batches and of inputs scored so far
+	std::size_t batchCount() const {return nrBatches.load();}
+	std::size_t rowCount() const {return nrRows.load();}
+};
+
+
+
+#endif   // _SERVING_
@@ -0,0 +1,172 @@
+
+#ifndef _SPARSE_
+#define _SPARSE_
+
+#include <vector>
+#include <utility>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+
+
+
+// Find the value of feature d in a sparse row, given as (feature, value) pairs sorted by feature.
+// Features which are not listed are zero.
+template<typename T>
+static inline T sparseValue(const std::vector< std::pair<std::size_t, T> >& row, const std::size_t& d)
+{
+	auto it = std::lower_bound(row.begin(), row.end(), d,
+		[](const std::pair<std::size_t, T>& el, std::size_t f) {return el.first < f;});
+	if (it != row.end() && it->first == d)
+		return it->second;
+	return T(0);
+}
+
+
+
+
+// Class defining a matrix in compressed sparse row (CSR) format, which only stores the entries of each
+// row which are not zero
+template<typename T>
+class SparseMatrix
+{
+	// MEMBER OBJECTS
+
+	// Number of rows and columns
+	std::size_t nrRows{0}, nrCols{0};
+
+	// Position of the first entry of each row, followed by the total number of entries
+	std::vector<std::size_t> start{0};
+
+	// Column and value of each entry, sorted by column within each row
+	std::vector<std::size_t> cols;
+	std::vector<T> vals;
+
+
+	// METHODS
+
+	// Check the arrays describing the matrix, and sort the entries of each row by column
+	void prepare()
+	{
+		if (start.size() != nrRows+1 || start.back() != cols.size() || cols.size() != vals.size())
+			throw std::invalid_argument("Sparse matrix arrays have inconsistent sizes\n");
+		for (std::size_t i = 0; i < nrRows; ++i)
+		{
+			if (start[i] > start[i+1])
+				throw std::invalid_argument("Sparse matrix row starts must not decrease\n");
+			std::vector<std::size_t> idx(start[i+1] - start[i]);
+			std::iota(idx.begin(), idx.end(), start[i]);
+			std::sort(idx.begin(), idx.end(), [this](std::size_t e1, std::size_t e2) {return cols[e1] < cols[e2];});
+			std::vector<std::size_t> c(idx.size());
+			std::vector<T> v(idx.size());
+			for (std::size_t e = 0; e < idx.size(); ++e)
+			{
+				if (cols[idx[e]] >= nrCols)
+					throw std::invalid_argument("Sparse matrix column index out of range\n");
+				c[e] = cols[idx[e]]; v[e] = vals[idx[e]];
+			}
+			std::copy(c.begin(), c.end(), cols.begin() + start[i]);
+			std::copy(v.begin(), v.end(), vals.begin() + start[i]);
+		}
+	}
+
+
+public:
+
+	// Constructor from CSR arrays: entries rowStart[i] to rowStart[i+1]-1 belong to row i
+	SparseMatrix(const std::size_t& rows, const std::size_t& columns, std::vector<std::size_t> rowStart,
+			std::vector<std::size_t> colIdx, std::vector<T> values)
+	: nrRows(rows), nrCols(columns), start(rowStart), cols(colIdx), vals(values) {prepare();}
+
+
+	// Constructor from a dense matrix, dropping its zero entries
+	SparseMatrix(const std::vector< std::vector<T> >& dense)
+	: nrRows(dense.size()), nrCols(dense.empty() ? 0 : dense[0].size())
+	{
+		for (const auto& row : dense)
+		{
+			for (std::size_t j = 0; j < nrCols; ++j)
+				if (row[j] != T(0))
+				{
+					cols.push_back(j);
+					vals.push_back(row[j]);
+				}
+			start.push_back(cols.size());
+		}
+	}
+
+
+	// Default constructor
+	SparseMatrix() = default;
+
+
+	// Construct from compressed sparse column (CSC) arrays: entries colStart[j] to colStart[j+1]-1 belong to column j
+	static SparseMatrix fromCSC(const std::size_t& rows, const std::size_t& columns, const std::vector<std::size_t>& colStart,
+			const std::vector<std::size_t>& rowIdx, const std::vector<T>& values)
+	{
+		if (colStart.size() != columns+1 || colStart.back() != rowIdx.size() || rowIdx.size() != values.size())
+			throw std::invalid_argument("Sparse matrix arrays have inconsistent sizes\n");
+		std::vector<std::size_t> rowStart(rows+1, 0);
+		for (const std::size_t& i : rowIdx)
+		{
+			if (i >= rows)
+				throw std::invalid_argument("Sparse matrix row index out of range\n");
+			++rowStart[i+1];
+		}
+		std::partial_sum(rowStart.begin(), rowStart.end(), rowStart.begin());
+
+		std::vector<std::size_t> next(rowStart.begin(), rowStart.end()-1), colIdx(rowIdx.size());
+		std::vector<T> vls(values.size());
+		for (std::size_t j = 0; j < columns; ++j)
+			for (std::size_t e = colStart[j]; e < colStart[j+1]; ++e)
+			{
+				colIdx[ next[rowIdx[e]] ] = j;
+				vls[ next[rowIdx[e]]++ ] = values[e];
+			}
+		return SparseMatrix(rows, columns, rowStart, colIdx, vls);
+	}
+
+
+	// Access methods
+	std::size_t rows() const {return nrRows;}
+	std::size_t columns() const {return nrCols;}
+	std::size_t nonZeros() const {return vals.size();}
+	std::size_t bytes() const {return (start.capacity() + cols.capacity()) * sizeof(std::size_t) + vals.capacity() * sizeof(T);}
+
+
+	// Row i as (column, value) pairs sorted by column
+	std::vector< std::pair<std::size_t, T> > row(const std::size_t& i) const
+	{
+		std::vector< std::pair<std::size_t, T> > r;
+		r.reserve(start[i+1] - start[i]);
+		for (std::size_t e = start[i]; e < start[i+1]; ++e)
+			r.push_back(std::make_pair(cols[e], vals[e]));
+		return r;
+	}
+
+
+	// Entries of each column as (row, value) pairs, in compressed sparse column order
+	std::vector< std::vector< std::pair<std::size_t, T> > > byColumn() const
+	{
+		std::vector< std::vector< std::pair<std::size_t, T> > > c(nrCols);
+		for (std::size_t i = 0; i < nrRows; ++i)
+			for (std::size_t e = start[i]; e < start[i+1]; ++e)
+				c[cols[e]].push_back(std::make_pair(i, vals[e]));
+		return c;
+	}
+
+
+	// Value of the entry in row i and column j
+	T at(const std::size_t& i, const std::size_t& j) const
+	{
+		auto first = cols.begin() + start[i], last = cols.begin() + start[i+1];
+		auto it = std::lower_bound(first, last, j);
+		if (it != last && *it == j)
+			return vals[it - cols.begin()];
+		return T(0);
+	}
+};
+
+
+
+#endif   // _SPARSE_
@@ -0,0 +1,526 @@
+
+#ifndef _STREAMING_
+#define _STREAMING_
+
+#include <type_traits>
+#include "trees.h"
+
+
+// Incremental decision tree for unbounded streams of dense, numerical inputs: a Hoeffding tree, or very
+// fast decision tree. Each leaf keeps a histogram of the examples reaching it over a fixed set of bins per
+// feature, with the number of examples of each class ('c') or the number, sum and square sum of outputs ('r')
+// in each bin. A leaf is split once the Hoeffding bound shows, with probability 1 - delta, that its best
+// split is better than the best split on any other feature, using the same impurities as ClassificationTree
+// and RegressionTree. The bins are quantiles of the first examples of the stream, so every leaf holds the
+// same bounded statistics however many examples reach it.
+template<typename T, typename U>
+class HoeffdingTree
+{
+public:
+
+	static const std::size_t none = std::numeric_limits<std::size_t>::max();
+
+
+private:
+
+	// NESTED CLASS
+
+	// Node of the tree. An internal node sends inputs with x[d] < split to 'left' and the others to left + 1.
+	// A leaf has d = none, and 'leaf' is the position of its statistics.
+	class Node
+	{
+	public:
+		double split{0};
+		std::size_t d{none}, left{none}, leaf{none}, depth{0};
+	};
+
+
+	// Statistics of a leaf: 'stats' over the examples it predicts from, including its share of the examples
+	// of the split that created it, and 'hist' over the examples it has seen itself, with the statistics of
+	// bin b of feature d at position (d*B + b)*width. 'seen' is the number of examples in the histogram and
+	// 'checked' its value at the last check for a split. A leaf which can no longer be split keeps no histogram.
+	class Leaf
+	{
+	public:
+		std::vector<double> stats, hist;
+		std::size_t width{0};
+		double seen{0}, checked{0};
+		bool active{true};
+	};
+
+
+	// MEMBER OBJECTS
+
+	// Task, 'c' (classification) or 'r' (regression), number of features and maximum number of bins per feature
+	char task;
+	std::size_t D, B;
+
+	// Impurity of classification, entropy ('e') or Gini ('g')
+	char impurity{'e'};
+
+	// Examples a leaf sees between checks for a split, probability of a wrong split, difference in merit
+	// below which two splits are considered tied, and limits on the tree
+	std::size_t gracePeriod{200};
+	double delta{1e-7}, tieThreshold{0.05};
+	std::size_t maxDepth{none}, maxLeaves{none};
+
+	// Number of examples from which the bins are set, the examples kept until then with their targets, and the
+	// thresholds between the bins of each feature
+	std::size_t warmup{1000};
+	std::vector< std::vector<T> > buffer;
+	std::vector<double> bufferTargets;
+	std::vector< std::vector<double> > cuts;
+
+	// Nodes, with the root first, and statistics of the leaves
+	std::vector<Node> nodes;
+	std::vector<Leaf> leaves;
+
+	// Classes in order of first appearance and their positions (classification only)
+	std::vector<U> classes;
+	std::map<U, std::size_t> classIndex;
+
+	// Number of examples learnt
+	std::size_t count{0};
+
+
+	// METHODS
+
+	// Width of the statistics: one per class seen so far, or the number, sum and square sum of outputs
+	std::size_t width() const {return task == 'c' ? classes.size() : 3;}
+
+
+	// Add an example with the given target, its class position or its output, to statistics st
+	void addStats(double* st, const double& target) const
+	{
+		if (task == 'c')
+			st[(std::size_t)target] += 1;
+		else
+		{
+			st[0] += 1; st[1] += target; st[2] += target * target;
+		}
+	}
+
+
+	// Impurity of statistics multiplied by their number of examples, as for ClassificationTree and RegressionTree
+	double nodeImpurity(const double* st, const std::size_t& W) const
+	{
+		return task == 'c' ? classImpurity(st, W, impurity) : varianceImpurity(st);
+	}
+
+
+	// Number of examples described by statistics of width W
+	static double statCount(const double* st, const std::size_t& W, const char& task)
+	{
+		return task == 'c' ? std::accumulate(st, st + W, 0.0) : st[0];
+	}
+
+
+	// Bring the statistics of a leaf to the current width, once new classes have been seen
+	void widen(Leaf& leaf) const
+	{
+		std::size_t W = width();
+		if (leaf.stats.size() < W)
+			leaf.stats.resize(W, 0);
+		if (!leaf.active || cuts.empty() || leaf.width == W)
+			return;
+		std::vector<double> hist(D * B * W, 0);
+		for (std::size_t c = 0; c < D * B && leaf.width > 0; ++c)
+			std::copy(leaf.hist.begin() + c * leaf.width, leaf.hist.begin() + (c+1) * leaf.width, hist.begin() + c * W);
+		leaf.hist.swap(hist);
+		leaf.width = W;
+	}
+
+
+	// Bin of a value of feature d: the number of thresholds of the feature not above it
+	std::size_t binOf(const std::size_t& d, const T& x) const
+	{
+		return std::upper_bound(cuts[d].begin(), cuts[d].end(), (double) x) - cuts[d].begin();
+	}
+
+
+	// Node of the leaf reached by an input
+	std::size_t findLeaf(const std::vector<T>& in) const
+	{
+		std::size_t i = 0;
+		while (nodes[i].d != none)
+			i = in[nodes[i].d] < nodes[i].split ? nodes[i].left : nodes[i].left + 1;
+		return i;
+	}
+
+
+	// Add an example to the histogram of a leaf, and check for a split every grace period
+	void addToHistogram(const std::size_t& node, const std::vector<T>& in, const double& target)
+	{
+		Leaf& leaf = leaves[nodes[node].leaf];
+		if (!leaf.active)
+			return;
+		widen(leaf);
+		for (std::size_t d = 0; d < D; ++d)
+			addStats(&leaf.hist[(d * B + binOf(d, in[d])) * leaf.width], target);
+		leaf.seen += 1;
+		if (leaf.seen - leaf.checked >= gracePeriod)
+		{
+			leaf.checked = leaf.seen;
+			checkSplit(node);
+		}
+	}
+
+
+	// Set the thresholds between bins at quantiles of the examples seen so far, then learn from those examples
+	// again as from new ones, so that the leaves created while they are replayed hold all of them
+	void setCuts()
+	{
+		std::size_t N = buffer.size();
+		cuts.assign(D, std::vector<double>());
+		std::vector<double> column(N);
+		for (std::size_t d = 0; d < D; ++d)
+		{
+			for (std::size_t n = 0; n < N; ++n)
+				column[n] = buffer[n][d];
+			std::sort(column.begin(), column.end());
+			for (std::size_t b = 1; b < B; ++b)
+			{
+				double cut = column[b * N / B];
+				if (cut > column[0] && (cuts[d].empty() || cut > cuts[d].back()))
+					cuts[d].push_back(cut);
+			}
+		}
+		std::vector< std::vector<T> > examples;
+		std::vector<double> targets;
+		examples.swap(buffer);
+		targets.swap(bufferTargets);
+		std::fill(leaves[0].stats.begin(), leaves[0].stats.end(), 0);
+		for (std::size_t n = 0; n < N; ++n)
+		{
+			std::size_t node = findLeaf(examples[n]);
+			widen(leaves[nodes[node].leaf]);
+			addStats(&leaves[nodes[node].leaf].stats[0], targets[n]);
+			addToHistogram(node, examples[n], targets[n]);
+		}
+
+		double total = 0;
+		for (const auto& leaf : leaves)
+			total += statCount(leaf.stats.data(), leaf.stats.size(), task);
+		if (total != count)
+			throw std::logic_error("Leaves hold " + std::to_string((std::size_t) total) + " examples after the warm-up, but "
+					+ std::to_string(count) + " were learnt\n");
+	}
+
+
+	// Split a leaf if the Hoeffding bound separates its best split from the best split on any other feature.
+	// The merit of a split is its reduction in impurity per example for classification, which lies between
+	// 0 and log(K) for entropy and 1 for Gini, or its fraction of the sum of squared deviations removed for
+	// regression, which lies between 0 and 1.
+	void checkSplit(const std::size_t& node)
+	{
+		if (nodes[node].depth >= maxDepth || leaves.size() >= maxLeaves)
+			return;
+		Leaf& leaf = leaves[nodes[node].leaf];
+		std::size_t W = leaf.width;
+		std::vector<double> tot(W, 0), left(W), right(W);
+		for (std::size_t b = 0; b < B; ++b)
+			for (std::size_t j = 0; j < W; ++j)
+				tot[j] += leaf.hist[b * W + j];
+		double n = statCount(&tot[0], W, task), impurityBefore = nodeImpurity(&tot[0], W);
+		if (impurityBefore <= 0)
+			return;
+
+		double best = 0, second = 0;
+		std::size_t bestD = none, bestB = 0;
+		for (std::size_t d = 0; d < D; ++d)
+		{
+			double featureBest = 0;
+			std::size_t featureB = none;
+			std::fill(left.begin(), left.end(), 0);
+			for (std::size_t b = 0; b < cuts[d].size(); ++b)
+			{
+				for (std::size_t j = 0; j < W; ++j)
+				{
+					left[j] += leaf.hist[(d * B + b) * W + j];
+					right[j] = tot[j] - left[j];
+				}
+				double nLeft = statCount(&left[0], W, task);
+				if (nLeft == 0 || nLeft == n)
+					continue;
+				double merit = (impurityBefore - nodeImpurity(&left[0], W) - nodeImpurity(&right[0], W))
+							/ (task == 'c' ? n : impurityBefore);
+				if (merit > featureBest)
+				{
+					featureBest = merit;
+					featureB = b;
+				}
+			}
+			if (featureB == none)
+				continue;
+			if (featureBest > best)
+			{
+				second = best;
+				best = featureBest;
+				bestD = d;
+				bestB = featureB;
+			}
+			else if (featureBest > second)
+				second = featureBest;
+		}
+		if (bestD == none)
+			return;
+
+		double R = task == 'c' && impurity == 'e' ? std::log(std::max<double>(W, 2)) : 1;
+		double epsilon = std::sqrt(R * R * std::log(1 / delta) / (2 * n));
+		if (best - second > epsilon || epsilon < tieThreshold)
+			split(node, bestD, bestB);
+	}
+
+
+	// Split a leaf on feature d after bin b, giving each child the statistics of its side of the split
+	void split(const std::size_t& node, const std::size_t& d, const std::size_t& b)
+	{
+		std::size_t W = leaves[nodes[node].leaf].width, depth = nodes[node].depth + 1;
+		std::vector<double> leftStats(W, 0), rightStats(W, 0);
+		const std::vector<double>& hist = leaves[nodes[node].leaf].hist;
+		for (std::size_t c = 0; c < B; ++c)
+			for (std::size_t j = 0; j < W; ++j)
+				(c <= b ? leftStats : rightStats)[j] += hist[(d * B + c) * W + j];
+
+		// The left child takes over the statistics of the parent, and the right child gets new ones
+		std::size_t leftLeaf = nodes[node].leaf, rightLeaf = leaves.size();
+		leaves.emplace_back();
+		bool active = depth < maxDepth && leaves.size() < maxLeaves;
+		for (std::size_t l : {leftLeaf, rightLeaf})
+		{
+			Leaf& leaf = leaves[l];
+			leaf.stats = l == leftLeaf ? leftStats : rightStats;
+			leaf.seen = 0;
+			leaf.checked = 0;
+			leaf.active = active;
+			leaf.width = active ? W : 0;
+			std::vector<double>(active ? D * B * W : 0, 0).swap(leaf.hist);
+		}
+
+		Node child;
+		child.depth = depth;
+		child.leaf = leftLeaf;
+		nodes[node].d = d;
+		nodes[node].split = cuts[d][b];
+		nodes[node].left = nodes.size();
+		nodes[node].leaf = none;
+		nodes.push_back(child);
+		child.leaf = rightLeaf;
+		nodes.push_back(child);
+
+		// Once the tree has its maximum number of leaves, none of them can be split
+		if (leaves.size() >= maxLeaves)
+			for (auto& leaf : leaves)
+			{
+				leaf.active = false;
+				std::vector<double>().swap(leaf.hist);
+			}
+	}
+
+
+	// Output of a leaf: its most common class, or its mean output
+	U leafValue(const Leaf& leaf) const
+	{
+		if (task == 'c')
+			return classes[std::max_element(leaf.stats.begin(), leaf.stats.end()) - leaf.stats.begin()];
+		if constexpr (std::is_arithmetic<U>::value)
+			return leaf.stats[1] / leaf.stats[0];
+		else
+			throw std::invalid_argument("Regression requires numerical outputs\n");
+	}
+
+
+	// Append the nodes of the subtree at node i to a predictor's node array, in preorder
+	void compile(const std::size_t& i, std::vector<typename TreePredictor<T, U>::Node>& out, std::vector<U>& values) const
+	{
+		typename TreePredictor<T, U>::Node node;
+		node.cats = none;
+		if (nodes[i].d == none)
+		{
+			node.split = 0;
+			node.d = none;
+			node.next = values.size();
+			values.push_back(leafValue(leaves[nodes[i].leaf]));
+			out.push_back(node);
+			return;
+		}
+		std::size_t position = out.size();
+		node.split = nodes[i].split;
+		node.d = nodes[i].d;
+		out.push_back(node);
+		compile(nodes[i].left, out, values);
+		out[position].next = out.size();
+		compile(nodes[i].left + 1, out, values);
+	}
+
+
+public:
+
+	// Constructor, with the task, 'c' (classification) or 'r' (regression), the number of features, and the
+	// maximum number of bins per feature
+	HoeffdingTree(char t, const std::size_t& nrFeatures, const std::size_t& nrBins = 64)
+	: task(t), D(nrFeatures), B(nrBins)
+	{
+		if (task != 'c' && task != 'r')
+			throw std::invalid_argument("Task must be 'c' (classification) or 'r' (regression)\n");
+		if (task == 'r' && !std::is_arithmetic<U>::value)
+			throw std::invalid_argument("Regression requires numerical outputs\n");
+		if (D == 0)
+			throw std::invalid_argument("Number of features must be positive\n");
+		if (B < 2)
+			throw std::invalid_argument("Number of bins must be at least 2\n");
+		nodes.emplace_back();
+		nodes[0].leaf = 0;
+		leaves.emplace_back();
+	}
+
+
+	// Settings: impurity of classification, examples a leaf sees between checks for a split (200 by default),
+	// probability of choosing a worse split than the best (1e-7), difference in merit below which the best
+	// split is taken anyway (0.05), maximum depth and number of leaves (unlimited), and number of examples
+	// from which the bins are set (1000), which can only be changed before learning
+	void setImpurity(char c)
+	{
+		if (c != 'e' && c != 'g')
+			throw std::invalid_argument("Impurity must be either 'e' (entropy) or 'g' (Gini)\n");
+		impurity = c;
+	}
+	void setGracePeriod(const std::size_t& g) {gracePeriod = std::max<std::size_t>(1, g);}
+	void setConfidence(const double& d)
+	{
+		if (!(d > 0 && d < 1))
+			throw std::invalid_argument("Probability of a wrong split must be in (0, 1)\n");
+		delta = d;
+	}
+	void setTieThreshold(const double& t) {tieThreshold = t;}
+	void setMaxDepth(const std::size_t& d) {maxDepth = d;}
+	void setMaxLeaves(const std::size_t& l) {maxLeaves = std::max<std::size_t>(1, l);}
+	void setWarmup(const std::size_t& w)
+	{
+		if (count > 0)
+			throw std::invalid_argument("Warm-up can only be set before learning\n");
+		warmup = std::max<std::size_t>(1, w);
+	}
+
+
+	// Learn from one example
+	void learn(const std::vector<T>& in, const U& out)
+	{
+		if (in.size() != D)
+			throw std::invalid_argument("Input has " + std::to_string(in.size()) + " features, but the tree has "
+					+ std::to_string(D) + "\n");
+		double target = 0;
+		if (task == 'c')
+		{
+			auto search = classIndex.find(out);
+			if (search == classIndex.end())
+			{
+				search = classIndex.insert(std::make_pair(out, classes.size())).first;
+				classes.push_back(out);
+			}
+			target = search->second;
+		}
+		else if constexpr (std::is_arithmetic<U>::value)
+			target = out;
+
+		++count;
+		std::size_t node = findLeaf(in);
+		widen(leaves[nodes[node].leaf]);
+		addStats(&leaves[nodes[node].leaf].stats[0], target);
+		if (!cuts.empty())
+		{
+			addToHistogram(node, in, target);
+			return;
+		}
+		buffer.push_back(in);
+		bufferTargets.push_back(target);
+		if (buffer.size() >= warmup)
+			setCuts();
+	}
+
+
+	// Learn from a mini-batch of examples, in order
+	void learn(const std::vector< std::vector<T> >& in, const std::vector<U>& out)
+	{
+		if (in.size() != out.size())
+			throw std::invalid_argument("Number of inputs (" + std::to_string(in.size()) + ") and outputs ("
+					+ std::to_string(out.size()) + ") must match\n");
+		for (std::size_t n = 0; n < in.size(); ++n)
+			learn(in[n], out[n]);
+	}
+
+
+	// Predict the output of an input from the examples learnt so far
+	U predict(const std::vector<T>& in) const
+	{
+		if (count == 0)
+			throw std::invalid_argument("Tree has not learnt from any examples\n");
+		if (in.size() != D)
+			throw std::invalid_argument("Input has " + std::to_string(in.size()) + " features, but the tree has "
+					+ std::to_string(D) + "\n");
+		return leafValue(leaves[nodes[findLeaf(in)].leaf]);
+	}
+
+
+	// Compile the current tree into a predictor, e.g. to publish a snapshot of it through a ModelHandle
+	// while the tree goes on learning
+	TreePredictor<T, U> toPredictor() const
+	{
+		if (count == 0)
+			throw std::invalid_argument("Tree has not learnt from any examples\n");
+		std::vector<typename TreePredictor<T, U>::Node> out;
+		std::vector<U> values;
+		compile(0, out, values);
+		return TreePredictor<T, U>(out, std::vector< std::vector<T> >(), values);
+	}
+
+
+	// Number of nodes, leaves, leaves which can still be split, and examples learnt
+	std::size_t nodeCount() const {return nodes.size();}
+	std::size_t leafCount() const {return leaves.size();}
+	std::size_t activeLeafCount() const
+	{
+		return std::count_if(leaves.begin(), leaves.end(), [](const Leaf& leaf) {return leaf.active;});
+	}
+	std::size_t exampleCount() const {return count;}
+
+
+	// Depth of the deepest leaf
+	std::size_t depth() const
+	{
+		std::size_t deepest = 0;
+		for (const auto& node : nodes)
+			deepest = std::max(deepest, node.depth);
+		return deepest;
+	}
+
+
+	// Classes in order of first appearance, and thresholds between the bins of each feature
+	const std::vector<U>& getClasses() const {return classes;}
+	const std::vector< std::vector<double> >& getCuts() const {return cuts;}
+
+
+	// Memory held by the tree. The examples kept until the bins are set and the thresholds count as index
+	// structures, and the statistics and histograms as leaves.
+	MemoryUsage memoryUsage() const
+	{
+		MemoryUsage usage;
+		usage.nodes = nodes.capacity() * sizeof(Node);
+		usage.leaves = leaves.capacity() * sizeof(Leaf);
+		for (const auto& leaf : leaves)
+			usage.leaves += (leaf.stats.capacity() + leaf.hist.capacity()) * sizeof(double);
+		usage.indexStructures = buffer.capacity() * sizeof(std::vector<T>) + bufferTargets.capacity() * sizeof(double);
+		for (const auto& x : buffer)
+			usage.indexStructures += x.capacity() * sizeof(T);
+		for (const auto& c : cuts)
+			usage.indexStructures += c.capacity() * sizeof(double);
+		return usage;
+	}
+
+
+};
+
+
+
+
+#endif     // _STREAMING_
@@ -6,6 +6,7 @@
 #include <algorithm>
 #include <fstream>	
 #include "trees.h"
+#include "evaluation.h"
 		
 
 // Randomly sample a percentage of nr indices and return the vector of samples as well as 
@@ -61,56 +62,95 @@ static inline std::pair< std::pair< std::vector< std::vector<T> >, std::vector<U
 
 
 
-template<typename Tr, typename T, typename U>
-static inline double classificationError(Tr tree, std::vector< std::vector<T> > testingInputs, std::vector<U> testingOutputs)
+// Generate a synthetic classification dataset of N examples with D features and C classes, which is
+// reproducible from the seed. Each class is a Gaussian cluster around a random centre, with the spread of
+// the centres scaled so that classes partly overlap whatever the number of features.
+static inline std::pair< std::vector< std::vector<double> >, std::vector<int> >
+		syntheticClassification(const std::size_t& N, const std::size_t& D, const std::size_t& C, const unsigned& seed = 0)
+{
+	std::mt19937 gen(seed);
+	std::normal_distribution<double> normal(0, 1);
+	std::uniform_int_distribution<int> distrib(0, C-1);
+	std::vector< std::vector<double> > centres(C, std::vector<double>(D)), in(N, std::vector<double>(D));
+	std::vector<int> out(N);
+	for (auto& centre : centres)
+		for (auto& x : centre)
+			x = 3 * normal(gen) / std::sqrt(D);
+	for (std::size_t n = 0; n < N; ++n)
+	{
+		out[n] = distrib(gen);
+		for (std::size_t d = 0; d < D; ++d)
+			in[n][d] = centres[out[n]][d] + normal(gen);
+	}
+	return std::make_pair(in, out);
+}
+
+
+
+// Generate a synthetic regression dataset of N examples with D features, reproducible from the seed. The
+// output is a smooth nonlinear function of the features with an interaction term and Gaussian noise.
+static inline std::pair< std::vector< std::vector<double> >, std::vector<double> >
+		syntheticRegression(const std::size_t& N, const std::size_t& D, const unsigned& seed = 0)
 {
-	U predictedOutput;
-	std::size_t nrTest = testingInputs.size();
-	std::size_t incorrect = 0;
-	for (std::size_t i = 0; i < nrTest; ++i)
+	std::mt19937 gen(seed);
+	std::normal_distribution<double> normal(0, 1);
+	std::uniform_real_distribution<double> uniform(-3, 3);
+	std::vector<double> weights(D);
+	for (auto& w : weights)
+		w = normal(gen);
+	std::vector< std::vector<double> > in(N, std::vector<double>(D));
+	std::vector<double> out(N);
+	for (std::size_t n = 0; n < N; ++n)
 	{
-		predictedOutput = tree.predict(testingInputs[i]);
-		if (predictedOutput != testingOutputs[i])
-			++incorrect;
+		for (std::size_t d = 0; d < D; ++d)
+		{
+			in[n][d] = uniform(gen);
+			out[n] += weights[d] * std::sin(in[n][d]);
+		}
+		if (D > 1)
+			out[n] += in[n][0] * in[n][1];
+		out[n] += 0.1 * normal(gen);
 	}
-	return (double) incorrect / nrTest;
+	return std::make_pair(in, out);
+}
+
+
+
+// Fraction of test examples misclassified by a model, scored in parallel batches
+template<typename Tr, typename T, typename U>
+static inline double classificationError(const Tr& tree, const std::vector< std::vector<T> >& testingInputs, const std::vector<U>& testingOutputs)
+{
+	return evaluateClassifier(tree, testingInputs, testingOutputs).error();
 }
 
 template<typename T, typename U>
-static inline double classificationError(ClassificationTree<T, U> tree, std::vector< std::vector<T> > testingInputs, std::vector<U> testingOutputs)
+static inline double classificationError(const ClassificationTree<T, U>& tree, const std::vector< std::vector<T> >& testingInputs, const std::vector<U>& testingOutputs)
 {
 	return classificationError< ClassificationTree<T, U>, T, U >(tree, testingInputs, testingOutputs);
 }
 
 template<typename T, typename U>
-static inline double classificationError(BaggedClassificationTrees<T, U> trees, std::vector< std::vector<T> > testingInputs, std::vector<U> testingOutputs)
+static inline double classificationError(const BaggedClassificationTrees<T, U>& trees, const std::vector< std::vector<T> >& testingInputs, const std::vector<U>& testingOutputs)
 {
 	return classificationError< BaggedClassificationTrees<T, U>, T, U >(trees, testingInputs, testingOutputs);
 }
 
+// Mean squared error of a model over test examples, scored in parallel batches
 template<typename Tr, typename T, typename U>
-static inline double meanSquareError(Tr tree, std::vector< std::vector<T> > testingInputs, std::vector<U> testingOutputs)
+static inline double meanSquareError(const Tr& tree, const std::vector< std::vector<T> >& testingInputs, const std::vector<U>& testingOutputs)
 {
-	U predictedOutput;
-	std::size_t nrTest = testingInputs.size();
-	double sqError = 0;
-	for (std::size_t i = 0; i < nrTest; ++i)
-	{
-		predictedOutput = tree.predict(testingInputs[i]);
-		sqError += pow(predictedOutput-testingOutputs[i], 2);
-	}
-	return (double) sqError / nrTest;
+	return evaluateRegressor(tree, testingInputs, testingOutputs).mse();
 }
 
 
 template<typename T, typename U>
-static inline double meanSquareError(RegressionTree<T, U> tree, std::vector< std::vector<T> > testingInputs, std::vector<U> testingOutputs)
+static inline double meanSquareError(const RegressionTree<T, U>& tree, const std::vector< std::vector<T> >& testingInputs, const std::vector<U>& testingOutputs)
 {
 	return meanSquareError< RegressionTree<T, U>, T, U >(tree, testingInputs, testingOutputs);
 }
 
 template<typename T, typename U>
-static inline double meanSquareError(BaggedRegressionTrees<T, U> trees, std::vector< std::vector<T> > testingInputs, std::vector<U> testingOutputs)
+static inline double meanSquareError(const BaggedRegressionTrees<T, U>& trees, const std::vector< std::vector<T> >& testingInputs, const std::vector<U>& testingOutputs)
 {
 	return meanSquareError< BaggedRegressionTrees<T, U>, T, U >(trees, testingInputs, testingOutputs);
 }
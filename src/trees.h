@@ -9,6 +9,7 @@
 #include <tuple>
 #include <map>
 #include <unordered_map>
+#include <unordered_set>
 #include <iostream>
 #include <stdexcept>
 #include <iomanip>       // std::setw
@@ -18,6 +19,10 @@
 #include <limits>        // std::numeric_limits<double>::infinity()
 #include <iterator>      // std::advance
 #include <random>        // std::random_device
+#include <queue>         // std::priority_queue
+#include "sparse.h"
+#include "profiling.h"
+#include "predictor.h"
 
 
 
@@ -30,6 +35,51 @@
 
 
 
+// Examples sorted along each feature: for each feature, the examples in increasing order of its value,
+// and the matching column of values. Trees built on the same inputs can share one set of sorted columns,
+// e.g. the trees of a cross-validation trained on different folds, so that the data is only sorted once.
+template<typename T>
+class SortedColumns
+{
+public:
+	std::vector< std::vector<std::size_t> > order;
+	std::vector< std::vector<T> > vals;
+};
+
+
+
+// Entropy ('e') or Gini ('g') impurity of a node with st[k] (weighted) examples of class k, for K classes,
+// multiplied by its number of examples
+static inline double classImpurity(const double* st, const std::size_t& K, const char& impurity)
+{
+	double count = 0, H = 0, p;
+	for (std::size_t k = 0; k < K; ++k)
+		count += st[k];
+	if (count == 0)
+		return 0;
+	for (std::size_t k = 0; k < K; ++k)
+	{
+		p = st[k] / count;
+		if (p > 0)
+			H += (impurity == 'e') ? -p * log(p) : p * (1 - p);
+	}
+	return count * H;
+}
+
+
+
+// Sum of squared deviations from the mean output of a node with statistics (number of examples, sum of
+// outputs, square sum of outputs)
+static inline double varianceImpurity(const double* st)
+{
+	if (st[0] == 0)
+		return 0;
+	return std::max(st[2] - st[1] * st[1] / st[0], 0.0);
+}
+
+
+
+
 // Abstract base class which prepares training data for decision tree construction, as well as defining
 // certain generic properties of the constructed tree
 template<typename T, typename U>
@@ -84,6 +134,17 @@ class TreeData
 	}	
 	
 	
+	// Set the dimensions of the dataset and default tree properties
+	void initialise(const std::size_t& nrExamples, const std::size_t& nrFeatures)
+	{
+		N = nrExamples; D = nrFeatures; maxDepth = N; maxLeafNodes = N; maxSplitSamples = N; subD = D;
+		features.resize(D);
+		std::iota(features.begin(), features.end(), 0);
+		selectedFeatures = features;
+		categorical.assign(D, 0);
+	}
+	
+	
 	// Create vector where each element is a vector for a given dimension. Each inner element contains the key for the 
 	// corresponding index in the indices map for that dimension, allowing us to locate a data point in the map based 
 	// on one iteration through the map at the start, instead of having to iterate the map for every new node.
@@ -116,6 +177,9 @@ protected:
 		bool leaf;
 		U val;
 		TreeNode *L = NULL, *R = NULL;
+		
+		// Sorted categories sent to the left branch, if the split is on a categorical feature
+		std::vector<T> cats;
 			
 	public:
 		// Default constructor
@@ -125,196 +189,1956 @@ protected:
 		TreeNode(std::size_t d, double sp)
 		: split(std::make_pair(d, sp)), leaf(false) {}
 		
+		// Constructor for internal node splitting a categorical feature
+		TreeNode(std::size_t d, const std::vector<T>& c)
+		: split(std::make_pair(d, 0.0)), leaf(false), cats(c) {}
+		
 		// Constructor for leaf node
 		TreeNode(U vl) : leaf(true), val(vl) {}
 		
 		// Access methods
 		void setL(TreeNode* n) {L = n;}
 		void setR(TreeNode* n) {R = n;}
+		void setVal(const U& vl) {val = vl;}
 		bool getLeaf() const {return leaf;}
 		U getVal() const {return val;}
 		TreeNode* getL() const {return L;}
 		TreeNode* getR() const {return R;}
 		std::pair<std::size_t, double> getSplit() const {return split;}
+		const std::vector<T>& getCats() const {return cats;}
+		
+		// Turn an internal node into a leaf with its current output value, deleting both of its branches
+		void makeLeaf()
+		{
+			std::vector<TreeNode*> stack{L, R};
+			while (!stack.empty())
+			{
+				TreeNode* n = stack.back();
+				stack.pop_back();
+				if (n == NULL)
+					continue;
+				stack.push_back(n->L); stack.push_back(n->R);
+				delete n;
+			}
+			leaf = true; L = NULL; R = NULL;
+			std::vector<T>().swap(cats);
+		}
+		
+		// Check whether an input value belongs in the left branch
+		bool goesLeft(const T& x) const
+		{
+			if (cats.empty())
+				return x < split.second;
+			return std::binary_search(cats.begin(), cats.end(), x);
+		}
+		
+		// Display information about node
+		void display() const 
+		{
+			std::cout << std::setw(20) << "Leaf? ";
+			if (leaf)
+			{
+				std::cout << "Yes\n";
+				std::cout << std::setw(20) << "Output: " << val << '\n';
+			}
+			else
+			{
+				std::cout << "No\n";
+				std::cout << std::setw(20) << "Split dimension: " << split.first << '\n';
+				if (cats.empty())
+					std::cout << std::setw(20) << "Split value: " << split.second << '\n';
+				else
+				{
+					std::cout << std::setw(20) << "Left categories: ";
+					for (const T& c : cats)
+						std::cout << c << ' ';
+					std::cout << '\n';
+				}
+			}
+			std::cout << "   -----------------------\n";
+			if (R != NULL)
+				R->display();
+			if (L != NULL)
+				L->display();
+		}
+	};
+	
+	
+	// Node of the array compiled from the tree for prediction. The child taken most often during calibration
+	// directly follows its parent in the array, and 'next' is the position of the other child.
+	class FlatNode
+	{
+	public:
+		std::size_t d, next;
+		double split;
+		const std::vector<T>* cats;
+		U val;
+		bool leaf, hotLeft;
+	};
+
+
+
+
+	// METHODS
+
+	// Predict an output by walking the compiled node array, for a dense or sparse input
+	static T featureValue(const std::vector<T>& in, const std::size_t& d) {return in[d];}
+	static T featureValue(const std::vector< std::pair<std::size_t, T> >& in, const std::size_t& d) {return sparseValue(in, d);}
+	template<typename X>
+	U predictLayout(const X& in) const
+	{
+		std::size_t i = 0;
+		while (!layout[i].leaf)
+		{
+			const FlatNode& f = layout[i];
+			T x = featureValue(in, f.d);
+			bool left = f.cats == nullptr ? x < f.split : std::binary_search(f.cats->begin(), f.cats->end(), x);
+			i = left == f.hotLeft ? i + 1 : f.next;
+		}
+		return layout[i].val;
+	}
+	
+
+	// Create all possible splits between N data points in D dimensions
+	std::map< std::size_t, std::vector<double> > createSplits(const std::vector< std::map< std::size_t, std::set< std::size_t> > >& inds) const	
+	{	
+		std::size_t s;
+		std::map< std::size_t, std::vector<double> > splits;
+		
+		for (auto ftr : selectedFeatures)
+		{
+			splits[ftr] = std::vector<double>(inds[ftr].size()-1);
+			auto it = inds[ftr].begin();
+			s = 0;
+			while (it->first != inds[ftr].rbegin()->first)
+				splits[ftr][s++] = ((double)inputs[ *(it->second.begin()) ][ftr]
+								+ (double)inputs[ *((++it)->second.begin()) ][ftr]) / 2;
+		}
+		return splits;
+	}
+	
+	
+	// Compare current value to minimum and reassign minimum value and location if necessary
+	void compare(const double& current, double& minVal, 
+				std::pair<std::size_t, std::size_t>& min, const std::size_t& d, std::size_t& s) const
+	{
+		if (current < minVal)
+		{
+			minVal = current;
+			min.first = d; 
+			min.second = s;
+		}
+	}
+	
+	
+	// Check if all input points are identical (implying repeated or conflicting data)
+	bool identicalInputs(const std::vector< std::map< std::size_t, std::set< std::size_t> > >& inds) const
+	{
+		std::size_t equal = 0;
+		for (auto ftr : inds)
+		{
+			if (ftr.size() > 1)
+				break;
+			++equal;
+		}
+		if (equal == D)
+			return true;
+		return false;
+	}
+	
+
+	// Random number generator for one build, seeded from std::random_device unless a seed has been set.
+	// With a seed, each build draws a different but reproducible sequence.
+	std::mt19937 generator()
+	{
+		if (!seeded)
+		{
+			std::random_device rd;
+			return std::mt19937(rd());
+		}
+		std::seed_seq seq{seed, (unsigned)generators++};
+		return std::mt19937(seq);
+	}
+
+
+	// Implement random feature selection
+	void randomFeatures(const std::vector< std::map< std::size_t, std::set< std::size_t> > >& inds)
+	{
+		// Identify set of useful features, meaning features on which at least one split is possible
+		std::vector<std::size_t> usefulFtrs;
+		for (std::size_t d = 0; d < D; ++d)
+			if (inds[d].size() > 1)
+				usefulFtrs.push_back(d);
+		
+		std::size_t nrUselessFtrs = D - usefulFtrs.size();
+		if (subD <= nrUselessFtrs)
+			selectedFeatures = usefulFtrs;
+		else
+		{
+			std::vector<std::size_t> copy = usefulFtrs;
+			std::mt19937 gen = generator();
+			std::shuffle(copy.begin(), copy.end(), gen);
+			copy.erase(copy.begin()+subD, copy.end());
+			selectedFeatures = copy;
+		}
+	}
+
+
+	// Sort the training examples along each dimension, unless this has already been done. Sorting is
+	// deferred until a tree is built, since extremely randomised trees do not need it.
+	void presort()
+	{
+		if (pntLocator.empty() && !sparse)
+		{
+			PROFILE_PHASE(PRESORT);
+			indicesTable();
+			locatePnts();
+			PROFILE_COUNT(bytes, 2 * N * D * sizeof(std::size_t));
+		}
+	}
+
+
+	// Sort the examples into a row order and a matching column of values for each feature, so that a
+	// feature can be swept sequentially from its smallest to its largest value. Each column is sorted
+	// directly, without the index maps of depth-first growth, which take several times more memory. For
+	// sparse inputs, the columns only hold the stored entries.
+	void sortedColumns(std::vector< std::vector<std::size_t> >& order, std::vector< std::vector<T> >& vals)
+	{
+		order.resize(D); vals.resize(D);
+		if (sparse)
+		{
+			// Only the stored entries of a sparse matrix are sorted, leaving out its implicit zeros
+			PROFILE_PHASE(PRESORT);
+			PROFILE_COUNT(bytes, sparseInputs.nonZeros() * (sizeof(std::size_t) + sizeof(T)));
+			auto columns = sparseInputs.byColumn();
+			for (auto ftr : features)
+			{
+				std::stable_sort(columns[ftr].begin(), columns[ftr].end(),
+					[](const std::pair<std::size_t, T>& e1, const std::pair<std::size_t, T>& e2) {return e1.second < e2.second;});
+				for (const auto& e : columns[ftr])
+				{
+					order[ftr].push_back(e.first);
+					vals[ftr].push_back(e.second);
+				}
+			}
+			return;
+		}
+		
+		PROFILE_PHASE(PRESORT);
+		PROFILE_COUNT(bytes, N * features.size() * (sizeof(std::size_t) + sizeof(T)));
+		std::vector<T> column(N);
+		for (auto ftr : features)
+		{
+			for (std::size_t n = 0; n < N; ++n)
+				column[n] = inputs[n][ftr];
+			order[ftr] = sortIndices(column);
+			vals[ftr].resize(N);
+			for (std::size_t n = 0; n < N; ++n)
+				vals[ftr][n] = column[order[ftr][n]];
+		}
+	}
+
+
+	// Copy the stored entries of each column of sparse inputs in row order, without sorting them, for the
+	// passes which read whole columns but do not sweep them in order
+	void storedColumns(std::vector< std::vector<std::size_t> >& order, std::vector< std::vector<T> >& vals) const
+	{
+		order.resize(D); vals.resize(D);
+		auto columns = sparseInputs.byColumn();
+		for (auto ftr : features)
+			for (const auto& e : columns[ftr])
+			{
+				order[ftr].push_back(e.first);
+				vals[ftr].push_back(e.second);
+			}
+	}
+
+
+	// Free the index maps of depth-first growth, which are consumed while the tree is built
+	void releaseIndices()
+	{
+		std::vector< std::map< std::size_t, std::set< std::size_t> > >().swap(indices);
+		std::vector< std::vector<std::size_t> >().swap(pntLocator);
+	}
+
+
+	// Whether training example n is used to build the tree, i.e. selected by the row mask if there is one
+	bool included(const std::size_t& n) const
+	{
+		return rowMask.empty() || rowMask[n];
+	}
+
+
+	// Value of feature splitOf[k] for every training example n of node k = nodeOf[n], where splitOf[k] = D for
+	// a node which is not split. Sparse inputs are read through their columns: every example is zero unless
+	// it has a stored entry for the feature, so only the stored entries of the features split on are visited.
+	std::vector<T> splitValues(const SortedColumns<T>& columns, const std::vector<std::size_t>& nodeOf,
+			const std::vector<std::size_t>& splitOf) const
+	{
+		const std::size_t none = std::numeric_limits<std::size_t>::max();
+		std::vector<T> x(N, T(0));
+		if (!sparse)
+		{
+			for (std::size_t n = 0; n < N; ++n)
+				if (nodeOf[n] != none && splitOf[nodeOf[n]] < D)
+					x[n] = inputs[n][splitOf[nodeOf[n]]];
+			return x;
+		}
+		std::vector<char> used(D, 0);
+		for (const std::size_t& d : splitOf)
+			if (d < D)
+				used[d] = 1;
+		for (auto ftr : features)
+			if (used[ftr])
+				for (std::size_t i = 0; i < columns.order[ftr].size(); ++i)
+				{
+					std::size_t n = columns.order[ftr][i];
+					if (nodeOf[n] != none && splitOf[nodeOf[n]] == ftr)
+						x[n] = columns.vals[ftr][i];
+				}
+		return x;
+	}
+
+
+	// Weighted impurity of splitting a node with statistics 'tot' into 'left' and the remainder
+	double splitScore(const double* left, const double* tot, std::vector<double>& right) const
+	{
+		PROFILE_COUNT(thresholds, 1);
+		for (std::size_t w = 0; w < right.size(); ++w)
+			right[w] = tot[w] - left[w];
+		return nodeImpurity(left) + nodeImpurity(&right[0]);
+	}
+
+
+	// Choose the feature to split on, given the best split score found along each feature. Only features
+	// with a valid split are considered, restricted to a random selection of subD of them when random
+	// feature selection is in use. Returns D if no split is possible.
+	std::size_t pickFeature(const double* scores, std::mt19937& gen) const
+	{
+		std::vector<std::size_t> useful;
+		for (auto ftr : features)
+			if (scores[ftr] < std::numeric_limits<double>::infinity())
+				useful.push_back(ftr);
+		if (subD < useful.size())
+		{
+			std::shuffle(useful.begin(), useful.end(), gen);
+			useful.erase(useful.begin()+subD, useful.end());
+			std::sort(useful.begin(), useful.end());
+		}
+
+		std::size_t d = D;
+		for (auto ftr : useful)
+			if (d == D || scores[ftr] < scores[d])
+				d = ftr;
+		return d;
+	}
+
+
+	// Attach a newly created node to its parent, or make it the top of the tree if it has no parent
+	void attach(TreeNode* parent, bool right, TreeNode* node, TreeNode*& top) const
+	{
+		PROFILE_COUNT(nodes, 1);
+		PROFILE_COUNT(leaves, node->getLeaf());
+		if (parent == NULL)
+			top = node;
+		else if (right)
+			parent->setR(node);
+		else
+			parent->setL(node);
+	}
+
+
+	// Find the best subset split of a categorical feature, given the statistics of each category present
+	// in a node. Categories are ordered by their target statistic and each prefix of that order is scored
+	// as the left branch, which finds the optimal subset for regression and two classes (Fisher, 1958)
+	// with a single scan. Extremely randomised trees instead send each category to a random side.
+	double categorySplit(std::vector< std::pair< T, std::vector<double> > >& cats, const double* tot,
+			std::vector<T>& leftCats, std::mt19937& gen) const
+	{
+		const std::size_t C = cats.size();
+		std::vector<double> left(statWidth(), 0), right(statWidth());
+		leftCats.clear();
+		if (C < 2)
+			return std::numeric_limits<double>::infinity();
+
+		std::vector<std::size_t> order(C);
+		std::iota(order.begin(), order.end(), 0);
+		std::size_t nrLeft = 0;
+		if (extraTrees)
+		{
+			std::shuffle(order.begin(), order.end(), gen);
+			std::uniform_int_distribution<std::size_t> distrib(1, C-1);
+			nrLeft = distrib(gen);
+		}
+		else
+		{
+			std::vector<double> key(C);
+			for (std::size_t c = 0; c < C; ++c)
+				key[c] = categoryKey(&cats[c].second[0], tot);
+			std::stable_sort(order.begin(), order.end(),
+				[&key](std::size_t c1, std::size_t c2) {return key[c1] < key[c2];});
+
+			double minVal = std::numeric_limits<double>::infinity();
+			for (std::size_t c = 0; c+1 < C; ++c)
+			{
+				for (std::size_t w = 0; w < left.size(); ++w)
+					left[w] += cats[order[c]].second[w];
+				double current = splitScore(&left[0], tot, right);
+				if (current < minVal)
+				{
+					minVal = current;
+					nrLeft = c+1;
+				}
+			}
+			std::fill(left.begin(), left.end(), 0);
+		}
+
+		for (std::size_t c = 0; c < nrLeft; ++c)
+		{
+			leftCats.push_back(cats[order[c]].first);
+			for (std::size_t w = 0; w < left.size(); ++w)
+				left[w] += cats[order[c]].second[w];
+		}
+		std::sort(leftCats.begin(), leftCats.end());
+		return splitScore(&left[0], tot, right);
+	}
+
+
+	// Draw a random threshold for each feature, uniformly between the smallest and largest value among
+	// a node's examples. Only a random selection of subD features with distinct values is used.
+	void randomThresholds(const double* lo, const double* hi, double* splits, char* drawn, std::mt19937& gen) const
+	{
+		std::vector<std::size_t> useful;
+		for (auto ftr : features)
+		{
+			drawn[ftr] = 0;
+			if (lo[ftr] < hi[ftr])
+				useful.push_back(ftr);
+		}
+		if (subD < useful.size())
+		{
+			std::shuffle(useful.begin(), useful.end(), gen);
+			useful.erase(useful.begin()+subD, useful.end());
+		}
+		for (auto ftr : useful)
+		{
+			std::uniform_real_distribution<double> distrib(lo[ftr], hi[ftr]);
+			splits[ftr] = distrib(gen);
+			drawn[ftr] = 1;
+		}
+	}
+
+
+	// Score random thresholds for every open node of a level (extremely randomised trees). Each feature
+	// needs one pass over the examples in their original order to find the range of every node, and
+	// one more to accumulate the statistics left of the threshold, so no sorting is required. Sparse
+	// inputs are read through their columns, visiting only the stored entries: the other examples of a
+	// node are zero, and their statistics are those of the node minus those of its stored entries.
+	void randomLevelSplits(const SortedColumns<T>& columns, const std::vector<std::size_t>& nodeOf,
+			const std::vector<double>& stats, std::vector<double>& bestScore, std::vector<double>& bestSplit,
+			std::vector< std::vector<T> >& bestCats, std::mt19937& gen) const
+	{
+		const std::size_t W = statWidth(), K = stats.size() / W, none = std::numeric_limits<std::size_t>::max();
+		const double inf = std::numeric_limits<double>::infinity();
+		std::vector<double> lo(K*D, inf), hi(K*D, -inf), left(K*W), right(W);
+		std::vector<char> drawn(K*D);
+		if (sparse)
+		{
+			// A node whose examples do not all have a stored entry for a feature also holds zero
+			std::vector<std::size_t> size(K, 0), stored(K*D, 0);
+			for (std::size_t n = 0; n < N; ++n)
+				if (nodeOf[n] != none)
+					++size[nodeOf[n]];
+			for (auto ftr : features)
+				for (std::size_t i = 0; i < columns.order[ftr].size(); ++i)
+				{
+					std::size_t k = nodeOf[columns.order[ftr][i]];
+					if (k == none)
+						continue;
+					double x = columns.vals[ftr][i];
+					lo[k*D + ftr] = std::min(lo[k*D + ftr], x);
+					hi[k*D + ftr] = std::max(hi[k*D + ftr], x);
+					++stored[k*D + ftr];
+				}
+			for (std::size_t k = 0; k < K; ++k)
+				for (auto ftr : features)
+					if (stored[k*D + ftr] < size[k])
+					{
+						lo[k*D + ftr] = std::min(lo[k*D + ftr], 0.0);
+						hi[k*D + ftr] = std::max(hi[k*D + ftr], 0.0);
+					}
+		}
+		else
+			for (std::size_t n = 0; n < N; ++n)
+				if (nodeOf[n] != none)
+					for (auto ftr : features)
+					{
+						double x = inputs[n][ftr];
+						std::size_t i = nodeOf[n]*D + ftr;
+						lo[i] = std::min(lo[i], x);
+						hi[i] = std::max(hi[i], x);
+					}
+		for (std::size_t k = 0; k < K; ++k)
+			randomThresholds(&lo[k*D], &hi[k*D], &bestSplit[k*D], &drawn[k*D], gen);
+
+		for (auto ftr : features)
+		{
+			if (categorical[ftr])
+			{
+				std::vector< std::map< T, std::vector<double> > > cats(K);
+				if (sparse)
+				{
+					std::vector<double> zeros = stats;
+					for (std::size_t i = 0; i < columns.order[ftr].size(); ++i)
+					{
+						std::size_t n = columns.order[ftr][i], k = nodeOf[n];
+						if (k == none || !drawn[k*D + ftr])
+							continue;
+						std::vector<double>& st = cats[k][columns.vals[ftr][i]];
+						st.resize(W);
+						addStats(&st[0], n, 1);
+						addStats(&zeros[k*W], n, -1);
+					}
+					for (std::size_t k = 0; k < K; ++k)
+						if (drawn[k*D + ftr] && statCount(&zeros[k*W]) > 0.5)
+						{
+							std::vector<double>& st = cats[k][T(0)];
+							st.resize(W);
+							for (std::size_t w = 0; w < W; ++w)
+								st[w] += zeros[k*W + w];
+						}
+				}
+				else
+					for (std::size_t n = 0; n < N; ++n)
+					{
+						std::size_t k = nodeOf[n];
+						if (k == none || !drawn[k*D + ftr])
+							continue;
+						std::vector<double>& st = cats[k][inputs[n][ftr]];
+						st.resize(W);
+						addStats(&st[0], n, 1);
+					}
+				for (std::size_t k = 0; k < K; ++k)
+					if (drawn[k*D + ftr])
+					{
+						std::vector< std::pair< T, std::vector<double> > > list(cats[k].begin(), cats[k].end());
+						bestScore[k*D + ftr] = categorySplit(list, &stats[k*W], bestCats[k*D + ftr], gen);
+					}
+				continue;
+			}
+
+			std::fill(left.begin(), left.end(), 0);
+			if (sparse)
+			{
+				// Start from the side the zeros of each node go to, and move the stored entries which go
+				// to the other side
+				for (std::size_t k = 0; k < K; ++k)
+					if (drawn[k*D + ftr] && 0 < bestSplit[k*D + ftr])
+						std::copy(stats.begin() + k*W, stats.begin() + (k+1)*W, left.begin() + k*W);
+				for (std::size_t i = 0; i < columns.order[ftr].size(); ++i)
+				{
+					std::size_t n = columns.order[ftr][i], k = nodeOf[n];
+					if (k == none || !drawn[k*D + ftr])
+						continue;
+					bool goesLeft = columns.vals[ftr][i] < bestSplit[k*D + ftr];
+					if (goesLeft != (0 < bestSplit[k*D + ftr]))
+						addStats(&left[k*W], n, goesLeft ? 1 : -1);
+				}
+			}
+			else
+				for (std::size_t n = 0; n < N; ++n)
+				{
+					std::size_t k = nodeOf[n];
+					if (k != none && drawn[k*D + ftr] && inputs[n][ftr] < bestSplit[k*D + ftr])
+						addStats(&left[k*W], n, 1);
+				}
+			for (std::size_t k = 0; k < K; ++k)
+				if (drawn[k*D + ftr] && statCount(&left[k*W]) > 0 && statCount(&left[k*W]) < statCount(&stats[k*W]))
+					bestScore[k*D + ftr] = splitScore(&left[k*W], &stats[k*W], right);
+		}
+	}
+
+
+	// Grow the tree one depth at a time. All open nodes of a level are handled together: every feature
+	// column is swept once in sorted order while a row-to-node assignment routes each row's statistics
+	// to its own node, so each level costs D sequential passes instead of separate passes per node.
+	TreeNode* levelWise()
+	{
+		SortedColumns<T> sorted;
+		if (!extraTrees && presorted == NULL)
+			sortedColumns(sorted.order, sorted.vals);
+		else if (sparse && presorted == NULL)
+			storedColumns(sorted.order, sorted.vals);
+		const SortedColumns<T>* columns = presorted ? presorted : &sorted;
+		std::size_t columnRows = N;
+
+		const std::size_t W = statWidth(), none = std::numeric_limits<std::size_t>::max();
+		const double inf = std::numeric_limits<double>::infinity();
+		std::mt19937 gen = generator();
+
+		// Open nodes on the current level, described by their statistics, parent and side of the parent.
+		// Rows left out by the row mask are never assigned to a node.
+		std::vector<std::size_t> nodeOf(N, 0);
+		std::vector<double> stats(W, 0);
+		for (std::size_t n = 0; n < N; ++n)
+			if (included(n))
+				addStats(&stats[0], n, 1);
+			else
+				nodeOf[n] = none;
+		std::vector<TreeNode*> parents{NULL};
+		std::vector<bool> sides{false};
+
+		TreeNode* top = NULL;
+		std::vector<double> right(W);
+		for (std::size_t lvl = 0; !parents.empty(); ++lvl)
+		{
+			std::size_t K = parents.size();
+			PROFILE_PHASE(LEAVES);
+
+			// Close nodes which satisfy a stopping criterion, and remove their rows from the sweep
+			std::vector<bool> open(K);
+			for (std::size_t k = 0; k < K; ++k)
+				open[k] = statCount(&stats[k*W]) > minLeafSize && lvl < maxDepth && nodeImpurity(&stats[k*W]) > 0;
+			std::vector<std::size_t> size(K, 0);
+			for (std::size_t n = 0; n < N; ++n)
+				if (nodeOf[n] != none && !open[nodeOf[n]])
+					nodeOf[n] = none;
+				else if (nodeOf[n] != none)
+					++size[nodeOf[n]];
+
+			// Once most rows in the columns have left the sweep, keep only the entries of the rows still in
+			// it, so that deep levels with few open rows, or a row mask selecting few rows, sweep less
+			std::size_t active = std::accumulate(size.begin(), size.end(), std::size_t(0));
+			if (!extraTrees && 2 * active < columnRows)
+			{
+				SortedColumns<T> kept;
+				kept.order.resize(D); kept.vals.resize(D);
+				for (auto ftr : features)
+				{
+					const auto& r = columns->order[ftr];
+					for (std::size_t i = 0; i < r.size(); ++i)
+						if (nodeOf[r[i]] != none)
+						{
+							kept.order[ftr].push_back(r[i]);
+							kept.vals[ftr].push_back(columns->vals[ftr][i]);
+						}
+				}
+				sorted = std::move(kept);
+				columns = &sorted;
+				columnRows = active;
+			}
+			const auto& order = columns->order;
+			const auto& vals = columns->vals;
+
+			// Nodes with more than maxSplitSamples examples estimate their split from a random subsample
+			// of that size, drawn by selection sampling in one pass
+			PROFILE_NEXT(CHOOSE_SPLIT);
+			std::vector<std::size_t> searchNode = nodeOf;
+			std::vector<double> searchStats = stats;
+			bool sampling = false;
+			for (std::size_t k = 0; k < K; ++k)
+				if (size[k] > maxSplitSamples)
+				{
+					sampling = true;
+					std::fill(searchStats.begin() + k*W, searchStats.begin() + (k+1)*W, 0);
+				}
+			if (sampling)
+			{
+				std::vector<std::size_t> needed(K, maxSplitSamples), remaining = size;
+				for (std::size_t n = 0; n < N; ++n)
+				{
+					std::size_t k = nodeOf[n];
+					if (k == none || size[k] <= maxSplitSamples)
+						continue;
+					std::uniform_int_distribution<std::size_t> distrib(0, remaining[k]-1);
+					if (distrib(gen) < needed[k])
+					{
+						--needed[k];
+						addStats(&searchStats[k*W], n, 1);
+					}
+					else
+						searchNode[n] = none;
+					--remaining[k];
+				}
+			}
+
+			// Sweep each feature column, scoring a threshold whenever a node sees a new value, or score
+			// random thresholds for extremely randomised trees
+			std::vector<double> bestScore(K*D, inf), bestSplit(K*D), left(K*W);
+			std::vector< std::vector<T> > bestCats(K*D);
+			std::vector< std::vector< std::pair< T, std::vector<double> > > > cats(K);
+			std::vector<T> last(K);
+			std::vector<bool> seen(K);
+			if (extraTrees)
+				randomLevelSplits(*columns, searchNode, searchStats, bestScore, bestSplit, bestCats, gen);
+			else
+				for (auto ftr : features)
+				{
+					std::fill(left.begin(), left.end(), 0);
+					std::fill(seen.begin(), seen.end(), false);
+
+					// Register a new value v arriving at node k, and return the statistics it is added to.
+					// Examples of a categorical feature are collected per category, which come in runs.
+					auto arrive = [&](std::size_t k, const T& v) -> double*
+					{
+						double* st = &left[k*W];
+						if (categorical[ftr])
+						{
+							if (!seen[k] || v != last[k])
+								cats[k].push_back(std::make_pair(v, std::vector<double>(W, 0)));
+							st = &cats[k].back().second[0];
+						}
+						else if (seen[k] && v != last[k])
+						{
+							double current = splitScore(&left[k*W], &searchStats[k*W], right);
+							if (current < bestScore[k*D + ftr])
+							{
+								bestScore[k*D + ftr] = current;
+								bestSplit[k*D + ftr] = ((double)last[k] + (double)v) / 2;
+							}
+						}
+						last[k] = v; seen[k] = true;
+						return st;
+					};
+
+					// The implicit zeros of a sparse column form a single run for each node, whose statistics
+					// are those of the node minus those of its stored entries
+					std::vector<double> zeros;
+					if (sparse)
+					{
+						zeros = searchStats;
+						for (std::size_t i = 0; i < order[ftr].size(); ++i)
+							if (searchNode[order[ftr][i]] != none)
+								addStats(&zeros[searchNode[order[ftr][i]]*W], order[ftr][i], -1);
+					}
+
+					for (std::size_t i = 0; i <= order[ftr].size(); ++i)
+					{
+						if (!zeros.empty() && (i == order[ftr].size() || vals[ftr][i] > T(0)))
+						{
+							for (std::size_t k = 0; k < K; ++k)
+								if (statCount(&zeros[k*W]) > 0.5)
+								{
+									double* st = arrive(k, T(0));
+									for (std::size_t w = 0; w < W; ++w)
+										st[w] += zeros[k*W + w];
+								}
+							zeros.clear();
+						}
+						if (i == order[ftr].size())
+							break;
+
+						std::size_t n = order[ftr][i], k = searchNode[n];
+						if (k != none)
+							addStats(arrive(k, vals[ftr][i]), n, 1);
+					}
+
+					if (categorical[ftr])
+						for (std::size_t k = 0; k < K; ++k)
+						{
+							bestScore[k*D + ftr] = categorySplit(cats[k], &searchStats[k*W], bestCats[k*D + ftr], gen);
+							cats[k].clear();
+						}
+				}
+
+			// Create the nodes of this level, choosing each split among the (randomly selected) useful features
+			PROFILE_NEXT(LEAVES);
+			std::vector<TreeNode*> nextParents;
+			std::vector<bool> nextSides;
+			std::vector<std::size_t> child(K, none), dSplit(K);
+			std::vector<TreeNode*> nodes(K);
+			for (std::size_t k = 0; k < K; ++k)
+			{
+				dSplit[k] = open[k] ? pickFeature(&bestScore[k*D], gen) : D;
+				if (dSplit[k] == D)
+				{
+					attach(parents[k], sides[k], new TreeNode(leafValue(&stats[k*W])), top);
+					continue;
+				}
+				TreeNode* node = categorical[dSplit[k]] ? new TreeNode(dSplit[k], bestCats[k*D + dSplit[k]])
+									: new TreeNode(dSplit[k], bestSplit[k*D + dSplit[k]]);
+				nodes[k] = node;
+				attach(parents[k], sides[k], node, top);
+				child[k] = nextParents.size();
+				nextParents.push_back(node); nextSides.push_back(false);
+				nextParents.push_back(node); nextSides.push_back(true);
+			}
+
+			// Route each row to its child on the next level, accumulating the children's statistics. Rows of
+			// sparse inputs take the side of zero unless they have a stored entry for the feature split on.
+			PROFILE_NEXT(SPLIT_INDICES);
+			std::vector<T> x;
+			if (sparse)
+				x = splitValues(*columns, nodeOf, dSplit);
+			std::vector<double> nextStats(nextParents.size()*W, 0);
+			for (std::size_t n = 0; n < N; ++n)
+			{
+				std::size_t k = nodeOf[n];
+				if (k == none)
+					continue;
+				if (child[k] == none)
+				{
+					nodeOf[n] = none;
+					continue;
+				}
+				nodeOf[n] = child[k] + (nodes[k]->goesLeft(sparse ? x[n] : inputs[n][dSplit[k]]) ? 0 : 1);
+				addStats(&nextStats[nodeOf[n]*W], n, 1);
+				PROFILE_COUNT(rowsMoved, 1);
+			}
+
+			stats.swap(nextStats);
+			parents.swap(nextParents);
+			sides.swap(nextSides);
+		}
+		return top;
+	}
+
+
+	// A leaf of a partially grown tree which may still be split, holding its examples sorted along each
+	// feature and the best split found for it
+	class OpenNode
+	{
+	public:
+		std::vector< std::vector<std::size_t> > rows;
+		std::vector<double> stats;
+		std::vector<T> cats;
+		std::size_t depth, d;
+		double split, gain;
+		TreeNode* parent;
+		bool right;
+	};
+
+
+	// Find the best split of an open node by sweeping its sorted examples along each feature, and store
+	// the reduction in impurity it achieves (negative if the node cannot be split). For a node with more
+	// than maxSplitSamples examples, the split is estimated from a random subsample of that size, and
+	// the remaining examples are flagged in 'skip' while searching.
+	void evaluateNode(OpenNode& nd, std::vector<char>& skip, std::mt19937& gen) const
+	{
+		PROFILE_PHASE(CHOOSE_SPLIT);
+		const std::size_t W = statWidth();
+		std::vector<double> scores(D, std::numeric_limits<double>::infinity()), splits(D), left(W), right(W);
+		std::vector< std::vector<T> > leftCats(D);
+		std::vector< std::pair< T, std::vector<double> > > cats;
+		double impurity = nodeImpurity(&nd.stats[0]);
+		nd.gain = -1;
+		if (statCount(&nd.stats[0]) <= minLeafSize || nd.depth >= maxDepth || impurity <= 0)
+			return;
+
+		std::vector<double> tot = nd.stats;
+		std::vector<std::size_t> sample;
+		if (nd.rows[0].size() > maxSplitSamples)
+		{
+			std::sample(nd.rows[0].begin(), nd.rows[0].end(), std::back_inserter(sample), maxSplitSamples, gen);
+			std::fill(tot.begin(), tot.end(), 0);
+			for (const std::size_t& n : nd.rows[0])
+				skip[n] = 1;
+			for (const std::size_t& n : sample)
+			{
+				skip[n] = 0;
+				addStats(&tot[0], n, 1);
+			}
+		}
+
+		if (extraTrees)
+		{
+			std::vector<double> lo(D, scores[0]), hi(D, -scores[0]);
+			std::vector<char> drawn(D);
+			for (const std::size_t& n : nd.rows[0])
+				if (!skip[n])
+					for (auto ftr : features)
+					{
+						lo[ftr] = std::min(lo[ftr], (double)inputs[n][ftr]);
+						hi[ftr] = std::max(hi[ftr], (double)inputs[n][ftr]);
+					}
+			randomThresholds(&lo[0], &hi[0], &splits[0], &drawn[0], gen);
+			for (auto ftr : features)
+				if (drawn[ftr] && categorical[ftr])
+				{
+					std::map< T, std::vector<double> > cat;
+					for (const std::size_t& n : nd.rows[0])
+						if (!skip[n])
+						{
+							std::vector<double>& st = cat[inputs[n][ftr]];
+							st.resize(W);
+							addStats(&st[0], n, 1);
+						}
+					cats.assign(cat.begin(), cat.end());
+					scores[ftr] = categorySplit(cats, &tot[0], leftCats[ftr], gen);
+				}
+				else if (drawn[ftr])
+				{
+					std::fill(left.begin(), left.end(), 0);
+					for (const std::size_t& n : nd.rows[0])
+						if (!skip[n] && inputs[n][ftr] < splits[ftr])
+							addStats(&left[0], n, 1);
+					if (statCount(&left[0]) > 0 && statCount(&left[0]) < statCount(&tot[0]))
+						scores[ftr] = splitScore(&left[0], &tot[0], right);
+				}
+		}
+		else
+			for (auto ftr : features)
+			{
+				const std::vector<std::size_t>& r = nd.rows[ftr];
+				std::fill(left.begin(), left.end(), 0);
+				cats.clear();
+				std::size_t prev = N;
+				for (std::size_t i = 0; i < r.size(); ++i)
+				{
+					if (skip[r[i]])
+						continue;
+					if (categorical[ftr])
+					{
+						if (prev == N || inputs[r[i]][ftr] != inputs[prev][ftr])
+							cats.push_back(std::make_pair(inputs[r[i]][ftr], std::vector<double>(W, 0)));
+						addStats(&cats.back().second[0], r[i], 1);
+					}
+					else if (prev < N && inputs[r[i]][ftr] != inputs[prev][ftr])
+					{
+						double current = splitScore(&left[0], &tot[0], right);
+						if (current < scores[ftr])
+						{
+							scores[ftr] = current;
+							splits[ftr] = ((double)inputs[prev][ftr] + (double)inputs[r[i]][ftr]) / 2;
+						}
+					}
+					addStats(&left[0], r[i], 1);
+					prev = r[i];
+				}
+				if (categorical[ftr])
+					scores[ftr] = categorySplit(cats, &tot[0], leftCats[ftr], gen);
+			}
+		if (!sample.empty())
+			for (const std::size_t& n : nd.rows[0])
+				skip[n] = 0;
+
+		// Scale the impurity reduction of a subsample up to the whole node
+		nd.d = pickFeature(&scores[0], gen);
+		if (nd.d < D)
+		{
+			nd.split = splits[nd.d];
+			nd.cats = leftCats[nd.d];
+			nd.gain = (nodeImpurity(&tot[0]) - scores[nd.d]) * statCount(&nd.stats[0]) / statCount(&tot[0]);
+		}
+	}
+
+
+	// Grow the tree best-first: open leaves wait in a priority queue ordered by the impurity reduction of
+	// their best split, and the best one is split until maxLeafNodes leaves exist. Examples stay sorted
+	// along each feature by stable partitioning, so no recursion or re-sorting is needed.
+	TreeNode* bestFirst()
+	{
+		std::vector< std::vector<T> > vals;
+		std::mt19937 gen = generator();
+		std::vector<OpenNode> open(1);
+		std::priority_queue< std::pair<double, std::size_t> > queue;
+		std::vector<char> side(N), skip(N, 0);
+		TreeNode* top = NULL;
+
+		// Queue a new open node if it can be split, otherwise make it a leaf straight away
+		auto push = [&](std::size_t id)
+		{
+			evaluateNode(open[id], skip, gen);
+			if (open[id].gain >= 0)
+				queue.push(std::make_pair(open[id].gain, id));
+			else
+			{
+				attach(open[id].parent, open[id].right, new TreeNode(leafValue(&open[id].stats[0])), top);
+				std::vector< std::vector<std::size_t> >().swap(open[id].rows);
+			}
+		};
+
+		open[0].stats.assign(statWidth(), 0);
+		for (std::size_t n = 0; n < N; ++n)
+			if (included(n))
+				addStats(&open[0].stats[0], n, 1);
+		if (presorted)
+			open[0].rows = presorted->order;
+		else
+			sortedColumns(open[0].rows, vals);
+		if (!rowMask.empty())
+			for (auto& r : open[0].rows)
+				r.erase(std::remove_if(r.begin(), r.end(), [&](const std::size_t& n) {return !included(n);}), r.end());
+		open[0].depth = 0; open[0].parent = NULL; open[0].right = false;
+		push(0);
+
+		std::size_t leaves = 1;
+		while (!queue.empty() && leaves < maxLeafNodes)
+		{
+			std::size_t id = queue.top().second;
+			queue.pop();
+			TreeNode* node = categorical[open[id].d] ? new TreeNode(open[id].d, open[id].cats)
+								: new TreeNode(open[id].d, open[id].split);
+			attach(open[id].parent, open[id].right, node, top);
+			++leaves;
+
+			// Partition the examples of the node, preserving their sorted order along every feature
+			PROFILE_PHASE(SPLIT_INDICES);
+			PROFILE_COUNT(rowsMoved, open[id].rows[0].size());
+			for (const std::size_t& n : open[id].rows[0])
+				side[n] = node->goesLeft(inputs[n][open[id].d]) ? 0 : 1;
+			open.resize(open.size()+2);
+			OpenNode& nd = open[id];
+			for (std::size_t c = 0; c < 2; ++c)
+			{
+				OpenNode& ch = open[open.size()-2+c];
+				ch.rows.resize(D);
+				ch.stats.assign(statWidth(), 0);
+				ch.depth = nd.depth + 1; ch.parent = node; ch.right = (c == 1);
+			}
+			for (auto ftr : features)
+				for (const std::size_t& n : nd.rows[ftr])
+					open[open.size()-2+side[n]].rows[ftr].push_back(n);
+			for (std::size_t c = 0; c < 2; ++c)
+				for (const std::size_t& n : open[open.size()-2+c].rows[0])
+					addStats(&open[open.size()-2+c].stats[0], n, 1);
+			std::vector< std::vector<std::size_t> >().swap(nd.rows);
+			PROFILE_STOP();
+
+			push(open.size()-2);
+			push(open.size()-1);
+		}
+
+		// The leaf budget is exhausted, so every node still waiting becomes a leaf
+		for (; !queue.empty(); queue.pop())
+		{
+			OpenNode& nd = open[queue.top().second];
+			attach(nd.parent, nd.right, new TreeNode(leafValue(&nd.stats[0])), top);
+		}
+		return top;
+	}
+
+
+	// Order in which the tree is actually grown. Depth-first growth only supports exhaustive threshold
+	// splits on all examples of a dense dataset, sorted by the tree itself, so anything else implies
+	// level-wise growth. Level-wise growth, which gives the same splits with less memory, is also used if
+	// depth-first growth would exceed the memory budget.
+	char growthOrder() const
+	{
+		bool anyCategorical = std::find(categorical.begin(), categorical.end(), 1) != categorical.end();
+		if (growth == 'd' && (extraTrees || maxSplitSamples < N || anyCategorical || sparse || !rowMask.empty() || presorted))
+			return 'l';
+		if (growth == 'd' && memoryBudget > 0 && dataBytes() + buildBytes('d') > memoryBudget)
+			return 'l';
+		return growth;
+	}
+
+
+	// Memory in bytes of the training data, including the targets kept by a subclass
+	std::size_t dataBytes() const
+	{
+		std::size_t bytes = inputs.capacity() * sizeof(std::vector<T>) + outputs.capacity() * sizeof(U);
+		for (const auto& in : inputs)
+			bytes += in.capacity() * sizeof(T);
+		return bytes + sparseInputs.bytes() + targetBytes();
+	}
+
+
+	// Estimate the peak memory in bytes needed on top of the training data to grow the tree in the given
+	// order: the sorted structures used to find splits, and the nodes of the largest tree that could grow
+	std::size_t buildBytes(const char& order) const
+	{
+		const std::size_t entries = sparse ? sparseInputs.nonZeros() : N * features.size(), sz = sizeof(std::size_t);
+		std::size_t leaves = (order == 'b') ? std::min(N, maxLeafNodes) : N;
+		if (maxDepth < 8 * sz - 1)
+			leaves = std::min(leaves, (std::size_t)1 << maxDepth);
+		std::size_t bytes = (2 * std::max<std::size_t>(leaves, 1) - 1) * sizeof(TreeNode);
+		
+		// Depth-first growth holds index maps, part of which are copied at each split, and the location of
+		// every example in them. Best-first growth also holds the sorted rows of both children of a split.
+		// Level-wise growth holds the sorted columns, and a copy of at most half of them once compacted.
+		if (order == 'd')
+			bytes += 2 * entries * (containerNodeBytes<std::size_t>()
+					+ containerNodeBytes< std::pair< const std::size_t, std::set<std::size_t> > >()) + entries * sz;
+		else if (order == 'b')
+			bytes += entries * (2 * sz + sizeof(T)) + 2 * N;
+		else if (!extraTrees && presorted == NULL)
+			bytes += entries * (sz + sizeof(T)) * (sparse ? 4 : 3) / 2 + N * sz;
+		else if (!extraTrees)
+			bytes += entries * (sz + sizeof(T)) / 2 + N * sz;
+		else
+			bytes += N * sz;
+		return bytes;
+	}
+
+
+	// Check that the tree can be built or pruned, which needs its training data
+	void checkTrainingData() const
+	{
+		if (released)
+			throw std::invalid_argument("Tree cannot be built or pruned once its training data is released\n");
+	}
+
+
+	// Check before building that the estimated memory of the build is within the budget, if there is one
+	void checkMemoryBudget() const
+	{
+		checkTrainingData();
+		std::size_t bytes = dataBytes() + buildBytes(growthOrder());
+		if (memoryBudget > 0 && bytes > memoryBudget)
+			throw std::invalid_argument("Building the tree needs an estimated " + std::to_string(bytes)
+					+ " bytes, which exceeds the memory budget of " + std::to_string(memoryBudget) + " bytes\n");
+	}
+
+
+	// Number of statistics accumulated per node, e.g. one count per class
+	virtual std::size_t statWidth() const = 0;
+
+	// Add the contribution of example n, with weight w, to the statistics of a node
+	virtual void addStats(double* st, const std::size_t& n, const double& w) const = 0;
+
+	// Number of (weighted) examples described by the statistics of a node
+	virtual double statCount(const double* st) const = 0;
+
+	// Impurity of a node multiplied by its number of examples, so that child impurities can be summed
+	virtual double nodeImpurity(const double* st) const = 0;
+
+	// Output value of a leaf with the given statistics
+	virtual U leafValue(const double* st) const = 0;
+
+	// Target statistic by which the categories of a feature are ordered, given their statistics and
+	// those of the whole node
+	virtual double categoryKey(const double* st, const double* tot) const = 0;
+
+	// Training error of a node with the given statistics if it were a leaf
+	virtual double leafRisk(const double* st) const = 0;
+
+	// Error of predicting 'pred' when the actual output is 'actual'
+	virtual double loss(const U& pred, const U& actual) const = 0;
+
+	// Memory in bytes of the per-example targets kept by a subclass, and freeing them
+	virtual std::size_t targetBytes() const = 0;
+	virtual void releaseTargets() = 0;
+
+
+	// Forget the cost-complexity pruning path, which refers to the nodes of the tree it was computed for.
+	// Every build and every change to the outputs calls this, so that pruning never reaches nodes of a
+	// previous tree.
+	void clearPruningPath()
+	{
+		std::vector<double>().swap(pruneAlphas);
+		std::vector< std::vector<TreeNode*> >().swap(pruneSteps);
+	}
+
+
+	// Collapse the nodes of the first 'steps' steps of the pruning path into leaves, then forget the path.
+	// Steps are counted rather than compared by alpha, since consecutive steps can share the same alpha.
+	void collapseSteps(const std::size_t& steps)
+	{
+		for (std::size_t k = 0; k < steps && k < pruneSteps.size(); ++k)
+			for (TreeNode* node : pruneSteps[k])
+				node->makeLeaf();
+		clearPruningPath();
+		layout.clear();
+	}
+
+
+	// Number the nodes of the tree in depth-first order, so that each subtree occupies consecutive numbers
+	// starting at its root, and record the parent of each node
+	void numberNodes(std::vector<TreeNode*>& nodes, std::vector<std::size_t>& parent) const
+	{
+		std::vector< std::pair<TreeNode*, std::size_t> > stack{std::make_pair(root, std::numeric_limits<std::size_t>::max())};
+		nodes.clear(); parent.clear();
+		while (!stack.empty())
+		{
+			auto pr = stack.back();
+			stack.pop_back();
+			nodes.push_back(pr.first); parent.push_back(pr.second);
+			if (!pr.first->getLeaf())
+			{
+				stack.push_back(std::make_pair(pr.first->getR(), nodes.size()-1));
+				stack.push_back(std::make_pair(pr.first->getL(), nodes.size()-1));
+			}
+		}
+	}
+
+
+	// Compile the tree into the node array of a predictor, in preorder with each left child directly after
+	// its parent. Leaf values are added to the table 'values', each distinct value once, with 'position'
+	// giving the position of each value in it.
+	void compile(std::vector<typename TreePredictor<T, U>::Node>& nodes, std::vector< std::vector<T> >& categories,
+			std::vector<U>& values, std::map<U, std::size_t>& position) const
+	{
+		const std::size_t none = TreePredictor<T, U>::none;
+		std::vector< std::pair<const TreeNode*, std::size_t> > stack{std::make_pair(root, none)};
+		while (!stack.empty())
+		{
+			const TreeNode* node = stack.back().first;
+			std::size_t from = stack.back().second;
+			stack.pop_back();
+			if (from != none)
+				nodes[from].next = nodes.size();
+				
+			typename TreePredictor<T, U>::Node nd = typename TreePredictor<T, U>::Node();
+			nd.cats = none;
+			if (node->getLeaf())
+			{
+				nd.d = none;
+				auto search = position.insert(std::make_pair(node->getVal(), values.size()));
+				if (search.second)
+					values.push_back(node->getVal());
+				nd.next = search.first->second;
+			}
+			else
+			{
+				nd.d = node->getSplit().first;
+				nd.split = node->getSplit().second;
+				if (!node->getCats().empty())
+				{
+					nd.cats = categories.size();
+					categories.push_back(node->getCats());
+				}
+				stack.push_back(std::make_pair(node->getR(), nodes.size()));
+				stack.push_back(std::make_pair(node->getL(), none));
+			}
+			nodes.push_back(nd);
+		}
+	}
+
+
+	// Route every training example the tree is built on down the tree one level at a time, calling
+	// visit(node, n) for each node that example n passes through, in increasing order of n for each node.
+	// Sparse inputs are read through their columns, as when the tree is grown.
+	template<typename F>
+	void routeExamples(F visit) const
+	{
+		const std::size_t none = std::numeric_limits<std::size_t>::max();
+		SortedColumns<T> columns;
+		if (sparse)
+			storedColumns(columns.order, columns.vals);
+		std::vector<TreeNode*> level{root};
+		std::vector<std::size_t> nodeOf(N, none);
+		for (std::size_t n = 0; n < N; ++n)
+			if (included(n))
+				nodeOf[n] = 0;
+		while (!level.empty())
+		{
+			std::vector<TreeNode*> next;
+			std::vector<std::size_t> splitOf(level.size(), D), child(level.size(), none);
+			for (std::size_t k = 0; k < level.size(); ++k)
+				if (!level[k]->getLeaf())
+				{
+					splitOf[k] = level[k]->getSplit().first;
+					child[k] = next.size();
+					next.push_back(level[k]->getL());
+					next.push_back(level[k]->getR());
+				}
+			std::vector<T> x = splitValues(columns, nodeOf, splitOf);
+			for (std::size_t n = 0; n < N; ++n)
+			{
+				std::size_t k = nodeOf[n];
+				if (k == none)
+					continue;
+				visit(level[k], n);
+				nodeOf[n] = child[k] == none ? none : child[k] + (level[k]->goesLeft(x[n]) ? 0 : 1);
+			}
+			level.swap(next);
+		}
+	}
+
+
+	// Route every training example the tree is built on down the tree, accumulating the statistics of each
+	// node it passes through
+	std::vector<double> nodeStatistics(const std::vector<TreeNode*>& nodes) const
+	{
+		const std::size_t W = statWidth();
+		std::unordered_map<TreeNode*, std::size_t> id;
+		for (std::size_t t = 0; t < nodes.size(); ++t)
+			id[nodes[t]] = t;
+		std::vector<double> st(nodes.size()*W, 0);
+		routeExamples([&](TreeNode* node, const std::size_t& n) {addStats(&st[id[node]*W], n, 1);});
+		return st;
+	}
+
+
+	// Pure virtual declaration of function for building tree
+	virtual void buildTree() = 0;
+
+
+	
+	// MEMBER OBJECTS
+	
+	// Vector of training example inputs, where each example is a vector
+	std::vector< std::vector<T> > inputs;
+	
+	// Vector of output data corresponding to example inputs
+	std::vector<U> outputs;
+	
+	// Training example inputs in compressed sparse row format, used instead of 'inputs' if 'sparse' is set
+	SparseMatrix<T> sparseInputs;
+	bool sparse{false};
+	
+	// Vector of feature numbers
+	std::vector<std::size_t> features, selectedFeatures;
+	
+	// Indices of examples, sorted along each dimension. Consecutive examples are grouped
+	// in the same vector if they have the same value in the given dimension.
+	std::vector< std::map< std::size_t, std::set< std::size_t> > > indices;
+	
+	// Vector indicating sorted position of each data point with respect to each dimension
+	std::vector< std::vector<std::size_t> > pntLocator;
+	
+	// D = # dimensions, N = # examples, subD = # features checked at each node
+	std::size_t D, N, subD;    
+	
+	// Tree properties to track for stopping criteria
+	std::size_t maxDepth, minLeafSize{0}, depth{0};
+
+	// Indicate order of tree growth: depth-first ('d', default), level-wise ('l') or best-first ('b')
+	char growth{'d'};
+	
+	// Maximum number of leaves in a tree grown best-first
+	std::size_t maxLeafNodes;
+	
+	// Indicate whether splits use one random threshold per feature (extremely randomised trees)
+	bool extraTrees{false};
+	
+	// Maximum number of examples of a node used to choose its split when growing level-wise or best-first
+	std::size_t maxSplitSamples;
+	
+	// Seed of the random choices made while building, if one has been set, and the number of generators
+	// seeded from it so far
+	bool seeded{false};
+	unsigned seed{0};
+	std::size_t generators{0};
+	
+	// Indicate for each feature whether its values are unordered categories
+	std::vector<char> categorical;
+
+	// Pointer to TreeNode object representing the root node of the tree
+	TreeNode* root{NULL};
+	
+	// Cost-complexity pruning path: increasing values of alpha, and the nodes collapsed into leaves at each
+	std::vector<double> pruneAlphas;
+	std::vector< std::vector<TreeNode*> > pruneSteps;
+	
+	// Node array used for prediction once the tree is calibrated (empty otherwise)
+	std::vector<FlatNode> layout;
+	
+	// Number of calibration examples visiting each node, numbered in preorder, and number of calibration
+	// examples whose path from the root has each length
+	std::vector<std::size_t> visitCounts, pathLengths;
+	
+	// Timers and counters of the last build, which only exist if compiled with DTREES_PROFILE defined
+#ifdef DTREES_PROFILE
+	mutable BuildStats buildStats;
+#endif
+	
+	// Memory budget in bytes for building the tree (not used if 0), and whether the training data has
+	// been released
+	std::size_t memoryBudget{0};
+	bool released{false};
+
+	// Rows used to build the tree, all of them if empty, and columns sorted in advance which are shared
+	// with other trees (not owned by the tree, and sorted by the tree itself if NULL)
+	std::vector<char> rowMask;
+	const SortedColumns<T>* presorted{NULL};
+
+	
+	
+public:
+	
+	// Constructor
+	TreeData(std::vector< std::vector<T> > in, std::vector<U> out)
+	: inputs(std::move(in)), outputs(std::move(out)) {initialise(inputs.size(), inputs[0].size());}
+	
+	
+	// Constructor from a sparse matrix of inputs, whose implicit zeros are never stored or sorted
+	TreeData(const SparseMatrix<T>& in, std::vector<U> out)
+	: outputs(out), sparseInputs(in), sparse(true) {initialise(in.rows(), in.columns());}
+	
+	
+	// Default constructor
+	TreeData() = default;
+	
+	
+	// Pruning properties of trees
+	void setMinLeafSize(const std::size_t& s) {minLeafSize = s;}
+	void setMaxDepth(const std::size_t& d) {maxDepth = d;}
+	void setNrSelectedFeatures(const std::size_t n) {subD = n; selectedFeatures.resize(subD);}
+	std::size_t getMinLeafSize() const {return minLeafSize;}
+	std::size_t getMaxDepth() const {return maxDepth;}
+	std::size_t getNrSelectedFeatures() {return subD;}
+	
+	
+	// Order in which the tree is grown
+	void setGrowth(char c)
+	{
+		if (c != 'd' && c != 'l' && c != 'b')
+			throw std::invalid_argument("Growth must be 'd' (depth-first), 'l' (level-wise) or 'b' (best-first)\n");
+		if (c == 'b' && sparse)
+			throw std::invalid_argument("Best-first growth is not available for sparse inputs\n");
+		growth = c;
+	}
+	char getGrowth() const {return growth;}
+	void setMaxLeafNodes(const std::size_t& l) {maxLeafNodes = l;}
+	std::size_t getMaxLeafNodes() const {return maxLeafNodes;}
+	
+	
+	// Extremely randomised trees, which are grown level-wise unless best-first growth is chosen
+	void setExtraTrees(bool b) {extraTrees = b;}
+	bool getExtraTrees() const {return extraTrees;}
+	
+	
+	// Estimate the split of a large node from a random subsample of its examples, then partition all of
+	// them. As for extremely randomised trees, this implies level-wise growth unless best-first is chosen.
+	void setMaxSplitSamples(const std::size_t& s)
+	{
+		if (s == 0)
+			throw std::invalid_argument("Maximum number of split samples must be positive\n");
+		maxSplitSamples = s;
+	}
+	std::size_t getMaxSplitSamples() const {return maxSplitSamples;}
+	
+	
+	// Seed the random choices made while building the tree (features, thresholds and subsamples), so that
+	// the same seed and settings always give the same tree, or the same sequence of trees if it is rebuilt
+	void setSeed(const unsigned& s)
+	{
+		seed = s;
+		seeded = true;
+		generators = 0;
+	}
+	
+	
+	// Treat the values of a feature as unordered categories, split by subsets of categories. As for
+	// extremely randomised trees, this implies level-wise growth unless best-first growth is chosen.
+	void setCategorical(const std::size_t& d, bool b = true)
+	{
+		if (d >= D)
+			throw std::invalid_argument("Categorical feature must be less than the number of features\n");
+		categorical[d] = b;
+	}
+	bool getCategorical(const std::size_t& d) const {return categorical[d];}
+	
+	
+	// Sort the training examples along each feature, once for any number of trees built on the same inputs
+	SortedColumns<T> sortColumns()
+	{
+		checkTrainingData();
+		SortedColumns<T> columns;
+		sortedColumns(columns.order, columns.vals);
+		return columns;
+	}
+	
+	
+	// Build the tree from columns already sorted by sortColumns, of this tree or of a tree with the same
+	// inputs, instead of sorting the examples again (NULL to sort them again). The columns are not copied,
+	// so they must outlive every build using them. As for a row mask, this implies level-wise growth unless
+	// best-first growth is chosen.
+	void setPresorted(const SortedColumns<T>* columns)
+	{
+		if (columns != NULL && (columns->order.size() != D || columns->vals.size() != D))
+			throw std::invalid_argument("Sorted columns have " + std::to_string(columns->order.size())
+					+ " features, but the training data has " + std::to_string(D) + "\n");
+		presorted = columns;
+	}
+	
+	
+	// Build the tree only from the training examples n with mask[n] set, e.g. the training folds of a
+	// cross-validation, while the data and its sorted columns stay shared by all folds. An empty mask
+	// selects every example. This implies level-wise growth unless best-first growth is chosen.
+	void setRowMask(const std::vector<char>& mask)
+	{
+		if (!mask.empty() && mask.size() != N)
+			throw std::invalid_argument("Row mask has " + std::to_string(mask.size()) + " entries, but the training data has "
+					+ std::to_string(N) + " examples\n");
+		if (!mask.empty() && std::all_of(mask.begin(), mask.end(), [](const char& m) {return m == 0;}))
+			throw std::invalid_argument("Row mask selects no training examples\n");
+		rowMask = mask;
+	}
+	const std::vector<char>& getRowMask() const {return rowMask;}
+	
+	
+	// Predict output associated with new input data using tree
+	U predict(const std::vector<T>& in) const
+	{
+		if (!layout.empty())
+			return predictLayout(in);
+		TreeNode* node = root;
+		while (true)
+		{
+			if (node->getLeaf())
+				break;
+				
+			auto pr = node->getSplit();
+			if (node->goesLeft(in[pr.first]))
+				node = node->getL();
+			else
+				node = node->getR();
+		}
+		return node->getVal();
+	}
+	
+	
+	// Predict output for a sparse input, given as (feature, value) pairs sorted by feature
+	U predict(const std::vector< std::pair<std::size_t, T> >& in) const
+	{
+		if (!layout.empty())
+			return predictLayout(in);
+		TreeNode* node = root;
+		while (!node->getLeaf())
+			if (node->goesLeft(sparseValue(in, node->getSplit().first)))
+				node = node->getL();
+			else
+				node = node->getR();
+		return node->getVal();
+	}
+	
+	
+	// Run a representative sample of inputs through the tree, recording how often each node is visited and
+	// the length of each path, then compile the tree into an array for prediction. Nodes are laid out in
+	// preorder taking the more frequently visited child first, so that common paths are contiguous and the
+	// likely child is the next node in the array.
+	void calibrate(const std::vector< std::vector<T> >& in)
+	{
+		std::vector<TreeNode*> nodes;
+		std::vector<std::size_t> parent;
+		numberNodes(nodes, parent);
+		std::unordered_map<const TreeNode*, std::size_t> number;
+		for (std::size_t t = 0; t < nodes.size(); ++t)
+			number[nodes[t]] = t;
+			
+		visitCounts.assign(nodes.size(), 0);
+		pathLengths.clear();
+		for (const auto& x : in)
+		{
+			std::size_t length = 0;
+			for (const TreeNode* node = root; ; node = node->goesLeft(x[node->getSplit().first]) ? node->getL() : node->getR())
+			{
+				++visitCounts[number[node]];
+				if (node->getLeaf())
+					break;
+				++length;
+			}
+			if (pathLengths.size() <= length)
+				pathLengths.resize(length+1, 0);
+			++pathLengths[length];
+		}
+		
+		const std::size_t none = std::numeric_limits<std::size_t>::max();
+		layout.clear();
+		layout.reserve(nodes.size());
+		std::vector< std::pair<const TreeNode*, std::size_t> > stack{std::make_pair(root, none)};
+		while (!stack.empty())
+		{
+			const TreeNode* node = stack.back().first;
+			std::size_t from = stack.back().second;
+			stack.pop_back();
+			if (from != none)
+				layout[from].next = layout.size();
+				
+			FlatNode f = FlatNode();
+			f.leaf = node->getLeaf();
+			f.val = node->getVal();
+			f.next = none;
+			if (!f.leaf)
+			{
+				f.d = node->getSplit().first;
+				f.split = node->getSplit().second;
+				f.cats = node->getCats().empty() ? nullptr : &node->getCats();
+				f.hotLeft = visitCounts[number[node->getL()]] >= visitCounts[number[node->getR()]];
+				stack.push_back(std::make_pair(f.hotLeft ? node->getR() : node->getL(), layout.size()));
+				stack.push_back(std::make_pair(f.hotLeft ? node->getL() : node->getR(), none));
+			}
+			layout.push_back(f);
+		}
+	}
+	
+	
+	// Statistics recorded by calibrate: visits of each node, numbered in preorder, the number of examples
+	// by path length, and the mean path length
+	const std::vector<std::size_t>& getVisitCounts() const {return visitCounts;}
+	const std::vector<std::size_t>& getPathLengths() const {return pathLengths;}
+	double meanPathLength() const
+	{
+		std::size_t count = 0, total = 0;
+		for (std::size_t l = 0; l < pathLengths.size(); ++l)
+		{
+			count += pathLengths[l];
+			total += l * pathLengths[l];
+		}
+		return count > 0 ? (double) total / count : 0;
+	}
+	
+	
+	// Number of nodes and of leaves in the tree
+	std::size_t nodeCount() const
+	{
+		std::vector<TreeNode*> nodes;
+		std::vector<std::size_t> parent;
+		numberNodes(nodes, parent);
+		return nodes.size();
+	}
+	std::size_t leafCount() const {return (nodeCount() + 1) / 2;}
+	
+	
+	// Compute the minimal cost-complexity pruning path (Breiman et al., 1984). The weakest link of the tree
+	// is the internal node whose collapse into a leaf increases the training error least per leaf removed,
+	// and collapsing weakest links in turn gives the optimal subtree for each increasing value of the
+	// complexity parameter alpha. Returns those values of alpha, starting with 0 for the full tree.
+	std::vector<double> pruningPath()
+	{
+		checkTrainingData();
+		std::vector<TreeNode*> nodes;
+		std::vector<std::size_t> parent;
+		numberNodes(nodes, parent);
+		const std::size_t M = nodes.size(), W = statWidth(), none = std::numeric_limits<std::size_t>::max();
+		std::vector<double> st = nodeStatistics(nodes);
 		
-		// Display information about node
-		void display() const 
+		// Error of each node as a leaf (R), total error of the leaves of its subtree (RT), number of those
+		// leaves and size of the subtree
+		std::vector<double> R(M), RT(M, 0);
+		std::vector<std::size_t> leaves(M, 0), size(M, 1);
+		std::vector<char> internal(M);
+		for (std::size_t t = M; t-- > 0; )
 		{
-			std::cout << std::setw(20) << "Leaf? ";
-			if (leaf)
+			R[t] = leafRisk(&st[t*W]);
+			internal[t] = !nodes[t]->getLeaf();
+			if (internal[t])
+				nodes[t]->setVal(leafValue(&st[t*W]));
+			else
 			{
-				std::cout << "Yes\n";
-				std::cout << std::setw(20) << "Output: " << val << '\n';
+				leaves[t] = 1;
+				RT[t] = R[t];
 			}
-			else
+			if (parent[t] != none)
 			{
-				std::cout << "No\n";
-				std::cout << std::setw(20) << "Split dimension: " << split.first << '\n';
-				std::cout << std::setw(20) << "Split value: " << split.second << '\n';
+				leaves[parent[t]] += leaves[t];
+				RT[parent[t]] += RT[t];
+				size[parent[t]] += size[t];
 			}
-			std::cout << "   -----------------------\n";
-			if (R != NULL)
-				R->display();
-			if (L != NULL)
-				L->display();
 		}
-	};
-
-
-
-
-	// METHODS
-
-	// Create all possible splits between N data points in D dimensions
-	std::map< std::size_t, std::vector<double> > createSplits(const std::vector< std::map< std::size_t, std::set< std::size_t> > >& inds) const	
-	{	
-		std::size_t s;
-		std::map< std::size_t, std::vector<double> > splits;
 		
-		for (auto ftr : selectedFeatures)
+		pruneAlphas.assign(1, 0);
+		pruneSteps.assign(1, std::vector<TreeNode*>());
+		while (internal[0])
 		{
-			splits[ftr] = std::vector<double>(inds[ftr].size()-1);
-			auto it = inds[ftr].begin();
-			s = 0;
-			while (it->first != inds[ftr].rbegin()->first)
-				splits[ftr][s++] = ((double)inputs[ *(it->second.begin()) ][ftr]
-								+ (double)inputs[ *((++it)->second.begin()) ][ftr]) / 2;
+			// Find the weakest links, collapsing ancestors before descendants
+			std::vector<double> g(M, std::numeric_limits<double>::infinity());
+			double minG = g[0];
+			for (std::size_t t = 0; t < M; ++t)
+				if (internal[t])
+				{
+					g[t] = (R[t] - RT[t]) / (leaves[t] - 1);
+					minG = std::min(minG, g[t]);
+				}
+			
+			std::vector<TreeNode*> step;
+			for (std::size_t t = 0; t < M; ++t)
+				if (internal[t] && g[t] <= minG + 1e-12 * std::max(1.0, std::fabs(minG)))
+				{
+					for (std::size_t a = parent[t]; a != none; a = parent[a])
+					{
+						leaves[a] -= leaves[t] - 1;
+						RT[a] += R[t] - RT[t];
+					}
+					leaves[t] = 1; RT[t] = R[t];
+					std::fill(internal.begin() + t, internal.begin() + t + size[t], 0);
+					step.push_back(nodes[t]);
+				}
+			pruneAlphas.push_back(std::max(minG, pruneAlphas.back()));
+			pruneSteps.push_back(step);
 		}
-		return splits;
+		return pruneAlphas;
 	}
 	
 	
-	// Compare current value to minimum and reassign minimum value and location if necessary
-	void compare(const double& current, double& minVal, 
-				std::pair<std::size_t, std::size_t>& min, const std::size_t& d, std::size_t& s) const
+	// Prune the tree in place to its optimal subtree for complexity parameter alpha, deleting removed nodes
+	void prune(const double& alpha)
 	{
-		if (current < minVal)
+		if (pruneAlphas.empty())
+			pruningPath();
+		std::size_t steps = 0;
+		while (steps < pruneAlphas.size() && pruneAlphas[steps] <= alpha)
+			++steps;
+		collapseSteps(steps);
+	}
+	
+	
+	// Choose the value of alpha on the pruning path with the least error on a validation set, preferring
+	// smaller trees in case of ties, then prune the tree accordingly and return that value of alpha. Each
+	// validation example is only routed through the full tree once to score every subtree on the path.
+	double pruneByValidation(const std::vector< std::vector<T> >& in, const std::vector<U>& out)
+	{
+		if (pruneAlphas.empty())
+			pruningPath();
+		const std::size_t K = pruneAlphas.size();
+		std::unordered_map<TreeNode*, std::size_t> collapsed;
+		for (std::size_t k = 0; k < K; ++k)
+			for (TreeNode* node : pruneSteps[k])
+				collapsed[node] = k;
+		
+		// A node predicts for all steps from its collapse until the collapse of one of its ancestors
+		std::vector<double> error(K+1, 0);
+		for (std::size_t i = 0; i < in.size(); ++i)
 		{
-			minVal = current;
-			min.first = d; 
-			min.second = s;
+			std::size_t first = K;
+			for (TreeNode* node = root; ; node = node->goesLeft(in[i][node->getSplit().first]) ? node->getL() : node->getR())
+			{
+				auto search = collapsed.find(node);
+				std::size_t k = node->getLeaf() ? 0 : (search == collapsed.end() ? K : search->second);
+				if (k < first)
+				{
+					double l = loss(node->getVal(), out[i]);
+					error[k] += l; error[first] -= l;
+					first = k;
+				}
+				if (node->getLeaf())
+					break;
+			}
+		}
+		
+		std::size_t best = 0;
+		for (std::size_t k = 1; k < K; ++k)
+		{
+			error[k] += error[k-1];
+			if (error[k] <= error[best])
+				best = k;
 		}
+		double alpha = pruneAlphas[best];
+		collapseSteps(best + 1);
+		return alpha;
 	}
 	
 	
-	// Check if all input points are identical (implying repeated or conflicting data)
-	bool identicalInputs(const std::vector< std::map< std::size_t, std::set< std::size_t> > >& inds) const
+	// Key identifying a subtree by the contents of its root and by its branches, once these are shared, and
+	// a table of shared subtrees by key together with the shared node found for each node already visited
+	typedef std::tuple<bool, std::size_t, double, std::vector<T>, U, TreeNode*, TreeNode*> SubtreeKey;
+	typedef std::pair< std::map<SubtreeKey, TreeNode*>, std::unordered_map<TreeNode*, TreeNode*> > SubtreeTable;
+	
+	
+	// Hash-cons the tree: bottom up, each subtree identical to one already in the table (same leaf value, or
+	// same split and shared branches) is replaced by that subtree and deleted, and every other subtree is
+	// added to the table. Trees sharing a table then form one directed acyclic graph, over which prediction
+	// is unchanged. The root itself is kept, so copies of the tree stay valid. Returns the number of nodes
+	// deleted. Shared trees must not be pruned afterwards.
+	std::size_t shareSubtrees(SubtreeTable& table)
 	{
-		std::size_t equal = 0;
-		for (auto ftr : inds)
+		auto& shared = table.second;
+		std::size_t removed = 0;
+		layout.clear();
+		std::vector< std::pair<TreeNode*, bool> > stack{std::make_pair(root, false)};
+		while (!stack.empty())
 		{
-			if (ftr.size() > 1)
-				break;
-			++equal;
+			TreeNode* node = stack.back().first;
+			bool branchesDone = stack.back().second;
+			stack.pop_back();
+			if (shared.count(node))
+				continue;
+			if (!branchesDone)
+			{
+				stack.push_back(std::make_pair(node, true));
+				if (!node->getLeaf())
+				{
+					stack.push_back(std::make_pair(node->getR(), false));
+					stack.push_back(std::make_pair(node->getL(), false));
+				}
+				continue;
+			}
+			
+			SubtreeKey key;
+			if (node->getLeaf())
+				key = std::make_tuple(true, 0, 0.0, std::vector<T>(), node->getVal(), nullptr, nullptr);
+			else
+			{
+				node->setL(shared[node->getL()]);
+				node->setR(shared[node->getR()]);
+				key = std::make_tuple(false, node->getSplit().first, node->getSplit().second, node->getCats(), U(),
+				                      node->getL(), node->getR());
+			}
+			auto search = table.first.insert(std::make_pair(key, node)).first;
+			shared[node] = search->second;
+			if (search->second != node && node != root)
+			{
+				delete node;
+				++removed;
+			}
 		}
-		if (equal == D)
-			return true;
-		return false;
+		return removed;
 	}
 	
-
-	// Implement random feature selection
-	void randomFeatures(const std::vector< std::map< std::size_t, std::set< std::size_t> > >& inds)
+	
+	// Timers and counters of the last build, which are only available if the library is compiled with
+	// DTREES_PROFILE defined. With tracing on, every timed phase is also recorded as a trace event.
+#ifdef DTREES_PROFILE
+	const BuildStats& getBuildStats() const {return buildStats;}
+	void setTrace(bool b) {buildStats.trace = b;}
+#endif
+	
+	
+	// Memory held by the tree, broken down by kind. Nodes already in 'seen' are not counted again, so that
+	// subtrees shared between trees are only counted once, and the nodes of the tree are added to it.
+	MemoryUsage memoryUsage(std::unordered_set<const void*>& seen) const
 	{
-		// Identify set of useful features, meaning features on which at least one split is possible
-		std::vector<std::size_t> usefulFtrs;
-		for (std::size_t d = 0; d < D; ++d)
-			if (inds[d].size() > 1)
-				usefulFtrs.push_back(d);
+		MemoryUsage usage;
+		usage.trainingData = dataBytes();
+		for (const auto& map : indices)
+			for (const auto& el : map)
+				usage.indexStructures += containerNodeBytes< std::pair< const std::size_t, std::set<std::size_t> > >()
+						+ el.second.size() * containerNodeBytes<std::size_t>();
+		for (const auto& loc : pntLocator)
+			usage.indexStructures += loc.capacity() * sizeof(std::size_t);
+		for (const auto& step : pruneSteps)
+			usage.indexStructures += step.capacity() * sizeof(TreeNode*);
+		usage.indexStructures += pruneAlphas.capacity() * sizeof(double)
+				+ (visitCounts.capacity() + pathLengths.capacity()) * sizeof(std::size_t);
 		
-		std::size_t nrUselessFtrs = D - usefulFtrs.size();
-		if (subD <= nrUselessFtrs)
-			selectedFeatures = usefulFtrs;
-		else
+		usage.nodes = layout.capacity() * sizeof(FlatNode);
+		std::vector<const TreeNode*> stack;
+		if (root != NULL)
+			stack.push_back(root);
+		while (!stack.empty())
 		{
-			std::vector<std::size_t> copy = usefulFtrs;
-			std::random_device rd;
-			std::mt19937 gen(rd());
-			std::shuffle(copy.begin(), copy.end(), gen);
-			copy.erase(copy.begin()+subD, copy.end());
-			selectedFeatures = copy;
+			const TreeNode* node = stack.back();
+			stack.pop_back();
+			if (!seen.insert(node).second)
+				continue;
+			if (node->getLeaf())
+				usage.leaves += sizeof(TreeNode);
+			else
+			{
+				usage.nodes += sizeof(TreeNode) + node->getCats().capacity() * sizeof(T);
+				stack.push_back(node->getL()); stack.push_back(node->getR());
+			}
 		}
-	}	
-
-	
-	// Pure virtual declaration of function for building tree
-	virtual void buildTree() = 0;
+		return usage;
+	}
+	MemoryUsage memoryUsage() const
+	{
+		std::unordered_set<const void*> seen;
+		return memoryUsage(seen);
+	}
 	
-
 	
-	// MEMBER OBJECTS
+	// Memory budget in bytes for building the tree (0 for none). If growing depth-first would exceed it,
+	// the tree is grown level-wise instead, with the same splits and less memory. If the estimated memory
+	// still exceeds the budget, buildTree fails with the estimate before allocating anything.
+	void setMemoryBudget(const std::size_t& b) {memoryBudget = b;}
+	std::size_t getMemoryBudget() const {return memoryBudget;}
 	
-	// Vector of training example inputs, where each example is a vector
-	std::vector< std::vector<T> > inputs;
 	
-	// Vector of output data corresponding to example inputs
-	std::vector<U> outputs;
+	// Estimated peak memory in bytes of building the tree with its current settings, training data included
+	std::size_t estimateBuildMemory() const {return dataBytes() + buildBytes(growthOrder());}
 	
-	// Vector of feature numbers
-	std::vector<std::size_t> features, selectedFeatures;
 	
-	// Indices of examples, sorted along each dimension. Consecutive examples are grouped
-	// in the same vector if they have the same value in the given dimension.
-	std::vector< std::map< std::size_t, std::set< std::size_t> > > indices;
+	// Size in bytes of one node of a tree
+	static constexpr std::size_t nodeBytes() {return sizeof(TreeNode);}
 	
-	// Vector indicating sorted position of each data point with respect to each dimension
-	std::vector< std::vector<std::size_t> > pntLocator;
 	
-	// D = # dimensions, N = # examples, subD = # features checked at each node
-	std::size_t D, N, subD;    
+	// Free the training data and everything else only used for building and pruning, keeping what is
+	// needed for prediction. The tree can no longer be rebuilt or pruned afterwards.
+	void releaseTrainingData()
+	{
+		std::vector< std::vector<T> >().swap(inputs);
+		std::vector<U>().swap(outputs);
+		sparseInputs = SparseMatrix<T>();
+		releaseIndices();
+		clearPruningPath();
+		releaseTargets();
+		released = true;
+	}
+	bool getReleased() const {return released;}
 	
-	// Tree properties to track for stopping criteria
-	std::size_t maxDepth, minLeafSize{0}, depth{0};
-
-	// Pointer to TreeNode object representing the root node of the tree
-	TreeNode* root;
-
 	
+	// Compile the tree into an immutable predictor, which holds only its nodes and leaf values. In the
+	// second form, leaves index the table 'values' shared with other trees, to which the leaf values of the
+	// tree are added, each distinct value once, with 'position' giving the position of each value in it.
+	TreePredictor<T, U> toPredictor() const
+	{
+		std::vector<typename TreePredictor<T, U>::Node> nodes;
+		std::vector< std::vector<T> > categories;
+		std::vector<U> values;
+		std::map<U, std::size_t> position;
+		compile(nodes, categories, values, position);
+		return TreePredictor<T, U>(nodes, categories, values);
+	}
+	TreePredictor<T, U> toPredictor(std::vector<U>& values, std::map<U, std::size_t>& position) const
+	{
+		std::vector<typename TreePredictor<T, U>::Node> nodes;
+		std::vector< std::vector<T> > categories;
+		compile(nodes, categories, values, position);
+		return TreePredictor<T, U>(nodes, categories, std::vector<U>());
+	}
 	
-public:
 	
-	// Constructor
-	TreeData(std::vector< std::vector<T> > in, std::vector<U> out)
-	: inputs(in), outputs(out)
+	// Free everything the tree holds, including its nodes, except nodes already in 'seen', which are freed
+	// with another tree sharing them. Nodes freed are added to 'seen'.
+	void release(std::unordered_set<const void*>& seen)
 	{
-		N = in.size(); D = in[0].size(); maxDepth = N; subD = D;
-		features.resize(D);
-		std::iota(features.begin(), features.end(), 0);
-		selectedFeatures = features;
-		indicesTable();
-		locatePnts();	
+		deleteNodes(seen);
+		releaseTrainingData();
 	}
 	
 	
-	// Default constructor
-	TreeData() = default;
+	// Free the nodes of the tree, except those already in 'seen', and add the nodes freed to 'seen'
+	void deleteNodes(std::unordered_set<const void*>& seen)
+	{
+		std::vector<TreeNode*> stack;
+		if (root != NULL)
+			stack.push_back(root);
+		while (!stack.empty())
+		{
+			TreeNode* node = stack.back();
+			stack.pop_back();
+			if (!seen.insert(node).second)
+				continue;
+			if (!node->getLeaf())
+			{
+				stack.push_back(node->getL()); stack.push_back(node->getR());
+			}
+			delete node;
+		}
+		root = NULL;
+		std::vector<FlatNode>().swap(layout);
+		std::vector<std::size_t>().swap(visitCounts);
+		std::vector<std::size_t>().swap(pathLengths);
+		clearPruningPath();
+	}
 	
 	
-	// Pruning properties of trees
-	void setMinLeafSize(const std::size_t& s) {minLeafSize = s;}
-	void setMaxDepth(const std::size_t& d) {maxDepth = d;}
-	void setNrSelectedFeatures(const std::size_t n) {subD = n; selectedFeatures.resize(subD);}
-	std::size_t getMinLeafSize() const {return minLeafSize;}
-	std::size_t getMaxDepth() const {return maxDepth;}
-	std::size_t getNrSelectedFeatures() {return subD;}
+	// Free the nodes of the tree, keeping its training data, so that it can be built again, e.g. with other
+	// settings or another row mask. Copies of the tree, which share its nodes, cannot be used afterwards.
+	void deleteNodes()
+	{
+		std::unordered_set<const void*> seen;
+		deleteNodes(seen);
+	}
 	
 	
-	// Predict output associated with new input data using tree
-	U predict(const std::vector<T>& in) const
+	// Replace the value of every leaf by fit(rows), where 'rows' holds the training examples the tree was
+	// built on which reach that leaf, e.g. with the Newton step of a round of gradient boosting
+	template<typename F>
+	void refitLeaves(F fit)
 	{
-		TreeNode* node = root;
-		while (true)
+		checkTrainingData();
+		std::vector<TreeNode*> nodes;
+		std::vector<std::size_t> parent;
+		numberNodes(nodes, parent);
+		std::unordered_map<TreeNode*, std::size_t> id;
+		for (std::size_t t = 0; t < nodes.size(); ++t)
+			id[nodes[t]] = t;
+		std::vector< std::vector<std::size_t> > rows(nodes.size());
+		routeExamples([&](TreeNode* node, const std::size_t& n)
 		{
 			if (node->getLeaf())
-				break;
-				
-			auto pr = node->getSplit();
-			if (in[pr.first] < pr.second)
-				node = node->getL();
-			else
-				node = node->getR();
-		}
-		return node->getVal();
+				rows[id[node]].push_back(n);
+		});
+		for (std::size_t t = 0; t < nodes.size(); ++t)
+			if (nodes[t]->getLeaf())
+				nodes[t]->setVal(fit(rows[t]));
+		layout.clear();
+	}
+	
+	
+	// Compile the tree into a predictor, then free everything the tree holds. The tree cannot be used
+	// afterwards, and nor can copies of it, which share its nodes.
+	TreePredictor<T, U> freeze()
+	{
+		TreePredictor<T, U> predictor = toPredictor();
+		std::unordered_set<const void*> seen;
+		release(seen);
+		return predictor;
 	}
 	
 	
@@ -363,6 +2187,9 @@ class ClassificationTree : public TreeData<T, U>
 	// Number of unique classes 
 	std::size_t K;
 	
+	// Position in 'classes' of the output of each training example
+	std::vector<std::size_t> labels;
+	
 	// Indicates whether impurity should be measured with entropy ('e') or Gini ('g')
 	char impurity{'e'};
 
@@ -377,7 +2204,56 @@ class ClassificationTree : public TreeData<T, U>
 		for (auto const& m : tally)
 			classes.push_back(m.first);
 		K = classes.size();
+		
+		std::unordered_map<U, std::size_t> pos;
+		for (std::size_t k = 0; k < K; ++k)
+			pos[classes[k]] = k;
+		labels.resize(this->N);
+		for (std::size_t n = 0; n < this->N; ++n)
+			labels[n] = pos[this->outputs[n]];
+	}
+	
+	
+	// Node statistics are the (weighted) number of examples of each class
+	std::size_t statWidth() const {return K;}
+	void addStats(double* st, const std::size_t& n, const double& w) const {st[labels[n]] += w;}
+	double statCount(const double* st) const
+	{
+		double count = 0;
+		for (std::size_t k = 0; k < K; ++k)
+			count += st[k];
+		return count;
+	}
+	
+	
+	// Entropy or Gini impurity of a node, multiplied by its number of examples
+	double nodeImpurity(const double* st) const {return classImpurity(st, K, impurity);}
+	
+	
+	// Most common class among the examples of a node
+	std::size_t majority(const double* st) const
+	{
+		std::size_t max = 0;
+		for (std::size_t k = 1; k < K; ++k)
+			if (st[k] > st[max])
+				max = k;
+		return max;
 	}
+	U leafValue(const double* st) const {return classes[majority(st)];}
+	
+	
+	// Categories are ordered by the fraction of their examples in the most common class of the node
+	double categoryKey(const double* st, const double* tot) const {return st[majority(tot)] / statCount(st);}
+	
+	
+	// Pruning measures the number of misclassified examples
+	double leafRisk(const double* st) const {return statCount(st) - st[majority(st)];}
+	double loss(const U& pred, const U& actual) const {return pred != actual;}
+	
+	
+	// Class labels kept for each training example
+	std::size_t targetBytes() const {return labels.capacity() * sizeof(std::size_t);}
+	void releaseTargets() {std::vector<std::size_t>().swap(labels);}
 	
 	
 	// Create map between classes and number of new output occurrences when moving along one split
@@ -488,12 +2364,13 @@ class ClassificationTree : public TreeData<T, U>
 		for (const auto& ftr : this->selectedFeatures)
 			if (inds[ftr].size() > 1)
 			{
+				PROFILE_COUNT(thresholds, inds[ftr].size() - 1);
 				initialFracs(lfracs, rfracs, ftr, inds, tal, nPts);
 				s = 0;
 				current = weightedImpurity(lfracs, rfracs, nPts);
 				this->compare(current, minVal, min, ftr, s);
 
-				for (auto& it = ++inds[ftr].begin(); it != --inds[ftr].end(); ++it)
+				for (auto it = ++inds[ftr].begin(); it != --inds[ftr].end(); ++it)
 				{
 					++s;
 					updateFracs(lfracs, rfracs, ftr, it);
@@ -510,7 +2387,9 @@ class ClassificationTree : public TreeData<T, U>
 		split(std::vector< std::map< std::size_t, std::set< std::size_t> > >& inds,
 			std::unordered_map<U, std::size_t>& tal, const std::size_t& nPts) const
 	{
+		PROFILE_PHASE(CREATE_SPLITS);
 		std::map< std::size_t, std::vector<double> > splits = this->createSplits(inds);
+		PROFILE_NEXT(CHOOSE_SPLIT);
 		std::pair<std::size_t, std::size_t> min = chooseSplit(inds, tal, nPts);
 		std::size_t d = min.first, s = min.second;
 		return std::make_tuple(splits[d][s], d, s);
@@ -530,6 +2409,7 @@ class ClassificationTree : public TreeData<T, U>
 		const auto tp = split(inds, tal, nPts);
 		double splitVal = std::get<0>(tp);
 		std::size_t dSplit = std::get<1>(tp), splitPnt = std::get<2>(tp);
+		PROFILE_PHASE(SPLIT_INDICES);
 		
 		// Initialise variables
 		std::size_t pos, *loc, rNPts = 0;
@@ -586,6 +2466,7 @@ class ClassificationTree : public TreeData<T, U>
 					done = true;
 				}
 		}
+		PROFILE_COUNT(rowsMoved, rNPts);
 		return std::make_tuple(dSplit, splitVal, rInds, rTal, rNPts);
 	}
 	
@@ -594,6 +2475,8 @@ class ClassificationTree : public TreeData<T, U>
 	std::pair<bool, U> isLeaf(const std::unordered_map<U, std::size_t>& tal, const std::size_t& nPts, 
 	        const std::size_t& depth, const std::vector< std::map< std::size_t, std::set< std::size_t> > >& inds) const
 	{
+		PROFILE_PHASE(LEAVES);
+		
 		// Check if any of the early stopping criteria are satisfied
 		if (nPts <= this->minLeafSize || depth >= this->maxDepth || this->identicalInputs(inds))
 		{
@@ -623,8 +2506,10 @@ class ClassificationTree : public TreeData<T, U>
 		
 		// Check if node is leaf
 		std::pair<bool, U> leaf = isLeaf(tal, nPts, depth, inds);   
+		PROFILE_COUNT(nodes, 1);
 		if (leaf.first)
 		{
+			PROFILE_COUNT(leaves, 1);
 			TreeNode* n = new TreeNode(leaf.second);
 			return n;
 		}	
@@ -666,6 +2551,11 @@ public:
 	: TreeData<T, U>(in, out) {findClasses();}
 	
 	
+	// Constructor for sparse inputs
+	ClassificationTree(const SparseMatrix<T>& in, std::vector<U> out)
+	: TreeData<T, U>(in, out) {findClasses();}
+	
+	
 	// Default constructor
 	ClassificationTree() = default;
 	
@@ -680,11 +2570,28 @@ public:
 	char getImpurity() {return impurity;}
 	
 
-	// Build tree with initial call to the recursive function makeBranches(...)
+	// Build tree with initial call to the recursive function makeBranches(...), or level by level or best-first
 	void buildTree()
 	{
-		std::size_t depth = 0;
-		this->root = makeBranches(this->indices, tally, this->N, depth);
+		this->checkMemoryBudget();
+		this->layout.clear();
+		this->clearPruningPath();
+		PROFILE_CLEAR();
+		if (this->growthOrder() == 'b')
+		{
+			this->root = this->bestFirst();
+			return;
+		}
+		if (this->growthOrder() == 'l')
+		{
+			this->root = this->levelWise();
+			return;
+		}
+		std::size_t depth = 0, nPts = this->N;
+		std::unordered_map<U, std::size_t> tal = tally;
+		this->presort();
+		this->root = makeBranches(this->indices, tal, nPts, depth);
+		this->releaseIndices();
 	}
 	
 };
@@ -728,13 +2635,12 @@ class RegressionTree : public TreeData<T, U>
 	{
 		totSum = 0; totSqSum = 0;
 		U out;
-		for (auto& set : this->indices[0])
-			for (auto& el : set.second)
-			{
-				out = this->outputs[el];
-				totSum += out;
-				totSqSum += pow(out, 2);
-			}
+		for (std::size_t n = 0; n < this->N; ++n)
+		{
+			out = this->outputs[n];
+			totSum += out;
+			totSqSum += pow(out, 2);
+		}
 	}
 	
 	
@@ -797,13 +2703,14 @@ class RegressionTree : public TreeData<T, U>
 		for (const auto& ftr : this->selectedFeatures)
 			if (inds[ftr].size() > 1)
 			{
+				PROFILE_COUNT(thresholds, inds[ftr].size() - 1);
 				initialSums(sum, sqsum, lsum, rsum, lsqsum, rsqsum, ftr, inds);
 				lNPts = 1;
 				s = 0;
 				current = weightedVariance(lsum, rsum, lsqsum, rsqsum, nPts, lNPts);
 				this->compare(current, minVal, min, ftr, s);
 
-				for (auto& it = ++inds[ftr].begin(); it != --inds[ftr].end(); ++it)
+				for (auto it = ++inds[ftr].begin(); it != --inds[ftr].end(); ++it)
 				{
 					++lNPts;
 					++s;
@@ -821,7 +2728,9 @@ class RegressionTree : public TreeData<T, U>
 		split(std::vector< std::map< std::size_t, std::set< std::size_t> > >& inds,
 			U& sum, U& sqsum, const std::size_t& nPts) const
 	{
+		PROFILE_PHASE(CREATE_SPLITS);
 		std::map< std::size_t, std::vector<double> > splits = this->createSplits(inds);
+		PROFILE_NEXT(CHOOSE_SPLIT);
 		std::pair<std::size_t, std::size_t> min = chooseSplit(inds, sum, sqsum, nPts);
 		std::size_t d = min.first, s = min.second;
 		return std::make_tuple(splits[d][s], d, s);
@@ -839,6 +2748,7 @@ class RegressionTree : public TreeData<T, U>
 		const auto tp = split(inds, sum, sqsum, nPts);
 		double splitVal = std::get<0>(tp);
 		std::size_t dSplit = std::get<1>(tp), splitPnt = std::get<2>(tp);
+		PROFILE_PHASE(SPLIT_INDICES);
 		
 		// Initialise variables
 		std::size_t pos, *loc, rNPts = 0;
@@ -894,14 +2804,48 @@ class RegressionTree : public TreeData<T, U>
 					done = true;
 				}
 		}
+		PROFILE_COUNT(rowsMoved, rNPts);
 		return std::make_tuple(dSplit, splitVal, rInds, rSum, rSqSum, rNPts);
 	}	
 	
 	
+	// Node statistics are the (weighted) number of examples, sum of outputs and square sum of outputs
+	std::size_t statWidth() const {return 3;}
+	void addStats(double* st, const std::size_t& n, const double& w) const
+	{
+		double out = this->outputs[n];
+		st[0] += w; st[1] += w * out; st[2] += w * out * out;
+	}
+	double statCount(const double* st) const {return st[0];}
+	
+	
+	// Sum of squared deviations from the mean output of a node
+	double nodeImpurity(const double* st) const {return varianceImpurity(st);}
+	
+	
+	// Mean output of the examples of a node
+	U leafValue(const double* st) const {return st[1] / st[0];}
+	
+	
+	// Categories are ordered by their mean output
+	double categoryKey(const double* st, const double*) const {return st[1] / st[0];}
+	
+	
+	// Pruning measures the sum of squared errors
+	double leafRisk(const double* st) const {return nodeImpurity(st);}
+	double loss(const U& pred, const U& actual) const {return pow(pred - actual, 2);}
+	
+	
+	// Outputs are the only targets, which are part of the training data
+	std::size_t targetBytes() const {return 0;}
+	void releaseTargets() {}
+	
+	
 	// Check if a node is a leaf. If it is, also return output value at the leaf.
 	std::pair<bool, double> isLeaf(const U& sum, const std::size_t& nPts, const std::size_t& depth,
 	            const std::vector< std::map< std::size_t, std::set< std::size_t> > >& inds) const
 	{
+		PROFILE_PHASE(LEAVES);
 		if (nPts <= this->minLeafSize || depth >= this->maxDepth || this->identicalInputs(inds))
 			return std::make_pair(true, (double)sum / nPts);
 		return std::make_pair(false, 0);
@@ -917,8 +2861,10 @@ class RegressionTree : public TreeData<T, U>
 		
 		// Check if node is leaf
 		std::pair<bool, double> leaf = isLeaf(sum, nPts, depth, inds);
+		PROFILE_COUNT(nodes, 1);
 		if (leaf.first)
 		{
+			PROFILE_COUNT(leaves, 1);
 			TreeNode* n = new TreeNode(leaf.second);
 			return n;
 		}	
@@ -963,15 +2909,55 @@ public:
 	}
 	
 	
+	// Constructor for sparse inputs
+	RegressionTree(const SparseMatrix<T>& in, std::vector<U> out)
+	: TreeData<T, U>(in, out)
+	{
+		totalSums();
+		this->setMinLeafSize(10);
+	}
+	
+	
 	// Default constructor
 	RegressionTree() = default;
 
 
-	// Build tree with initial call to the recursive function makeBranches(...)
+	// Replace the outputs the tree is fitted to, keeping its inputs and any sorted columns or row mask, e.g.
+	// to fit the gradients of each round of gradient boosting without preparing the inputs again
+	void setOutputs(std::vector<U> out)
+	{
+		this->checkTrainingData();
+		if (out.size() != this->N)
+			throw std::invalid_argument("Number of outputs (" + std::to_string(out.size())
+					+ ") does not match the number of examples (" + std::to_string(this->N) + ")\n");
+		this->outputs = std::move(out);
+		this->clearPruningPath();
+		totalSums();
+	}
+
+
+	// Build tree with initial call to the recursive function makeBranches(...), or level by level or best-first
 	void buildTree()
 	{
-		std::size_t depth = 0;
-		this->root = makeBranches(this->indices, totSum, totSqSum, this->N, depth);
+		this->checkMemoryBudget();
+		this->layout.clear();
+		this->clearPruningPath();
+		PROFILE_CLEAR();
+		if (this->growthOrder() == 'b')
+		{
+			this->root = this->bestFirst();
+			return;
+		}
+		if (this->growthOrder() == 'l')
+		{
+			this->root = this->levelWise();
+			return;
+		}
+		std::size_t depth = 0, nPts = this->N;
+		U sum = totSum, sqsum = totSqSum;
+		this->presort();
+		this->root = makeBranches(this->indices, sum, sqsum, nPts, depth);
+		this->releaseIndices();
 	}
 
 	
@@ -0,0 +1,389 @@
+
+#ifndef _TUNING_
+#define _TUNING_
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <type_traits>
+#include "bagging.h"
+
+
+// Hyperparameters of a tree. A value of 0 leaves the default of the tree: unlimited depth, the minimum
+// leaf size of its constructor, and all features checked at each node. The impurity only applies to classification trees.
+class TreeParameters
+{
+public:
+	std::size_t maxDepth{0}, minLeafSize{0}, nrSelectedFeatures{0};
+	char impurity{'e'};
+};
+
+
+
+// Candidate values of each hyperparameter. A hyperparameter without candidates keeps its default value.
+class ParameterGrid
+{
+public:
+	std::vector<std::size_t> maxDepth, minLeafSize, nrSelectedFeatures;
+	std::vector<char> impurity;
+
+
+	// Number of combinations of candidate values
+	std::size_t size() const
+	{
+		return std::max<std::size_t>(1, maxDepth.size()) * std::max<std::size_t>(1, minLeafSize.size())
+			* std::max<std::size_t>(1, nrSelectedFeatures.size()) * std::max<std::size_t>(1, impurity.size());
+	}
+
+
+	// Combination with the given position, counting through the candidates of the last hyperparameter first
+	TreeParameters at(std::size_t i) const
+	{
+		TreeParameters p;
+		auto pick = [&i](auto& value, const auto& candidates)
+		{
+			if (!candidates.empty())
+			{
+				value = candidates[i % candidates.size()];
+				i /= candidates.size();
+			}
+		};
+		pick(p.impurity, impurity);
+		pick(p.nrSelectedFeatures, nrSelectedFeatures);
+		pick(p.minLeafSize, minLeafSize);
+		pick(p.maxDepth, maxDepth);
+		return p;
+	}
+
+
+	// Every combination of candidate values
+	std::vector<TreeParameters> combinations() const
+	{
+		std::vector<TreeParameters> all;
+		for (std::size_t i = 0; i < size(); ++i)
+			all.push_back(at(i));
+		return all;
+	}
+
+
+	// A random selection of n distinct combinations (all of them if there are fewer), reproducible from the seed
+	std::vector<TreeParameters> sample(const std::size_t& n, const unsigned& seed = 0) const
+	{
+		std::vector<std::size_t> positions(size()), chosen;
+		std::iota(positions.begin(), positions.end(), 0);
+		std::mt19937 gen(seed);
+		std::sample(positions.begin(), positions.end(), std::back_inserter(chosen), n, gen);
+		std::shuffle(chosen.begin(), chosen.end(), gen);
+		std::vector<TreeParameters> selection;
+		for (const std::size_t& i : chosen)
+			selection.push_back(at(i));
+		return selection;
+	}
+};
+
+
+
+// Cross-validated score of one combination of hyperparameters: the mean and standard deviation over the
+// folds of the validation error (classification error, or mean square error for regression), and the
+// fraction of the training examples of each fold that the trees were built on
+class ValidationResult
+{
+public:
+	TreeParameters parameters;
+	std::vector<double> foldErrors;
+	double error, deviation, fraction;
+};
+
+
+
+
+// k-fold cross-validation of trees of type Tr (ClassificationTree or RegressionTree), and search over
+// their hyperparameters. The examples are sorted along each feature once, and every tree of every fold
+// and every combination of hyperparameters is grown from those shared sorted columns, with its training
+// folds selected by a row mask instead of copying them into a new dataset. Trees are built in parallel
+// on a given number of threads, each of which holds one copy of the data and rebuilds a single tree.
+template<typename Tr, typename T, typename U>
+class CrossValidation
+{
+
+	// MEMBER OBJECTS
+
+	// Inputs and outputs of all examples
+	std::vector< std::vector<T> > inputs;
+	std::vector<U> outputs;
+
+	// Number of folds, the fold of each example, and the examples of each fold
+	std::size_t K;
+	std::vector<std::size_t> foldOf;
+	std::vector< std::vector<std::size_t> > folds;
+
+	// Position of each example in a random order, so that the first examples of that order form a training
+	// subsample of any size for successive halving
+	std::vector<std::size_t> rank;
+
+	// Examples sorted along each feature, shared by all trees and only computed once
+	SortedColumns<T> columns;
+
+	// Number of threads building trees, order of tree growth ('l' or 'b') and categorical features
+	std::size_t nrThreads;
+	char growth{'l'};
+	std::vector<std::size_t> categoricalFeatures;
+
+
+	// METHODS
+
+	// Whether the trees are classification trees, scored by classification error
+	static constexpr bool classification() {return std::is_base_of< ClassificationTree<T, U>, Tr >::value;}
+
+
+	// Prepare a tree built on all examples with the settings shared by every combination of hyperparameters
+	Tr makeTree() const
+	{
+		Tr tree(inputs, outputs);
+		tree.setGrowth(growth);
+		for (const std::size_t& d : categoricalFeatures)
+			tree.setCategorical(d);
+		return tree;
+	}
+
+
+	// Set the hyperparameters of a tree
+	void configure(Tr& tree, const TreeParameters& p) const
+	{
+		tree.setMaxDepth(p.maxDepth > 0 ? p.maxDepth : inputs.size());
+		if (p.minLeafSize > 0)
+			tree.setMinLeafSize(p.minLeafSize);
+		tree.setNrSelectedFeatures(p.nrSelectedFeatures > 0 ? std::min(p.nrSelectedFeatures, inputs[0].size()) : inputs[0].size());
+		if constexpr (classification())
+			tree.setImpurity(p.impurity);
+	}
+
+
+	// Mean validation error over the examples of a fold
+	double foldError(const Tr& tree, const std::vector<std::size_t>& rows) const
+	{
+		double error = 0;
+		for (const std::size_t& n : rows)
+		{
+			U pred = tree.predict(inputs[n]);
+			if constexpr (classification())
+				error += (pred != outputs[n]);
+			else
+				error += ((double)pred - (double)outputs[n]) * ((double)pred - (double)outputs[n]);
+		}
+		return error / rows.size();
+	}
+
+
+
+public:
+
+	// Constructor, which assigns the examples to k folds at random, reproducibly from the seed. Folds of
+	// classification examples preserve the class proportions.
+	CrossValidation(std::vector< std::vector<T> > in, std::vector<U> out, const std::size_t& k = 5, const unsigned& seed = 0)
+	: inputs(std::move(in)), outputs(std::move(out)), K(k), folds(k)
+	{
+		const std::size_t N = inputs.size();
+		if (K < 2 || K > N)
+			throw std::invalid_argument("Number of folds must be between 2 and the number of examples (" + std::to_string(N) + ")\n");
+		if (outputs.size() != N)
+			throw std::invalid_argument("Number of outputs (" + std::to_string(outputs.size())
+					+ ") does not match the number of inputs (" + std::to_string(N) + ")\n");
+
+		// Deal the examples of each group out to the folds in turn, continuing from one group to the next
+		std::mt19937 gen(seed);
+		foldOf.resize(N);
+		std::size_t next = 0;
+		for (auto& group : bootstrapGroups(outputs, classification()))
+		{
+			std::shuffle(group.begin(), group.end(), gen);
+			for (const std::size_t& n : group)
+			{
+				foldOf[n] = next;
+				folds[next].push_back(n);
+				next = (next + 1) % K;
+			}
+		}
+
+		std::vector<std::size_t> order(N);
+		std::iota(order.begin(), order.end(), 0);
+		std::shuffle(order.begin(), order.end(), gen);
+		rank.resize(N);
+		for (std::size_t i = 0; i < N; ++i)
+			rank[order[i]] = i;
+		nrThreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+
+	// Number of threads building trees at the same time, each holding a copy of the data
+	void setThreads(const std::size_t& n) {nrThreads = std::max<std::size_t>(1, n);}
+	std::size_t getThreads() const {return nrThreads;}
+
+
+	// Order of growth of the trees, level-wise ('l', default) or best-first ('b'), since trees built on
+	// a subset of the examples cannot grow depth-first
+	void setGrowth(char c)
+	{
+		if (c != 'l' && c != 'b')
+			throw std::invalid_argument("Trees built on folds must grow level-wise ('l') or best-first ('b')\n");
+		growth = c;
+	}
+
+
+	// Treat the values of a feature as unordered categories in every tree
+	void setCategorical(const std::size_t& d)
+	{
+		if (d >= inputs[0].size())
+			throw std::invalid_argument("Feature " + std::to_string(d) + " does not exist\n");
+		categoricalFeatures.push_back(d);
+	}
+
+
+	// Number of folds, and fold of each example
+	std::size_t nrFolds() const {return K;}
+	const std::vector<std::size_t>& getFolds() const {return foldOf;}
+
+
+	// Cross-validate each combination of hyperparameters, building the trees of each fold from a fraction
+	// of its training examples (all of them by default). Every (combination, fold) pair is a task, and the
+	// tasks are shared out between the threads. Results are sorted by increasing mean validation error.
+	std::vector<ValidationResult> evaluate(const std::vector<TreeParameters>& candidates, const double& fraction = 1)
+	{
+		if (fraction <= 0 || fraction > 1)
+			throw std::invalid_argument("Fraction of training examples must be in (0, 1]\n");
+		const std::size_t N = inputs.size(), M = candidates.size() * K;
+		const std::size_t limit = std::min<std::size_t>(N, std::max<std::size_t>(2 * K, std::lround(fraction * N)));
+		if (columns.order.empty())
+			columns = makeTree().sortColumns();
+
+		std::vector<double> errors(M);
+		std::atomic<std::size_t> next{0};
+		std::exception_ptr failure;
+		std::mutex failureLock;
+		auto work = [&]()
+		{
+			try
+			{
+				// The tree is reused for every task, so its own minimum leaf size is restored before each
+				Tr tree = makeTree();
+				tree.setPresorted(&columns);
+				const std::size_t minLeafSize = tree.getMinLeafSize();
+				std::vector<char> mask(N);
+				for (std::size_t task = next++; task < M; task = next++)
+				{
+					std::size_t c = task / K, f = task % K;
+					for (std::size_t n = 0; n < N; ++n)
+						mask[n] = (foldOf[n] != f && rank[n] < limit);
+					tree.setMinLeafSize(minLeafSize);
+					configure(tree, candidates[c]);
+					tree.setRowMask(mask);
+					tree.buildTree();
+					errors[task] = foldError(tree, folds[f]);
+					tree.deleteNodes();
+				}
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> guard(failureLock);
+				failure = std::current_exception();
+				next = M;
+			}
+		};
+		std::vector<std::thread> threads;
+		for (std::size_t t = 1; t < std::min(nrThreads, M); ++t)
+			threads.emplace_back(work);
+		work();
+		for (auto& thread : threads)
+			thread.join();
+		if (failure)
+			std::rethrow_exception(failure);
+
+		std::vector<ValidationResult> results(candidates.size());
+		for (std::size_t c = 0; c < candidates.size(); ++c)
+		{
+			ValidationResult& r = results[c];
+			r.parameters = candidates[c];
+			r.foldErrors.assign(errors.begin() + c*K, errors.begin() + (c+1)*K);
+			r.error = std::accumulate(r.foldErrors.begin(), r.foldErrors.end(), 0.0) / K;
+			double sq = 0;
+			for (const double& e : r.foldErrors)
+				sq += (e - r.error) * (e - r.error);
+			r.deviation = std::sqrt(sq / K);
+			r.fraction = fraction;
+		}
+		std::stable_sort(results.begin(), results.end(),
+			[](const ValidationResult& r1, const ValidationResult& r2) {return r1.error < r2.error;});
+		return results;
+	}
+	ValidationResult evaluate(const TreeParameters& parameters)
+	{
+		return evaluate(std::vector<TreeParameters>{parameters})[0];
+	}
+
+
+	// Cross-validate every combination of the candidate values
+	std::vector<ValidationResult> gridSearch(const ParameterGrid& grid)
+	{
+		return evaluate(grid.combinations());
+	}
+
+
+	// Cross-validate n combinations of the candidate values drawn at random, reproducibly from the seed
+	std::vector<ValidationResult> randomSearch(const ParameterGrid& grid, const std::size_t& n, const unsigned& seed = 0)
+	{
+		return evaluate(grid.sample(n, seed));
+	}
+
+
+	// Successive halving (Jamieson and Talwalkar, 2016): all candidates are first cross-validated with trees
+	// built on a small fraction of the training examples, and only the best 1/eta of them go on to the
+	// next round, which uses eta times more examples, until the last round uses all of them. The result
+	// holds the last score of every candidate, the candidates of later rounds first, each round sorted by
+	// increasing error, so the best candidate comes first.
+	std::vector<ValidationResult> successiveHalving(const std::vector<TreeParameters>& candidates, const std::size_t& eta = 3)
+	{
+		if (eta < 2)
+			throw std::invalid_argument("Successive halving needs a reduction factor of at least 2\n");
+		std::size_t rounds = 0;
+		for (std::size_t m = candidates.size(); m > 1; m = (m + eta - 1) / eta)
+			++rounds;
+		std::vector<TreeParameters> remaining = candidates;
+		std::vector<ValidationResult> eliminated;
+		for (std::size_t r = 0; ; ++r)
+		{
+			std::vector<ValidationResult> results = evaluate(remaining, std::pow((double)eta, (double)r - (double)rounds));
+			std::size_t keep = (results.size() + eta - 1) / eta;
+			if (r == rounds || keep == results.size())
+			{
+				results.insert(results.end(), eliminated.rbegin(), eliminated.rend());
+				return results;
+			}
+			remaining.clear();
+			for (std::size_t i = 0; i < keep; ++i)
+				remaining.push_back(results[i].parameters);
+			for (std::size_t i = results.size(); i-- > keep; )
+				eliminated.push_back(results[i]);
+		}
+	}
+	std::vector<ValidationResult> successiveHalving(const ParameterGrid& grid, const std::size_t& eta = 3)
+	{
+		return successiveHalving(grid.combinations(), eta);
+	}
+
+
+	// Build a tree on all examples with the given hyperparameters, e.g. the best ones found by a search
+	Tr train(const TreeParameters& parameters) const
+	{
+		Tr tree = makeTree();
+		configure(tree, parameters);
+		tree.buildTree();
+		return tree;
+	}
+
+};
+
+
+
+
+#endif     // _TUNING_